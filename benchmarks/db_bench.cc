@@ -4,6 +4,7 @@
 
 #include "db/db_impl.h"
 #include <atomic>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <thread>
@@ -37,11 +38,13 @@
 //      readaddrreverse
 //      fetchvaluefromaddr
 //      readrandom    -- read N times in random order
+//      multireadrandom -- read N times in random order, in MultiGet batches
 //      readmissing   -- read N missing keys in random order
 //      readhot       -- read N times in random order from 1% section of DB
+//      readzipfian   -- read N times with zipfian distributed keys
 //      seekrandom    -- N random seeks
 //      seekordered   -- N ordered seeks
-//      open          -- cost of opening a DB
+//      open          -- cost of reopening the DB, including vlog replay
 //      crc32c        -- repeated crc32c of 4K of data
 //   Meta operations:
 //      compact     -- Compact the entire DB
@@ -53,8 +56,10 @@ static const char* FLAGS_benchmarks =
     "fillsync,"
     "fillrandom,"
     "overwrite,"
+    "open,"
     "readrandom,"
     "readrandom,"  // Extra run to allow previous compactions to quiesce
+    "multireadrandom,"
     "readseq,"
     "readreverse,"
     "readaddrseq,"
@@ -63,6 +68,8 @@ static const char* FLAGS_benchmarks =
     "fetchvaluefromaddr,"
     "compact,"
     "readrandom,"
+    "readhot,"
+    "readzipfian,"
     "readseq,"
     "readreverse,"
     "fill100K,"
@@ -104,10 +111,31 @@ static int FLAGS_max_file_size = 0;
 // (initialized to default value by "main")
 static int FLAGS_block_size = 0;
 
+// If true, data blocks get a hash index for point lookups.
+static bool FLAGS_data_block_hash_index = false;
+
+// If true, index and filter blocks are split into partitions that are
+// read through the block cache.
+static bool FLAGS_partition_index_and_filters = false;
+
 // Number of bytes to use as a cache of uncompressed data.
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// Number of bytes to use as a cache of values read from the vlogs.
+// Negative means no value cache.
+static int FLAGS_value_cache_size = -1;
+
+// Number of bytes to use as a cache of the vlog addresses of recently read
+// keys.  Negative means no address cache.
+static int FLAGS_address_cache_size = -1;
+
+// Number of keys looked up by each MultiGet call of multireadrandom.
+static int FLAGS_multiget_batch_size = 64;
+
+// Skew of the keys read by readzipfian, in (0, 1).
+static double FLAGS_zipfian_theta = 0.99;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
@@ -115,6 +143,9 @@ static int FLAGS_open_files = 0;
 // Negative means use default settings.
 static int FLAGS_bloom_bits = -1;
 
+// If true, use NewBlockedBloomFilterPolicy() for the bloom filters.
+static bool FLAGS_blocked_bloom = false;
+
 // Common key prefix length.
 static int FLAGS_key_prefix = 0;
 
@@ -126,6 +157,26 @@ static bool FLAGS_use_existing_db = false;
 // If true, reuse existing log/MANIFEST files when re-opening a database.
 static bool FLAGS_reuse_logs = false;
 
+// Values smaller than this are stored inline in the LSM-tree instead of
+// being read back from the vlog.
+// (initialized to default value by "main")
+static int FLAGS_min_blob_size = 0;
+
+// Size of the buffer that vlog records are appended through.
+// (initialized to default value by "main")
+static int FLAGS_vlog_write_buffer_size = 0;
+
+// If true, the next write group appends to the vlog while the previous
+// one is applied to the memtable.
+static bool FLAGS_enable_pipelined_write = false;
+
+// If true, read and write the vlogs with direct I/O.
+static bool FLAGS_use_direct_io_for_vlog = false;
+
+// Microseconds a vlog sync may wait to cover more synchronous writes.
+// (initialized to default value by "main")
+static int FLAGS_max_sync_delay_micros = 0;
+
 // Use the db with the following name.
 static const char* FLAGS_db = nullptr;
 
@@ -193,6 +244,40 @@ class RandomGenerator {
   }
 };
 
+// Generates ranks in [0, n) following a zipfian distribution, rank 0 being
+// the most popular.  See Gray et al., "Quickly Generating Billion-Record
+// Synthetic Databases", SIGMOD 1994.
+class ZipfianGenerator {
+ public:
+  ZipfianGenerator(uint64_t n, double theta) : n_(n), theta_(theta) {
+    double zeta2 = 0;
+    zetan_ = 0;
+    for (uint64_t i = 1; i <= n_; i++) {
+      zetan_ += 1.0 / std::pow(static_cast<double>(i), theta_);
+      if (i == 2) zeta2 = zetan_;
+    }
+    alpha_ = 1.0 / (1.0 - theta_);
+    eta_ = (1.0 - std::pow(2.0 / n_, 1.0 - theta_)) / (1.0 - zeta2 / zetan_);
+  }
+
+  uint64_t Next(Random* rnd) {
+    const double u = static_cast<double>(rnd->Next()) / 2147483647.0;
+    const double uz = u * zetan_;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + std::pow(0.5, theta_)) return 1;
+    uint64_t rank =
+        static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+    return rank < n_ ? rank : n_ - 1;
+  }
+
+ private:
+  const uint64_t n_;
+  const double theta_;
+  double zetan_;
+  double alpha_;
+  double eta_;
+};
+
 class KeyBuffer {
  public:
   KeyBuffer() {
@@ -377,6 +462,8 @@ struct ThreadState {
 class Benchmark {
  private:
   Cache* cache_;
+  Cache* value_cache_;
+  Cache* address_cache_;
   const FilterPolicy* filter_policy_;
   DB* db_;
   int num_;
@@ -469,9 +556,16 @@ class Benchmark {
  public:
   Benchmark()
       : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : nullptr),
-        filter_policy_(FLAGS_bloom_bits >= 0
-                           ? NewBloomFilterPolicy(FLAGS_bloom_bits)
+        value_cache_(FLAGS_value_cache_size >= 0
+                         ? NewLRUCache(FLAGS_value_cache_size)
+                         : nullptr),
+        address_cache_(FLAGS_address_cache_size >= 0
+                           ? NewLRUCache(FLAGS_address_cache_size)
                            : nullptr),
+        filter_policy_(FLAGS_bloom_bits < 0 ? nullptr
+                       : FLAGS_blocked_bloom
+                           ? NewBlockedBloomFilterPolicy(FLAGS_bloom_bits)
+                           : NewBloomFilterPolicy(FLAGS_bloom_bits)),
         db_(nullptr),
         num_(FLAGS_num),
         value_size_(FLAGS_value_size),
@@ -495,6 +589,8 @@ class Benchmark {
   ~Benchmark() {
     delete db_;
     delete cache_;
+    delete value_cache_;
+    delete address_cache_;
     delete filter_policy_;
   }
 
@@ -564,6 +660,9 @@ class Benchmark {
         method = &Benchmark::FetchValueFromAddrList;
       } else if (name == Slice("readrandom")) {
         method = &Benchmark::ReadRandom;
+      } else if (name == Slice("multireadrandom")) {
+        entries_per_batch_ = FLAGS_multiget_batch_size;
+        method = &Benchmark::MultiReadRandom;
       } else if (name == Slice("readmissing")) {
         method = &Benchmark::ReadMissing;
       } else if (name == Slice("seekrandom")) {
@@ -572,6 +671,8 @@ class Benchmark {
         method = &Benchmark::SeekOrdered;
       } else if (name == Slice("readhot")) {
         method = &Benchmark::ReadHot;
+      } else if (name == Slice("readzipfian")) {
+        method = &Benchmark::ReadZipfian;
       } else if (name == Slice("readrandomsmall")) {
         reads_ /= 1000;
         method = &Benchmark::ReadRandom;
@@ -776,15 +877,24 @@ class Benchmark {
     options.env = g_env;
     options.create_if_missing = !FLAGS_use_existing_db;
     options.block_cache = cache_;
+    options.value_cache = value_cache_;
+    options.address_cache = address_cache_;
     options.write_buffer_size = FLAGS_write_buffer_size;
     options.max_file_size = FLAGS_max_file_size;
     options.block_size = FLAGS_block_size;
+    options.use_data_block_hash_index = FLAGS_data_block_hash_index;
+    options.partition_index_and_filters = FLAGS_partition_index_and_filters;
     if (FLAGS_comparisons) {
       options.comparator = &count_comparator_;
     }
     options.max_open_files = FLAGS_open_files;
     options.filter_policy = filter_policy_;
     options.reuse_logs = FLAGS_reuse_logs;
+    options.min_blob_size = FLAGS_min_blob_size;
+    options.vlog_write_buffer_size = FLAGS_vlog_write_buffer_size;
+    options.use_direct_io_for_vlog = FLAGS_use_direct_io_for_vlog;
+    options.enable_pipelined_write = FLAGS_enable_pipelined_write;
+    options.max_sync_delay_micros = FLAGS_max_sync_delay_micros;
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
       std::fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -835,7 +945,9 @@ class Benchmark {
   }
 
   void ReadSequential(ThreadState* thread) {
-    Iterator* iter = db_->NewIterator(ReadOptions());
+    ReadOptions options;
+    options.readahead_hint = reads_;
+    Iterator* iter = db_->NewIterator(options);
     int i = 0;
     int64_t bytes = 0;
     for (iter->SeekToFirst(); i < reads_ && iter->Valid(); iter->Next()) {
@@ -849,7 +961,9 @@ class Benchmark {
   }
 
   void ReadReverse(ThreadState* thread) {
-    Iterator* iter = db_->NewIterator(ReadOptions());
+    ReadOptions options;
+    options.readahead_hint = reads_;
+    Iterator* iter = db_->NewIterator(options);
     int i = 0;
     int64_t bytes = 0;
     for (iter->SeekToLast(); i < reads_ && iter->Valid(); iter->Prev()) {
@@ -955,6 +1069,35 @@ class Benchmark {
     thread->stats.AddMessage(msg);
   }
 
+  void MultiReadRandom(ThreadState* thread) {
+    ReadOptions options;
+    std::vector<std::string> key_data(entries_per_batch_);
+    std::vector<Slice> keys(entries_per_batch_);
+    std::vector<std::string> values(entries_per_batch_);
+    std::vector<Status> statuses(entries_per_batch_);
+    int found = 0;
+    KeyBuffer key;
+    for (int i = 0; i < reads_; i += entries_per_batch_) {
+      const int n = std::min(entries_per_batch_, reads_ - i);
+      for (int j = 0; j < n; j++) {
+        const int k = thread->rand.Uniform(FLAGS_num);
+        key.Set(k);
+        key_data[j] = key.slice().ToString();
+        keys[j] = key_data[j];
+      }
+      db_->MultiGet(options, n, keys.data(), values.data(), statuses.data());
+      for (int j = 0; j < n; j++) {
+        if (statuses[j].ok()) {
+          found++;
+        }
+        thread->stats.FinishedSingleOp();
+      }
+    }
+    char msg[100];
+    std::snprintf(msg, sizeof(msg), "(%d of %d found)", found, num_);
+    thread->stats.AddMessage(msg);
+  }
+
   void ReadMissing(ThreadState* thread) {
     ReadOptions options;
     std::string value;
@@ -973,12 +1116,63 @@ class Benchmark {
     std::string value;
     const int range = (FLAGS_num + 99) / 100;
     KeyBuffer key;
+    uint64_t hits, misses;
+    GetValueCacheStats(&hits, &misses);
     for (int i = 0; i < reads_; i++) {
       const int k = thread->rand.Uniform(range);
       key.Set(k);
       db_->Get(options, key.slice(), &value);
       thread->stats.FinishedSingleOp();
     }
+    AddValueCacheMessage(thread, hits, misses);
+  }
+
+  void ReadZipfian(ThreadState* thread) {
+    ReadOptions options;
+    std::string value;
+    ZipfianGenerator zipf(FLAGS_num, FLAGS_zipfian_theta);
+    int found = 0;
+    KeyBuffer key;
+    uint64_t hits, misses;
+    GetValueCacheStats(&hits, &misses);
+    for (int i = 0; i < reads_; i++) {
+      key.Set(static_cast<int>(zipf.Next(&thread->rand)));
+      if (db_->Get(options, key.slice(), &value).ok()) {
+        found++;
+      }
+      thread->stats.FinishedSingleOp();
+    }
+    char msg[100];
+    std::snprintf(msg, sizeof(msg), "(%d of %d found)", found, reads_);
+    thread->stats.AddMessage(msg);
+    AddValueCacheMessage(thread, hits, misses);
+  }
+
+  void GetValueCacheStats(uint64_t* hits, uint64_t* misses) {
+    std::string stats;
+    unsigned long long h = 0, m = 0;
+    if (db_->GetProperty("leveldb.value-cache", &stats)) {
+      std::sscanf(stats.c_str(), "hits: %llu misses: %llu", &h, &m);
+    }
+    *hits = h;
+    *misses = m;
+  }
+
+  // Reports the value cache hit rate since the counts in "hits0" and
+  // "misses0" were taken.  The counts are shared by all threads.
+  void AddValueCacheMessage(ThreadState* thread, uint64_t hits0,
+                            uint64_t misses0) {
+    if (value_cache_ == nullptr) {
+      return;
+    }
+    uint64_t hits, misses;
+    GetValueCacheStats(&hits, &misses);
+    hits -= hits0;
+    misses -= misses0;
+    char msg[100];
+    std::snprintf(msg, sizeof(msg), "(value cache hit rate %.1f%%)",
+                  hits + misses == 0 ? 0.0 : 100.0 * hits / (hits + misses));
+    thread->stats.AddMessage(msg);
   }
 
   void SeekRandom(ThreadState* thread) {
@@ -1114,6 +1308,9 @@ int main(int argc, char** argv) {
   FLAGS_max_file_size = leveldb::Options().max_file_size;
   FLAGS_block_size = leveldb::Options().block_size;
   FLAGS_open_files = leveldb::Options().max_open_files;
+  FLAGS_min_blob_size = leveldb::Options().min_blob_size;
+  FLAGS_vlog_write_buffer_size = leveldb::Options().vlog_write_buffer_size;
+  FLAGS_max_sync_delay_micros = leveldb::Options().max_sync_delay_micros;
   std::string default_db_path;
 
   for (int i = 1; i < argc; i++) {
@@ -1150,14 +1347,51 @@ int main(int argc, char** argv) {
       FLAGS_max_file_size = n;
     } else if (sscanf(argv[i], "--block_size=%d%c", &n, &junk) == 1) {
       FLAGS_block_size = n;
+    } else if (sscanf(argv[i], "--data_block_hash_index=%d%c", &n, &junk) ==
+                   1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_data_block_hash_index = n;
+    } else if (sscanf(argv[i], "--partition_index_and_filters=%d%c", &n,
+                      &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_partition_index_and_filters = n;
     } else if (sscanf(argv[i], "--key_prefix=%d%c", &n, &junk) == 1) {
       FLAGS_key_prefix = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--value_cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_value_cache_size = n;
+    } else if (sscanf(argv[i], "--address_cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_address_cache_size = n;
+    } else if (sscanf(argv[i], "--multiget_batch_size=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_multiget_batch_size = n;
+    } else if (sscanf(argv[i], "--zipfian_theta=%lf%c", &d, &junk) == 1 &&
+               d > 0 && d < 1) {
+      FLAGS_zipfian_theta = d;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
+    } else if (sscanf(argv[i], "--blocked_bloom=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_blocked_bloom = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
+    } else if (sscanf(argv[i], "--min_blob_size=%d%c", &n, &junk) == 1) {
+      FLAGS_min_blob_size = n;
+    } else if (sscanf(argv[i], "--vlog_write_buffer_size=%d%c", &n, &junk) ==
+               1) {
+      FLAGS_vlog_write_buffer_size = n;
+    } else if (sscanf(argv[i], "--use_direct_io_for_vlog=%d%c", &n, &junk) ==
+                   1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_use_direct_io_for_vlog = n;
+    } else if (sscanf(argv[i], "--enable_pipelined_write=%d%c", &n, &junk) ==
+                   1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_enable_pipelined_write = n;
+    } else if (sscanf(argv[i], "--max_sync_delay_micros=%d%c", &n, &junk) ==
+               1) {
+      FLAGS_max_sync_delay_micros = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
     } else {
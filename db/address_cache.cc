@@ -0,0 +1,123 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/address_cache.h"
+
+#include "leveldb/cache.h"
+#include "leveldb/write_batch.h"
+#include "util/coding.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+// A cached entry: the snapshot it was read at (fixed64), the value type
+// (one byte) and the address or inline value.
+void DeleteEntry(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
+}  // namespace
+
+class AddressCache::Invalidator : public WriteBatch::Handler {
+ public:
+  Invalidator(AddressCache* cache, SequenceNumber sequence)
+      : cache_(cache), sequence_(sequence) {}
+
+  void Put(const Slice& key, const Slice& value) override {
+    cache_->Invalidate(key, sequence_);
+  }
+  void Delete(const Slice& key) override {
+    cache_->Invalidate(key, sequence_);
+  }
+
+ private:
+  AddressCache* const cache_;
+  const SequenceNumber sequence_;
+};
+
+AddressCache::AddressCache(Cache* cache)
+    : cache_(cache), id_(cache->NewId()), hits_(0), misses_(0) {}
+
+AddressCache::Shard* AddressCache::ShardOf(const Slice& user_key) {
+  const uint32_t hash = Hash(user_key.data(), user_key.size(), 0);
+  return &shards_[hash >> (32 - kNumShardBits)];
+}
+
+void AddressCache::CacheKey(const Slice& user_key, std::string* result) const {
+  PutFixed64(result, id_);
+  result->append(user_key.data(), user_key.size());
+}
+
+bool AddressCache::Lookup(const Slice& user_key, SequenceNumber snapshot,
+                          ValueType* type, std::string* addr) {
+  std::string key;
+  CacheKey(user_key, &key);
+  Cache::Handle* handle = cache_->Lookup(key);
+  bool found = false;
+  if (handle != nullptr) {
+    const std::string& entry =
+        *reinterpret_cast<std::string*>(cache_->Value(handle));
+    // Entries read at a later snapshot may hold values written after
+    // "snapshot".
+    if (DecodeFixed64(entry.data()) <= snapshot) {
+      *type = static_cast<ValueType>(entry[8]);
+      addr->assign(entry.data() + 9, entry.size() - 9);
+      found = true;
+    }
+    cache_->Release(handle);
+  }
+  if (found) {
+    hits_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return found;
+}
+
+void AddressCache::Insert(const Slice& user_key, SequenceNumber snapshot,
+                          ValueType type, const Slice& addr) {
+  std::string key;
+  CacheKey(user_key, &key);
+  std::string* entry = new std::string;
+  PutFixed64(entry, snapshot);
+  entry->push_back(static_cast<char>(type));
+  entry->append(addr.data(), addr.size());
+
+  Shard* shard = ShardOf(user_key);
+  MutexLock l(&shard->mu);
+  if (shard->max_invalidated > snapshot) {
+    // A write that "snapshot" does not see may have replaced the value.
+    delete entry;
+    return;
+  }
+  cache_->Release(cache_->Insert(key, entry, key.size() + entry->size(),
+                                 &DeleteEntry));
+}
+
+void AddressCache::Invalidate(const Slice& user_key, SequenceNumber sequence) {
+  std::string key;
+  CacheKey(user_key, &key);
+  Shard* shard = ShardOf(user_key);
+  MutexLock l(&shard->mu);
+  if (shard->max_invalidated < sequence) {
+    shard->max_invalidated = sequence;
+  }
+  cache_->Erase(key);
+}
+
+void AddressCache::Invalidate(const WriteBatch* batch,
+                              SequenceNumber last_sequence) {
+  Invalidator invalidator(this, last_sequence);
+  batch->Iterate(&invalidator);
+}
+
+void AddressCache::GetStats(uint64_t* hits, uint64_t* misses) const {
+  *hits = hits_.load(std::memory_order_relaxed);
+  *misses = misses_.load(std::memory_order_relaxed);
+}
+
+}  // namespace leveldb
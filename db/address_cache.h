@@ -0,0 +1,83 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_ADDRESS_CACHE_H_
+#define STORAGE_LEVELDB_DB_ADDRESS_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "db/dbformat.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+
+namespace leveldb {
+
+class Cache;
+class WriteBatch;
+
+// Maps user keys to where their newest values live: the vlog address, or
+// the value itself if it is stored inline.  A hit saves the walk through
+// the memtables and the levels of the LSM-tree.
+//
+// An entry is only present while it is the newest version of its key.
+// Writes invalidate their keys before their sequence is published, and
+// each shard remembers the largest sequence it invalidated, so that a
+// reader whose snapshot predates a write cannot put back the value it
+// replaced.
+class AddressCache {
+ public:
+  // The entries are kept in "cache", which may be shared with other DBs.
+  explicit AddressCache(Cache* cache);
+
+  AddressCache(const AddressCache&) = delete;
+  AddressCache& operator=(const AddressCache&) = delete;
+
+  // If the newest version of "user_key" is cached and visible at
+  // "snapshot", store its type and address in *type and *addr and return
+  // true.
+  bool Lookup(const Slice& user_key, SequenceNumber snapshot, ValueType* type,
+              std::string* addr);
+
+  // Remember that "addr" is the newest version of "user_key" as read at
+  // "snapshot".  Nothing is cached if a write newer than "snapshot" may
+  // have replaced it in the meantime.
+  void Insert(const Slice& user_key, SequenceNumber snapshot, ValueType type,
+              const Slice& addr);
+
+  // Drop the entries of every key written by "batch", whose sequence
+  // numbers are no larger than "last_sequence".
+  void Invalidate(const WriteBatch* batch, SequenceNumber last_sequence);
+
+  void GetStats(uint64_t* hits, uint64_t* misses) const;
+
+ private:
+  class Invalidator;
+
+  // Padded to its own cache line, writers of different shards do not
+  // contend.
+  struct Shard {
+    port::Mutex mu;
+    SequenceNumber max_invalidated GUARDED_BY(mu) = 0;
+    char padding[64];
+  };
+
+  static const int kNumShardBits = 4;
+  static const int kNumShards = 1 << kNumShardBits;
+
+  void Invalidate(const Slice& user_key, SequenceNumber sequence);
+  Shard* ShardOf(const Slice& user_key);
+  void CacheKey(const Slice& user_key, std::string* result) const;
+
+  Cache* const cache_;
+  const uint64_t id_;
+  Shard shards_[kNumShards];
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_ADDRESS_CACHE_H_
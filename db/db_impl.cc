@@ -4,6 +4,7 @@
 
 #include "db/db_impl.h"
 
+#include "db/address_cache.h"
 #include "db/builder.h"
 #include "db/db_iter.h"
 #include "db/dbformat.h"
@@ -11,6 +12,7 @@
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/prefetch_executor.h"
 #include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
@@ -18,8 +20,11 @@
 #include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "leveldb/db.h"
@@ -40,18 +45,113 @@ namespace leveldb {
 
 const int kNumNonTableCacheFiles = 10;
 
+// Followers of a write group copy their batches into the vlog themselves
+// from this size on.
+static const size_t kMinFollowerFillBytes = 32 << 10;
+
+// Retired vlogs kept to become new vlogs when Options::preallocate_vlog is
+// set.
+static const size_t kMaxRecycledVlogs = 2;
+
 // Information kept for every waiting writer
 struct DBImpl::Writer {
   explicit Writer(port::Mutex* mu)
-      : batch(nullptr), sync(false), done(false), cv(mu) {}
+      : batch(nullptr),
+        sync(false),
+        done(false),
+        clean(false),
+        fill(false),
+        partition(0),
+        vlog_number(0),
+        vlog_offset(0),
+        group(nullptr),
+        cv(mu) {}
 
   Status status;
   WriteBatch* batch;
   bool sync;
   bool done;
+  bool clean;  // Garbage collection writer; fills its batch at the front
+  bool fill;   // The leader reserved vlog_offset for batch; copy it there
+  int partition;  // Vlog partition of batch, -1 if it is split into parts
+  uint64_t vlog_number;
+  uint64_t vlog_offset;
+  std::vector<BatchPart> parts;  // batch split by partition if partition < 0
+  PendingGroup* group;  // If set, also insert batch into group->mem
   port::CondVar cv;
 };
 
+// The entries of a batch that belong to one vlog partition.  Garbage
+// collection writes the values it moves as one vlog record per partition.
+struct DBImpl::BatchPart {
+  int partition;
+  WriteBatch batch;
+  uint64_t vlog_number;
+  uint64_t vlog_offset;
+};
+
+// A group of writes applied to the memtable whose sequence numbers are not
+// published yet.
+struct DBImpl::PendingGroup {
+  std::vector<Writer*> writers;
+  SequenceNumber last_sequence;
+  bool applied;  // The vlog records are synced if requested
+  Status status;
+  // Pipelined groups only: the memtable the group is applied to, and the
+  // number of followers still inserting their own batches.
+  MemTable* mem;
+  int inserting;
+};
+
+// The memtables and the version that a read uses, referenced together so
+// that they can be handed to readers without locking mutex_.
+struct DBImpl::SuperVersion {
+  MemTable* mem;
+  MemTable* imm;
+  Version* current;
+  uint64_t number;  // Value of super_version_number_ when it was installed
+  std::atomic<int> refs;
+};
+
+// Caches a reference to the SuperVersion for the reader threads assigned
+// to it.  The slots are padded to cache lines of their own.
+struct DBImpl::SuperVersionSlot {
+  SuperVersionSlot() : sv(nullptr) {}
+
+  // Marks a slot whose SuperVersion is taken by a reader.
+  static SuperVersion* InUse() {
+    return reinterpret_cast<SuperVersion*>(&in_use_tag);
+  }
+
+  std::atomic<SuperVersion*> sv;
+  char padding[64 - sizeof(std::atomic<SuperVersion*>)];
+
+ private:
+  static char in_use_tag;
+};
+
+char DBImpl::SuperVersionSlot::in_use_tag;
+
+static const int kNumSuperVersionSlots = 64;
+
+// Returns the slot of the calling thread.  Threads are spread over the
+// slots in the order they first read, so that up to kNumSuperVersionSlots
+// readers never share one.
+static int SuperVersionSlotIndex() {
+  static std::atomic<int> next_index(0);
+  static thread_local int index =
+      next_index.fetch_add(1, std::memory_order_relaxed) %
+      kNumSuperVersionSlots;
+  return index;
+}
+
+// A value read from the vlog tail during garbage collection.
+struct DBImpl::VlogCleanEntry {
+  std::string key;
+  std::string value;
+  std::string address;  // Where the value was found, see WriteBatch::Iterate
+};
+
 struct DBImpl::CompactionState {
   // Files produced by compaction
   struct Output {
@@ -84,6 +184,9 @@ struct DBImpl::CompactionState {
   TableBuilder* builder;
 
   uint64_t total_bytes;
+
+  // Values dropped by this compaction: vlog number -> <count, bytes>
+  std::map<uint64_t, std::pair<uint64_t, uint64_t>> dropped_values;
 };
 
 // Fix user-supplied options to be reasonable
@@ -103,6 +206,7 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
   ClipToRange(&result.max_file_size, 1 << 20, 1 << 30);
   ClipToRange(&result.block_size, 1 << 10, 4 << 20);
+  ClipToRange(&result.vlog_write_buffer_size, 64 << 10, 1 << 30);
   if (result.info_log == nullptr) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -124,6 +228,18 @@ static int TableCacheSize(const Options& sanitized_options) {
   return sanitized_options.max_open_files - kNumNonTableCacheFiles;
 }
 
+// Open the vlog "fname" to scan it, around the page cache if
+// options.use_direct_io_for_vlog is set and the Env supports that.
+static Status NewVlogSequentialFile(const Options& options,
+                                    const std::string& fname,
+                                    SequentialFile** file) {
+  if (options.use_direct_io_for_vlog &&
+      options.env->NewDirectSequentialFile(fname, file).ok()) {
+    return Status::OK();
+  }
+  return options.env->NewSequentialFile(fname, file);
+}
+
 DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
     : env_(raw_options.env),
       internal_comparator_(raw_options.comparator),
@@ -140,11 +256,22 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       mem_(nullptr),
       imm_(nullptr),
       has_imm_(false),
-      vlogfile_number_(0),
-      vlog_head_(0),
-      vlog_manager_(options_.clean_threshold),
+      vlog_streams_(options_.vlog_partitions.size() + 1),
+      vlog_manager_(options_.clean_threshold, options_.value_cache),
+      prefetch_executor_(new PrefetchExecutor(options_.max_prefetch_threads)),
+      address_cache_(options_.address_cache != nullptr
+                         ? new AddressCache(options_.address_cache)
+                         : nullptr),
+      unpersisted_garbage_(0),
+      vlog_bytes_written_(0),
+      clean_resume_bytes_(0),
+      clean_bytes_read_(0),
+      clean_bytes_live_(0),
       seed_(0),
-      tmp_batch_(new WriteBatch),
+      super_version_(nullptr),
+      super_version_number_(0),
+      sv_slots_(new SuperVersionSlot[kNumSuperVersionSlots]),
+      pending_groups_published_(&mutex_),
       background_compaction_scheduled_(false),
       manual_compaction_(nullptr),
       versions_(new VersionSet(dbname_, &options_, table_cache_,
@@ -157,7 +284,18 @@ DBImpl::~DBImpl() {
   while (background_compaction_scheduled_) {
     background_work_finished_signal_.Wait();
   }
+  for (int i = 0; i < kNumSuperVersionSlots; i++) {
+    SuperVersion* sv = sv_slots_[i].sv.exchange(nullptr);
+    if (sv != nullptr && sv != SuperVersionSlot::InUse()) {
+      UnrefSuperVersionLocked(sv);
+    }
+  }
+  if (super_version_ != nullptr) {
+    UnrefSuperVersionLocked(super_version_);
+    super_version_ = nullptr;
+  }
   mutex_.Unlock();
+  delete[] sv_slots_;
 
   if (db_lock_ != nullptr) {
     env_->UnlockFile(db_lock_);
@@ -166,8 +304,9 @@ DBImpl::~DBImpl() {
   delete versions_;
   if (mem_ != nullptr) mem_->Unref();
   if (imm_ != nullptr) imm_->Unref();
-  delete tmp_batch_;
   delete table_cache_;
+  delete prefetch_executor_;
+  delete address_cache_;
 
   if (owns_info_log_) {
     delete options_.info_log;
@@ -238,15 +377,17 @@ void DBImpl::RemoveObsoleteFiles() {
   env_->GetChildren(dbname_, &filenames);  // Ignoring errors on purpose
   uint64_t number;
   FileType type;
+  int partition;
   std::vector<std::string> files_to_delete;
   for (std::string& filename : filenames) {
-    if (ParseFileName(filename, &number, &type)) {
+    if (ParseFileName(filename, &number, &type, &partition)) {
       bool keep = true;
       switch (type) {
-          //        case kLogFile:
-          //          keep = ((number >= versions_->LogNumber()) ||
-          //                  (number == versions_->PrevLogNumber()));
-          //          break;
+        case kLogFile:
+          // Vlogs hold the values, so a vlog may only go once garbage
+          // collection has retired it and no reader can still address it.
+          keep = !versions_->CanDeleteVlog(number);
+          break;
         case kDescriptorFile:
           // Keep my manifest file, and any newer incarnations'
           // (in case there is a race that allows other incarnations)
@@ -263,15 +404,32 @@ void DBImpl::RemoveObsoleteFiles() {
         case kCurrentFile:
         case kDBLockFile:
         case kInfoLogFile:
-        case kLogFile:
           keep = true;
           break;
       }
 
+      if (!keep && type == kLogFile && options_.preallocate_vlog &&
+          !options_.vlog_preallocate_keep_size) {
+        // Keep a few retired vlogs around to become new vlogs, so that
+        // their space does not have to be allocated again.
+        const std::pair<uint64_t, int> vlog(number, partition);
+        if (std::find(recycled_vlogs_.begin(), recycled_vlogs_.end(), vlog) !=
+            recycled_vlogs_.end()) {
+          keep = true;
+        } else if (recycled_vlogs_.size() < kMaxRecycledVlogs) {
+          vlog_manager_.RemoveVlog(number);
+          recycled_vlogs_.push_back(vlog);
+          Log(options_.info_log, "Recycle vlog #%lld\n",
+              static_cast<unsigned long long>(number));
+          keep = true;
+        }
+      }
       if (!keep) {
         files_to_delete.push_back(std::move(filename));
         if (type == kTableFile) {
           table_cache_->Evict(number);
+        } else if (type == kLogFile) {
+          vlog_manager_.RemoveVlog(number);
         }
         Log(options_.info_log, "Delete type=%d #%lld\n", static_cast<int>(type),
             static_cast<unsigned long long>(number));
@@ -289,6 +447,121 @@ void DBImpl::RemoveObsoleteFiles() {
   mutex_.Lock();
 }
 
+// Reads and checksums the records of a vlog on a thread of its own, ahead of
+// the replay that decodes them.  Drops are queued in order with the records
+// and passed on to the replaying thread's reporter.
+class DBImpl::VlogReplayReader {
+ public:
+  VlogReplayReader(SequentialFile* file, uint64_t initial_offset)
+      : cv_(&mu_),
+        queued_bytes_(0),
+        done_(false),
+        stop_(false),
+        reader_(file, &reporter_, true /*checksum*/, initial_offset) {
+    reporter_.owner = this;
+    thread_ = std::thread(&VlogReplayReader::Run, this);
+  }
+
+  VlogReplayReader(const VlogReplayReader&) = delete;
+  VlogReplayReader& operator=(const VlogReplayReader&) = delete;
+
+  ~VlogReplayReader() {
+    {
+      MutexLock l(&mu_);
+      stop_ = true;
+      cv_.SignalAll();
+    }
+    thread_.join();
+  }
+
+  // Stores the next record of the vlog in *record and returns true, or
+  // returns false at its end.
+  bool ReadRecord(std::string* record, vlog::VReader::Reporter* reporter) {
+    MutexLock l(&mu_);
+    while (true) {
+      while (queue_.empty() && !done_) {
+        cv_.Wait();
+      }
+      if (queue_.empty()) {
+        return false;
+      }
+      Entry entry = std::move(queue_.front());
+      queue_.pop_front();
+      queued_bytes_ -= entry.record.size();
+      cv_.SignalAll();
+      if (!entry.drop.ok()) {
+        reporter->Corruption(entry.dropped_bytes, entry.drop);
+        continue;
+      }
+      record->swap(entry.record);
+      return true;
+    }
+  }
+
+ private:
+  // Records read ahead of the replay are capped at this many bytes.
+  static const size_t kMaxQueuedBytes = 4 << 20;
+
+  struct Entry {
+    std::string record;
+    size_t dropped_bytes = 0;
+    Status drop;  // Not ok for a drop
+  };
+
+  struct QueueReporter : public vlog::VReader::Reporter {
+    VlogReplayReader* owner;
+    void Corruption(size_t bytes, const Status& s) override {
+      Entry entry;
+      entry.dropped_bytes = bytes;
+      entry.drop = s;
+      MutexLock l(&owner->mu_);
+      owner->queue_.push_back(std::move(entry));
+      owner->cv_.SignalAll();
+    }
+  };
+
+  void Run() {
+    std::string scratch;
+    Slice record;
+    while (reader_.ReadRecord(&record, &scratch)) {
+      MutexLock l(&mu_);
+      while (!stop_ && queued_bytes_ >= kMaxQueuedBytes) {
+        cv_.Wait();
+      }
+      if (stop_) {
+        return;
+      }
+      Entry entry;
+      entry.record.assign(record.data(), record.size());
+      queued_bytes_ += record.size();
+      queue_.push_back(std::move(entry));
+      cv_.SignalAll();
+    }
+    MutexLock l(&mu_);
+    done_ = true;
+    cv_.SignalAll();
+  }
+
+  port::Mutex mu_;
+  port::CondVar cv_ GUARDED_BY(mu_);
+  std::deque<Entry> queue_ GUARDED_BY(mu_);
+  size_t queued_bytes_ GUARDED_BY(mu_);
+  bool done_ GUARDED_BY(mu_);
+  bool stop_ GUARDED_BY(mu_);
+  QueueReporter reporter_;
+  vlog::VReader reader_;  // Only used by thread_
+  std::thread thread_;
+};
+
+// A memtable filled by recovery whose level-0 table is being built.
+struct DBImpl::RecoveredTable {
+  MemTable* mem;
+  FileMetaData meta;
+  Status status;
+  uint64_t start_micros;
+  std::thread thread;
+};
+
 Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
   mutex_.AssertHeld();
 
@@ -334,7 +607,6 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
   // Note that PrevLogNumber() is no longer used, but we pay
   // attention to it in case we are recovering a database
   // produced by an older version of leveldb.
-  const uint64_t min_log = versions_->LogNumber();
   const uint64_t prev_log = versions_->PrevLogNumber();
   std::vector<std::string> filenames;
   s = env_->GetChildren(dbname_, &filenames);
@@ -345,17 +617,31 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
   versions_->AddLiveFiles(&expected);
   uint64_t number;
   FileType type;
-  std::vector<uint64_t> logs;
+  int partition;
+  // Vlogs to replay: number -> partition.
+  std::map<uint64_t, int> logs;
   for (size_t i = 0; i < filenames.size(); i++) {
-    if (ParseFileName(filenames[i], &number, &type)) {
+    if (ParseFileName(filenames[i], &number, &type, &partition)) {
       expected.erase(number);
-      if (type == kLogFile && ((number >= min_log) || (number == prev_log))) {
-        logs.push_back(number);
-        std::string vlog_name = LogFileName(dbname_, number);
-        vlog_manager_.AddVlog(dbname_, options_, number);
+      if (type == kLogFile && !versions_->IsVlogRetired(number)) {
+        if (static_cast<size_t>(partition) >= vlog_streams_.size()) {
+          return Status::InvalidArgument(
+              filenames[i], "belongs to a vlog partition that is not set up");
+        }
+        // Older vlogs still hold values referenced by the tables, but only
+        // the newer ones have to be replayed.
+        vlog_manager_.AddVlog(dbname_, options_, number, partition);
+        if (number >= versions_->PartitionLogNumber(partition) ||
+            (partition == 0 && number == prev_log)) {
+          logs[number] = partition;
+        }
       }
     }
   }
+  s = vlog_manager_.DecodeGarbageFrom(versions_->VlogInfo());
+  if (!s.ok()) {
+    return s;
+  }
   if (!expected.empty()) {
     char buf[50];
     std::snprintf(buf, sizeof(buf), "%d missing files; e.g.",
@@ -363,25 +649,68 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
     return Status::Corruption(buf, TableFileName(dbname_, *(expected.begin())));
   }
 
-  // Recover in the order in which the logs were generated
-  std::sort(logs.begin(), logs.end());
-  if (!logs.empty() && logs[0] == min_log) {
-    vlog_head_ = versions_->VlogHeadPos();
-  } else {
-    vlog_head_ = 0;
+  // Recover in the order in which the logs were generated.  The records of
+  // the oldest log of each partition before its checkpointed head are
+  // already in the tables.  A key always maps to the same partition, so
+  // the writes of a key are replayed in order.
+  //
+  // Recovery is pipelined: the logs are read and checksummed a few at a
+  // time by VlogReplayReaders, this thread decodes their records in order,
+  // and the level-0 tables are built on threads of their own.
+  std::vector<std::pair<uint64_t, int>> replay(logs.begin(), logs.end());
+  std::vector<uint64_t> last_logs(vlog_streams_.size(), 0);
+  std::vector<uint64_t> offsets(replay.size(), 0);
+  for (size_t i = 0; i < replay.size(); i++) {
+    const int p = replay[i].second;
+    last_logs[p] = replay[i].first;
+    if (replay[i].first == versions_->PartitionLogNumber(p)) {
+      offsets[i] = versions_->PartitionHeadPos(p);
+    }
   }
+  const size_t max_readers =
+      std::max<size_t>(2, std::thread::hardware_concurrency());
+  std::vector<std::unique_ptr<VlogReplayReader>> readers(replay.size());
+  std::vector<Status> open_status(replay.size());
+  std::deque<RecoveredTable*> tables;
+  for (size_t i = 0, started = 0; i < replay.size(); i++) {
+    for (; started < replay.size() && started < i + max_readers; started++) {
+      SequentialFile* file;
+      open_status[started] = NewVlogSequentialFile(
+          options_,
+          VlogFileName(dbname_, replay[started].first, replay[started].second),
+          &file);
+      if (open_status[started].ok()) {
+        readers[started].reset(new VlogReplayReader(file, offsets[started]));
+      }
+    }
 
-  for (size_t i = 0; i < logs.size(); i++) {
-    s = RecoverLogFile(logs[i], (i == logs.size() - 1), save_manifest, edit,
-                       &max_sequence);
+    const uint64_t log_number = replay[i].first;
+    const int p = replay[i].second;
+    if (readers[i] == nullptr) {
+      s = open_status[i];
+      MaybeIgnoreError(&s);
+    } else {
+      s = RecoverLogFile(log_number, p, offsets[i], readers[i].get(),
+                         log_number == last_logs[p], save_manifest, edit,
+                         &tables, &max_sequence);
+      readers[i].reset();
+    }
     if (!s.ok()) {
-      return s;
+      break;
     }
 
     // The previous incarnation may not have written any MANIFEST
     // records after allocating this log number.  So we manually
     // update the file number allocation counter in VersionSet.
-    versions_->MarkFileNumberUsed(logs[i]);
+    versions_->MarkFileNumberUsed(log_number);
+  }
+  readers.clear();
+  Status table_status = FinishRecoveredTables(tables.size(), &tables, edit);
+  if (s.ok()) {
+    s = table_status;
+  }
+  if (!s.ok()) {
+    return s;
   }
 
   if (versions_->LastSequence() < max_sequence) {
@@ -391,8 +720,38 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
   return Status::OK();
 }
 
-Status DBImpl::RecoverLogFile(const uint64_t log_number, bool last_log,
+// Returns true if the records of the vlog "fname" end at "offset": the
+// file either ends there too, or continues with zeros, preallocated or
+// padded by direct I/O.
+static bool VlogEndsAt(Env* env, const std::string& fname, uint64_t offset) {
+  uint64_t file_size;
+  if (!env->GetFileSize(fname, &file_size).ok() || file_size < offset) {
+    return false;
+  }
+  if (file_size == offset) {
+    return true;
+  }
+  RandomAccessFile* file;
+  if (!env->NewRandomAccessFile(fname, &file).ok()) {
+    return false;
+  }
+  const size_t n = std::min<uint64_t>(file_size - offset, vlog::kVHeaderSize);
+  char scratch[vlog::kVHeaderSize];
+  Slice header;
+  Status s = file->Read(offset, n, &header, scratch);
+  bool zero = s.ok() && header.size() == n;
+  for (size_t i = 0; zero && i < header.size(); i++) {
+    zero = (header[i] == 0);
+  }
+  delete file;
+  return zero;
+}
+
+Status DBImpl::RecoverLogFile(const uint64_t log_number, int partition,
+                              uint64_t initial_offset,
+                              VlogReplayReader* reader, bool last_log,
                               bool* save_manifest, VersionEdit* edit,
+                              std::deque<RecoveredTable*>* tables,
                               SequenceNumber* max_sequence) {
   struct LogReporter : public vlog::VReader::Reporter {
     Env* env;
@@ -409,38 +768,25 @@ Status DBImpl::RecoverLogFile(const uint64_t log_number, bool last_log,
 
   mutex_.AssertHeld();
 
-  // Open the log file
-  std::string fname = LogFileName(dbname_, log_number);
-  // file will be deleted during the deconstruction of VReader.
-  SequentialFile* file;
-  Status status = env_->NewSequentialFile(fname, &file);
-  if (!status.ok()) {
-    MaybeIgnoreError(&status);
-    return status;
-  }
-
-  // Create the log reader.
+  std::string fname = VlogFileName(dbname_, log_number, partition);
+  Status status;
   LogReporter reporter;
   reporter.env = env_;
   reporter.info_log = options_.info_log;
   reporter.fname = fname.c_str();
   reporter.status = (options_.paranoid_checks ? &status : nullptr);
-  // We intentionally make log::Reader do checksumming even if
-  // paranoid_checks==false so that corruptions cause entire commits
-  // to be skipped instead of propagating bad information (like overly
-  // large sequence numbers).
-  vlog::VReader reader(file, &reporter, true /*checksum*/,
-                       0 /*initial_offset*/);
-  Log(options_.info_log, "Recovering log #%llu",
-      (unsigned long long)log_number);
+  // The reader intentionally checksums even if paranoid_checks==false
+  // so that corruptions cause entire commits to be skipped instead of
+  // propagating bad information (like overly large sequence numbers).
+  Log(options_.info_log, "Recovering log #%llu from offset %llu",
+      (unsigned long long)log_number, (unsigned long long)initial_offset);
+  size_t head = initial_offset;
 
   // Read all the records and add to a memtable
-  std::string scratch;
-  Slice record;
+  std::string record;
   WriteBatch batch;
-  int compactions = 0;
   MemTable* mem = nullptr;
-  while (reader.ReadRecord(&record, &scratch) && status.ok()) {
+  while (status.ok() && reader->ReadRecord(&record, &reporter)) {
     if (record.size() < 12) {
       reporter.Corruption(record.size(),
                           Status::Corruption("log record too small"));
@@ -452,10 +798,19 @@ Status DBImpl::RecoverLogFile(const uint64_t log_number, bool last_log,
       mem = new MemTable(internal_comparator_);
       mem->Ref();
     }
-    vlog_head_ += vlog::kVHeaderSize;
-    status = WriteBatchInternal::InsertAddressInto(&batch, log_number, mem,
-                                                   &vlog_head_);
+    head += vlog::kVHeaderSize;
+    uint64_t inline_count, inline_bytes;
+    status = WriteBatchInternal::InsertAddressInto(
+        &batch, log_number, options_.min_blob_size, mem, false, &head,
+        &inline_count, &inline_bytes);
     MaybeIgnoreError(&status);
+    if (inline_count > 0) {
+      // The garbage may already be in the persisted table if it was saved
+      // after the write; a slight overestimate only makes the vlog a
+      // candidate for collection a bit earlier.
+      vlog_manager_.AddGarbage(log_number, inline_count, inline_bytes);
+      unpersisted_garbage_ += inline_count;
+    }
     if (!status.ok()) {
       break;
     }
@@ -466,40 +821,111 @@ Status DBImpl::RecoverLogFile(const uint64_t log_number, bool last_log,
     }
 
     if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
-      compactions++;
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, nullptr);
-      mem->Unref();
+      FlushRecoveredMemTable(mem, tables);
       mem = nullptr;
-      if (!status.ok()) {
-        // Reflect errors immediately so that conditions like full
-        // file-systems cause the DB::Open() to fail.
-        break;
+      // Bound the memtables held by the builders, and reflect errors soon
+      // so that conditions like full file-systems cause DB::Open() to fail.
+      const size_t max_tables =
+          std::max<size_t>(2, std::thread::hardware_concurrency());
+      if (tables->size() > max_tables) {
+        status = FinishRecoveredTables(tables->size() - max_tables, tables,
+                                       edit);
       }
     }
   }
-  vlog_manager_.SetHead(vlog_head_);
-  if (last_log) {
-    assert(mem_ == nullptr);
+  bool reuse = false;
+  if (last_log && VlogEndsAt(env_, fname, head)) {
     vlog_manager_.SetCurrentVlog(log_number);
-    vlogfile_number_ = log_number;
-    mem_ = new MemTable(internal_comparator_);
-    mem_->Ref();
-  } else {
-    vlog_head_ = 0;
+    reuse = vlog_manager_.SetHead(dbname_, options_, partition, head).ok();
+  }
+  if (reuse) {
+    VlogStream* stream = &vlog_streams_[partition];
+    stream->number = log_number;
+    stream->head = head;
+    stream->mem_number = log_number;
+    stream->mem_head = head;
+    if (mem_ == nullptr) {
+      // The later vlogs of the other partitions are replayed into
+      // memtables of their own, so mem_ stays empty.
+      mem_ = new MemTable(internal_comparator_);
+      mem_->Ref();
+    }
+  } else if (last_log) {
+    // Records appended after a torn tail could not be replayed, so a
+    // fresh vlog is started instead of reusing this one.
+    Log(options_.info_log, "Not reusing torn log #%llu",
+        (unsigned long long)log_number);
   }
 
   if (mem != nullptr) {
     if (status.ok()) {
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, nullptr);
+      FlushRecoveredMemTable(mem, tables);
+    } else {
+      mem->Unref();
     }
-    mem->Unref();
   }
 
   return status;
 }
 
+void DBImpl::FlushRecoveredMemTable(MemTable* mem,
+                                    std::deque<RecoveredTable*>* tables) {
+  mutex_.AssertHeld();
+  // The file number is taken in replay order, so that newer entries land
+  // in newer level-0 tables however the builds finish.
+  RecoveredTable* table = new RecoveredTable;
+  table->mem = mem;
+  table->meta.number = versions_->NewFileNumber();
+  table->start_micros = env_->NowMicros();
+  pending_outputs_.insert(table->meta.number);
+  Log(options_.info_log, "Level-0 table #%llu: started",
+      (unsigned long long)table->meta.number);
+  table->thread = std::thread([this, table]() {
+    Iterator* iter = table->mem->NewIterator();
+    table->status =
+        BuildTable(dbname_, env_, options_, table_cache_, iter, &table->meta);
+    delete iter;
+  });
+  tables->push_back(table);
+}
+
+Status DBImpl::FinishRecoveredTables(size_t n,
+                                     std::deque<RecoveredTable*>* tables,
+                                     VersionEdit* edit) {
+  mutex_.AssertHeld();
+  Status result;
+  for (size_t i = 0; i < n; i++) {
+    RecoveredTable* table = tables->front();
+    tables->pop_front();
+    table->thread.join();
+    const FileMetaData& meta = table->meta;
+    Log(options_.info_log, "Level-0 table #%llu: %lld bytes %s",
+        (unsigned long long)meta.number, (unsigned long long)meta.file_size,
+        table->status.ToString().c_str());
+    pending_outputs_.erase(meta.number);
+
+    // Note that if file_size is zero, the file has been deleted and
+    // should not be added to the manifest.
+    if (table->status.ok() && meta.file_size > 0) {
+      edit->AddFile(0, meta.number, meta.file_size, meta.smallest,
+                    meta.largest);
+    }
+
+    CompactionStats stats;
+    stats.micros = env_->NowMicros() - table->start_micros;
+    stats.bytes_written = meta.file_size;
+    stats_[0].Add(stats);
+    if (result.ok()) {
+      result = table->status;
+    }
+    table->mem->Unref();
+    delete table;
+  }
+  return result;
+}
+
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
                                 Version* base) {
   mutex_.AssertHeld();
@@ -544,6 +970,18 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   return s;
 }
 
+void DBImpl::SetReplayHeads(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  // A vlog may outlive a memtable, so replay has to start at the first
+  // record of the current memtable, which may be deep inside its vlog.
+  edit->SetLogNumber(vlog_streams_[0].mem_number);
+  edit->SetVlogHeadPos(vlog_streams_[0].mem_head);
+  for (size_t p = 1; p < vlog_streams_.size(); p++) {
+    edit->SetVlogPartitionHead(p, vlog_streams_[p].mem_number,
+                               vlog_streams_[p].mem_head);
+  }
+}
+
 void DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
   assert(imm_ != nullptr);
@@ -555,22 +993,41 @@ void DBImpl::CompactMemTable() {
   Status s = WriteLevel0Table(imm_, &edit, base);
   base->Unref();
 
+  // The values of the table may still be in the vlog write buffer, and
+  // recovery will not replay them once the table is installed.
+  if (s.ok()) {
+    mutex_.Unlock();
+    s = vlog_manager_.Flush();
+    mutex_.Lock();
+  }
+
   if (s.ok() && shutting_down_.load(std::memory_order_acquire)) {
     s = Status::IOError("Deleting DB during memtable compaction");
   }
 
   // Replace immutable memtable with the generated Table
+  uint64_t persisted_garbage = 0;
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
-    edit.SetLogNumber(vlogfile_number_);  // Earlier logs no longer needed
+    SetReplayHeads(&edit);  // Earlier logs no longer needed
+    // Replay no longer sees the flushed records, so the garbage of their
+    // inline values has to be persisted now.
+    persisted_garbage = unpersisted_garbage_;
+    if (persisted_garbage > 0) {
+      std::string vlog_info;
+      vlog_manager_.EncodeGarbageTo(&vlog_info);
+      edit.SetVlogInfo(vlog_info);
+    }
     s = versions_->LogAndApply(&edit, &mutex_);
   }
 
   if (s.ok()) {
     // Commit to the new state
+    unpersisted_garbage_ -= persisted_garbage;
     imm_->Unref();
     imm_ = nullptr;
     has_imm_.store(false, std::memory_order_release);
+    InstallSuperVersion();
     RemoveObsoleteFiles();
   } else {
     RecordBackgroundError(s);
@@ -666,7 +1123,7 @@ void DBImpl::MaybeScheduleCompaction() {
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
   } else if (imm_ == nullptr && manual_compaction_ == nullptr &&
-             !versions_->NeedsCompaction()) {
+             !versions_->NeedsCompaction() && !NeedsVlogClean()) {
     // No work to be done
   } else {
     background_compaction_scheduled_ = true;
@@ -685,6 +1142,10 @@ void DBImpl::BackgroundCall() {
     // No more background work when shutting down.
   } else if (!bg_error_.ok()) {
     // No more background work after a background error.
+  } else if (imm_ == nullptr && manual_compaction_ == nullptr &&
+             !versions_->NeedsCompaction()) {
+    // Garbage collection only runs when no compaction is pending.
+    BackgroundVlogClean();
   } else {
     BackgroundCompaction();
   }
@@ -735,7 +1196,9 @@ void DBImpl::BackgroundCompaction() {
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size, f->smallest,
                        f->largest);
     status = versions_->LogAndApply(c->edit(), &mutex_);
-    if (!status.ok()) {
+    if (status.ok()) {
+      InstallSuperVersion();
+    } else {
       RecordBackgroundError(status);
     }
     VersionSet::LevelSummaryStorage tmp;
@@ -884,7 +1347,28 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
     compact->compaction->edit()->AddFile(level + 1, out.number, out.file_size,
                                          out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+
+  // Account the dropped values to their vlogs, and persist the garbage
+  // table once enough of it is not yet in the descriptor.
+  for (const auto& kvp : compact->dropped_values) {
+    vlog_manager_.AddGarbage(kvp.first, kvp.second.first, kvp.second.second);
+    unpersisted_garbage_ += kvp.second.first;
+  }
+  const bool persist_garbage =
+      unpersisted_garbage_ >= options_.log_dropCount_threshold;
+  if (persist_garbage) {
+    std::string vlog_info;
+    vlog_manager_.EncodeGarbageTo(&vlog_info);
+    compact->compaction->edit()->SetVlogInfo(vlog_info);
+  }
+  Status s = versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  if (s.ok()) {
+    InstallSuperVersion();
+    if (persist_garbage) {
+      unpersisted_garbage_ = 0;
+    }
+  }
+  return s;
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
@@ -973,6 +1457,20 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       }
 
       last_sequence_for_key = ikey.sequence;
+
+      if (drop && ikey.type == kTypeValue) {
+        // The value is an address <vlog_number, vlog_offset, size>; the
+        // entry it points to is garbage from now on.
+        Slice addr = input->value();
+        uint64_t vlog_number, offset, size;
+        if (GetVarint64(&addr, &vlog_number) && GetVarint64(&addr, &offset) &&
+            GetVarint64(&addr, &size)) {
+          std::pair<uint64_t, uint64_t>& dropped =
+              compact->dropped_values[vlog_number];
+          dropped.first++;
+          dropped.second += size;
+        }
+      }
     }
 #if 0
     Log(options_.info_log,
@@ -1050,52 +1548,475 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
 namespace {
 
-struct IterState {
-  port::Mutex* const mu;
-  Version* const version GUARDED_BY(mu);
-  MemTable* const mem GUARDED_BY(mu);
-  MemTable* const imm GUARDED_BY(mu);
+// Collects the Put entries of a vlog record.  WriteBatch::Iterate() hands
+// out either the values or the addresses they were written at, so a record
+// is iterated once for each.
+class VlogEntryCollector : public WriteBatch::Handler {
+ public:
+  void Put(const Slice& key, const Slice& value) override {
+    entries.emplace_back(key.ToString(), value.ToString());
+  }
+  void Delete(const Slice& key) override {}
 
-  IterState(port::Mutex* mutex, MemTable* mem, MemTable* imm, Version* version)
-      : mu(mutex), version(version), mem(mem), imm(imm) {}
+  std::vector<std::pair<std::string, std::string>> entries;
 };
 
-static void CleanupIteratorState(void* arg1, void* arg2) {
-  IterState* state = reinterpret_cast<IterState*>(arg1);
-  state->mu->Lock();
-  state->mem->Unref();
-  if (state->imm != nullptr) state->imm->Unref();
-  state->version->Unref();
-  state->mu->Unlock();
-  delete state;
+}  // anonymous namespace
+
+// REQUIRES: mutex_ is held
+// REQUIRES: this thread is currently at the front of the writer queue
+void DBImpl::DismissCleanWriters() {
+  mutex_.AssertHeld();
+  // Garbage collection writers run on the background thread, which must
+  // not be blocked in the queue while the front writer waits for it.
+  for (auto iter = writers_.begin() + 1; iter != writers_.end();) {
+    Writer* w = *iter;
+    if (w->clean) {
+      iter = writers_.erase(iter);
+      w->done = true;
+      w->cv.Signal();
+    } else {
+      ++iter;
+    }
+  }
 }
 
-}  // anonymous namespace
+bool DBImpl::PickVlogToClean(uint64_t* number, uint64_t* offset) {
+  mutex_.AssertHeld();
+  std::vector<uint64_t> numbers;
+  vlog_manager_.GetVlogNumbers(&numbers);
+  uint64_t best_garbage = 0;
+  double best_ratio = 0;
+  bool found = false;
+  for (uint64_t n : numbers) {
+    const int partition = vlog_manager_.GetVlogPartition(n);
+    if (partition < 0 || n >= versions_->PartitionLogNumber(partition) ||
+        n == vlog_streams_[partition].number) {
+      // Still written to, or its records may still have to be replayed.
+      continue;
+    }
+    if (versions_->IsVlogRetired(n)) {
+      continue;
+    }
+    if (n == versions_->VlogTailNumber() && versions_->VlogTailPos() > 0) {
+      // Finish the vlog that is partially collected first.
+      *number = n;
+      *offset = versions_->VlogTailPos();
+      return true;
+    }
+    uint64_t count, garbage;
+    vlog_manager_.GetGarbage(n, &count, &garbage);
+    if (garbage < vlog::CleanThreshold(options_, partition)) {
+      continue;
+    }
+    const uint64_t size = vlog_manager_.GetVlogSize(n);
+    const double ratio =
+        (size > 0) ? static_cast<double>(garbage) / size : 1.0;
+    if (!found || ratio > best_ratio ||
+        (ratio == best_ratio && garbage > best_garbage)) {
+      *number = n;
+      *offset = 0;
+      best_ratio = ratio;
+      best_garbage = garbage;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool DBImpl::NeedsVlogClean() {
+  mutex_.AssertHeld();
+  if (!snapshots_.empty()) {
+    // A snapshot may read values that garbage collection would move.
+    return false;
+  }
+  if (vlog_bytes_written_ < clean_resume_bytes_) {
+    return false;
+  }
+  uint64_t number, offset;
+  return PickVlogToClean(&number, &offset);
+}
+
+// REQUIRES: mutex_ is held
+// REQUIRES: called from the background thread
+Status DBImpl::RewriteLiveValues(const std::vector<VlogCleanEntry>& entries,
+                                 bool* deferred, uint64_t* live_bytes) {
+  mutex_.AssertHeld();
+  *deferred = false;
+  *live_bytes = 0;
+
+  // The liveness check and the rewrite happen at the front of the writer
+  // queue, so no user write can overwrite a key in between.
+  WriteBatch live;
+  Writer w(&mutex_);
+  w.batch = &live;
+  w.sync = true;  // The old copies go away once the tail is advanced
+  w.clean = true;
+  writers_.push_back(&w);
+  while (!w.done && (writers_.empty() || &w != writers_.front())) {
+    w.cv.Wait();
+  }
+  if (w.done) {
+    // Dismissed by a writer that waits for the background thread.
+    *deferred = true;
+    return Status::OK();
+  }
+  // The check must see every write applied to mem_.
+  WaitForPendingGroups();
+
+  if (!bg_error_.ok() || imm_ != nullptr ||
+      versions_->NumLevelFiles(0) >= config::kL0_SlowdownWritesTrigger) {
+    // Making room for the write would wait for the compaction that this
+    // thread is supposed to run.
+    *deferred = true;
+  } else {
+    const SequenceNumber snapshot = versions_->LastSequence();
+    MemTable* mem = mem_;
+    Version* current = versions_->current();
+    mem->Ref();
+    current->Ref();
+    {
+      mutex_.Unlock();
+      std::string addr;
+      for (const VlogCleanEntry& e : entries) {
+        LookupKey lkey(e.key, snapshot);
+        Version::GetStats stats;
+        Status s;
+        ValueType type;
+        if (!mem->Get(lkey, &addr, &type, &s)) {
+          s = current->Get(ReadOptions(), lkey, &addr, &type, &stats);
+        }
+        if (s.ok() && type == kTypeValue && addr == e.address) {
+          live.Put(e.key, e.value);
+          *live_bytes += e.key.size() + e.value.size();
+        }
+      }
+      mutex_.Lock();
+    }
+    mem->Unref();
+    current->Unref();
+  }
+
+  if (!*deferred && WriteBatchInternal::Count(&live) > 0) {
+    AssignPartition(&w);
+    return WriteLeaderGroup(&w);
+  }
+
+  // Nothing to write: leave the queue to the next writer.
+  writers_.pop_front();
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  return Status::OK();
+}
+
+void DBImpl::BackgroundVlogClean() {
+  struct LogReporter : public vlog::VReader::Reporter {
+    Logger* info_log;
+    const char* fname;
+    Status* status;
+    void Corruption(size_t bytes, const Status& s) override {
+      Log(info_log, "%s: dropping %d bytes; %s", fname,
+          static_cast<int>(bytes), s.ToString().c_str());
+      if (this->status->ok()) *this->status = s;
+    }
+  };
+
+  mutex_.AssertHeld();
+  uint64_t number, offset;
+  if (!PickVlogToClean(&number, &offset)) {
+    return;
+  }
+  if (offset == 0) {
+    clean_bytes_read_ = 0;
+    clean_bytes_live_ = 0;
+  }
+  const uint64_t start_offset = offset;
+  const uint64_t start_micros = env_->NowMicros();
+  const int partition = vlog_manager_.GetVlogPartition(number);
+
+  std::string fname = VlogFileName(dbname_, number, partition);
+  SequentialFile* file;
+  Status read_status = NewVlogSequentialFile(options_, fname, &file);
+  if (!read_status.ok()) {
+    Log(options_.info_log, "Vlog clean #%llu: %s",
+        (unsigned long long)number, read_status.ToString().c_str());
+    vlog_manager_.ClearGarbage(number);
+    VersionEdit edit;
+    edit.SetVlogTailPos(0, 0);
+    Status s = versions_->LogAndApply(&edit, &mutex_);
+    if (s.ok()) {
+      InstallSuperVersion();
+    } else {
+      RecordBackgroundError(s);
+    }
+    return;
+  }
+  LogReporter reporter;
+  reporter.info_log = options_.info_log;
+  reporter.fname = fname.c_str();
+  reporter.status = &read_status;
+  // file will be deleted during the deconstruction of VReader.
+  vlog::VReader reader(file, &reporter, true /*checksum*/, offset);
+
+  Status s;
+  bool finished = false;
+  std::vector<VlogCleanEntry> entries;
+  std::string scratch;
+  Slice record;
+  WriteBatch batch;
+  while (s.ok() && !shutting_down_.load(std::memory_order_acquire) &&
+         imm_ == nullptr && manual_compaction_ == nullptr &&
+         !versions_->NeedsCompaction()) {
+    // Read the next chunk from the tail with the lock released.
+    entries.clear();
+    uint64_t chunk_end = offset;
+    bool eof = false;
+    mutex_.Unlock();
+    while (chunk_end - offset < options_.clean_write_buffer_size) {
+      if (!reader.ReadRecord(&record, &scratch)) {
+        eof = true;
+        break;
+      }
+      if (record.size() < 12) {
+        reporter.Corruption(record.size(),
+                            Status::Corruption("log record too small"));
+        break;
+      }
+      WriteBatchInternal::SetContents(&batch, record);
+      VlogEntryCollector values, addresses;
+      size_t head = chunk_end + vlog::kVHeaderSize;
+      if (batch.Iterate(&values).ok() &&
+          batch.Iterate(&addresses, number, &head).ok()) {
+        assert(values.entries.size() == addresses.entries.size());
+        for (size_t i = 0; i < values.entries.size(); i++) {
+          VlogCleanEntry e;
+          e.key.swap(values.entries[i].first);
+          e.value.swap(values.entries[i].second);
+          e.address.swap(addresses.entries[i].second);
+          entries.push_back(std::move(e));
+        }
+      }
+      chunk_end += vlog::kVHeaderSize + record.size();
+    }
+    mutex_.Lock();
+    if (!read_status.ok()) {
+      break;
+    }
+
+    bool deferred = false;
+    uint64_t live_bytes = 0;
+    if (!entries.empty()) {
+      s = RewriteLiveValues(entries, &deferred, &live_bytes);
+      if (!s.ok() || deferred) {
+        break;
+      }
+    }
+    clean_bytes_read_ += chunk_end - offset;
+    clean_bytes_live_ += live_bytes;
+    offset = chunk_end;
+    if (eof) {
+      finished = true;
+      break;
+    }
+
+    // Sleep off whatever is ahead of the rate limit, waking up early for
+    // memtable compactions and shutdown.
+    if (options_.clean_rate_limit > 0) {
+      const uint64_t target_micros =
+          start_micros +
+          (offset - start_offset) * 1000000 / options_.clean_rate_limit;
+      mutex_.Unlock();
+      uint64_t now = env_->NowMicros();
+      while (now < target_micros &&
+             !shutting_down_.load(std::memory_order_acquire) &&
+             !has_imm_.load(std::memory_order_relaxed)) {
+        env_->SleepForMicroseconds(
+            static_cast<int>(std::min<uint64_t>(target_micros - now, 1000)));
+        now = env_->NowMicros();
+      }
+      mutex_.Lock();
+    }
+  }
+
+  if (!s.ok()) {
+    // Like a failed sync, a failed rewrite leaves the vlog head in an
+    // unknown state.
+    RecordBackgroundError(s);
+  }
+
+  VersionEdit edit;
+  if (!read_status.ok()) {
+    // Leave the damaged vlog in place until it gathers more garbage.
+    Log(options_.info_log, "Vlog clean #%llu: skipped at %llu, %s",
+        (unsigned long long)number, (unsigned long long)offset,
+        read_status.ToString().c_str());
+    vlog_manager_.ClearGarbage(number);
+    edit.SetVlogTailPos(0, 0);
+  } else if (finished && snapshots_.empty()) {
+    edit.RemoveVlog(number);
+    edit.SetVlogTailPos(0, 0);
+  } else if (offset != start_offset) {
+    edit.SetVlogTailPos(number, offset);
+  } else {
+    return;
+  }
+
+  Status apply = versions_->LogAndApply(&edit, &mutex_);
+  if (!apply.ok()) {
+    RecordBackgroundError(apply);
+    return;
+  }
+  InstallSuperVersion();
+  Log(options_.info_log, "Vlog clean #%llu: tail at %llu%s",
+      (unsigned long long)number, (unsigned long long)offset,
+      finished ? ", retired" : "");
+  if (finished && snapshots_.empty()) {
+    if (clean_bytes_read_ - clean_bytes_live_ < options_.min_clean_threshold) {
+      // Mostly live data; wait for new writes before churning again.
+      clean_resume_bytes_ =
+          vlog_bytes_written_ + vlog::CleanThreshold(options_, partition);
+    }
+    RemoveObsoleteFiles();
+  }
+}
+
+void DBImpl::DeallocateCleanedVlogSpace() {
+  mutex_.AssertHeld();
+  const uint64_t number = versions_->VlogTailNumber();
+  const uint64_t offset = versions_->VlogTailPos();
+  const int partition = vlog_manager_.GetVlogPartition(number);
+  if (offset == 0 || partition < 0 || versions_->IsVlogRetired(number)) {
+    return;
+  }
+  SequentialFile* file;
+  if (!env_->NewSequentialFile(VlogFileName(dbname_, number, partition), &file)
+           .ok()) {
+    return;
+  }
+  // Every live value in front of the tail has been rewritten at the head,
+  // and no reader has an address into that range yet.
+  vlog::VReader reader(file, nullptr, false /*checksum*/);
+  if (!reader.DeallocateDiskSpace(0, offset)) {
+    Log(options_.info_log, "Vlog #%llu: could not deallocate %llu bytes",
+        (unsigned long long)number, (unsigned long long)offset);
+  }
+}
+
+DBImpl::SuperVersion* DBImpl::AcquireSuperVersion() {
+  SuperVersionSlot* slot = &sv_slots_[SuperVersionSlotIndex()];
+  SuperVersion* sv =
+      slot->sv.exchange(SuperVersionSlot::InUse(), std::memory_order_acquire);
+  if (sv != nullptr && sv != SuperVersionSlot::InUse()) {
+    if (sv->number ==
+        super_version_number_.load(std::memory_order_acquire)) {
+      return sv;
+    }
+    UnrefSuperVersion(sv);
+  }
+  MutexLock l(&mutex_);
+  sv = super_version_;
+  sv->refs.fetch_add(1, std::memory_order_relaxed);
+  return sv;
+}
+
+void DBImpl::ReturnSuperVersion(SuperVersion* sv) {
+  SuperVersionSlot* slot = &sv_slots_[SuperVersionSlotIndex()];
+  SuperVersion* expected = SuperVersionSlot::InUse();
+  if (!slot->sv.compare_exchange_strong(expected, sv,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+    // A newer SuperVersion was installed meanwhile, or another thread of
+    // the slot cached its own.
+    UnrefSuperVersion(sv);
+  }
+}
+
+void DBImpl::UnrefSuperVersion(SuperVersion* sv) {
+  if (sv->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    // Versions and memtables are only unreferenced under the lock.
+    MutexLock l(&mutex_);
+    DeleteSuperVersion(sv);
+  }
+}
+
+void DBImpl::UnrefSuperVersionLocked(SuperVersion* sv) {
+  mutex_.AssertHeld();
+  if (sv->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    DeleteSuperVersion(sv);
+  }
+}
+
+void DBImpl::DeleteSuperVersion(SuperVersion* sv) {
+  mutex_.AssertHeld();
+  sv->mem->Unref();
+  if (sv->imm != nullptr) sv->imm->Unref();
+  sv->current->Unref();
+  delete sv;
+}
+
+void DBImpl::InstallSuperVersion() {
+  mutex_.AssertHeld();
+  SuperVersion* old = super_version_;
+  Version* current = versions_->current();
+  if (old != nullptr && old->mem == mem_ && old->imm == imm_ &&
+      old->current == current) {
+    return;
+  }
+  SuperVersion* sv = new SuperVersion;
+  sv->mem = mem_;
+  sv->imm = imm_;
+  sv->current = current;
+  sv->mem->Ref();
+  if (sv->imm != nullptr) sv->imm->Ref();
+  sv->current->Ref();
+  sv->number = super_version_number_.load(std::memory_order_relaxed) + 1;
+  sv->refs.store(1, std::memory_order_relaxed);
+  super_version_ = sv;
+  super_version_number_.store(sv->number, std::memory_order_release);
+
+  // The slots may pin old memtables and versions, so they are emptied now
+  // rather than when their readers come back.
+  for (int i = 0; i < kNumSuperVersionSlots; i++) {
+    SuperVersion* cached =
+        sv_slots_[i].sv.exchange(nullptr, std::memory_order_acq_rel);
+    if (cached != nullptr && cached != SuperVersionSlot::InUse()) {
+      UnrefSuperVersionLocked(cached);
+    }
+  }
+  if (old != nullptr) {
+    UnrefSuperVersionLocked(old);
+  }
+}
+
+void DBImpl::CleanupIteratorSuperVersion(void* arg1, void* arg2) {
+  DBImpl* db = reinterpret_cast<DBImpl*>(arg1);
+  db->UnrefSuperVersion(reinterpret_cast<SuperVersion*>(arg2));
+}
 
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       SequenceNumber* latest_snapshot,
                                       uint32_t* seed) {
-  mutex_.Lock();
+  // The sequence is read first, so that the SuperVersion holds every entry
+  // up to it.
   *latest_snapshot = versions_->LastSequence();
+  SuperVersion* sv = AcquireSuperVersion();
+  // The iterator keeps a reference of its own.
+  sv->refs.fetch_add(1, std::memory_order_relaxed);
+  ReturnSuperVersion(sv);
 
   // Collect together all needed child iterators
   std::vector<Iterator*> list;
-  list.push_back(mem_->NewIterator());
-  mem_->Ref();
-  if (imm_ != nullptr) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+  list.push_back(sv->mem->NewIterator());
+  if (sv->imm != nullptr) {
+    list.push_back(sv->imm->NewIterator());
   }
-  versions_->current()->AddIterators(options, &list);
+  sv->current->AddIterators(options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
-  versions_->current()->Ref();
+  internal_iter->RegisterCleanup(CleanupIteratorSuperVersion, this, sv);
 
-  IterState* cleanup = new IterState(&mutex_, mem_, imm_, versions_->current());
-  internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, nullptr);
-
-  *seed = ++seed_;
-  mutex_.Unlock();
+  *seed = seed_.fetch_add(1, std::memory_order_relaxed) + 1;
   return internal_iter;
 }
 
@@ -1114,7 +2035,8 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
                    std::string* value) {
   std::string addr;
   Status s;
-  MutexLock l(&mutex_);
+  // The sequence is read first, so that the SuperVersion holds every entry
+  // up to it.
   SequenceNumber snapshot;
   if (options.snapshot != nullptr) {
     snapshot =
@@ -1122,47 +2044,129 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
   } else {
     snapshot = versions_->LastSequence();
   }
-
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  mem->Ref();
-  if (imm != nullptr) imm->Ref();
-  current->Ref();
+  SuperVersion* sv = AcquireSuperVersion();
 
   bool have_stat_update = false;
   Version::GetStats stats;
 
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, &addr, &s)) {
-      // Done
-    } else if (imm != nullptr && imm->Get(lkey, &addr, &s)) {
+  // Hot keys are found in the address cache.  Otherwise look in the
+  // memtable, then in the immutable memtable (if any).  The vlog files an
+  // address points to are kept alive by the SuperVersion.
+  LookupKey lkey(key, snapshot);
+  ValueType type;
+  if (address_cache_ != nullptr &&
+      address_cache_->Lookup(key, snapshot, &type, &addr)) {
+    // Done
+  } else if (sv->mem->Get(lkey, &addr, &type, &s)) {
+    // Done
+  } else {
+    if (sv->imm != nullptr && sv->imm->Get(lkey, &addr, &type, &s)) {
       // Done
     } else {
-      s = current->Get(options, lkey, &addr, &stats);
+      s = sv->current->Get(options, lkey, &addr, &type, &stats);
       have_stat_update = true;
     }
-    if (s.ok()) s = vlog_manager_.FetchValueFromVlog(addr, value);
-    mutex_.Lock();
+    if (s.ok() && address_cache_ != nullptr) {
+      address_cache_->Insert(key, snapshot, type, addr);
+    }
+  }
+  if (s.ok()) {
+    if (type == kTypeInlineValue) {
+      value->swap(addr);
+    } else {
+      s = vlog_manager_.FetchValueFromVlog(addr, value);
+    }
   }
 
-  if (have_stat_update && current->UpdateStats(stats)) {
-    MaybeScheduleCompaction();
+  // Seeks are charged without the lock, which is only taken when a file
+  // runs out of them.
+  if (have_stat_update && sv->current->ChargeSeek(stats)) {
+    MutexLock l(&mutex_);
+    if (sv->current->UpdateSeekCompaction(stats)) {
+      MaybeScheduleCompaction();
+    }
   }
-  mem->Unref();
-  if (imm != nullptr) imm->Unref();
-  current->Unref();
+  ReturnSuperVersion(sv);
   return s;
 }
 
+void DBImpl::MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                      std::string* values, Status* statuses) {
+  SequenceNumber snapshot;
+  if (options.snapshot != nullptr) {
+    snapshot =
+        static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+  SuperVersion* sv = AcquireSuperVersion();
+  MemTable* mem = sv->mem;
+  MemTable* imm = sv->imm;
+  Version* current = sv->current;
+
+  std::vector<Version::GetStats> stats;
+
+  // Look up all the keys first, and collect the addresses of the values
+  // that have to be read from the vlogs.
+  std::vector<std::string> addrs(n);
+  std::vector<Slice> vlog_addrs;
+  std::vector<std::string*> vlog_values;
+  std::vector<int> vlog_keys;
+  for (int i = 0; i < n; i++) {
+    LookupKey lkey(keys[i], snapshot);
+    ValueType type;
+    Status s;
+    if (mem->Get(lkey, &addrs[i], &type, &s)) {
+      // Done
+    } else if (imm != nullptr && imm->Get(lkey, &addrs[i], &type, &s)) {
+      // Done
+    } else {
+      Version::GetStats key_stats;
+      s = current->Get(options, lkey, &addrs[i], &type, &key_stats);
+      if (key_stats.seek_file != nullptr) {
+        stats.push_back(key_stats);
+      }
+    }
+    statuses[i] = s;
+    if (s.ok()) {
+      if (type == kTypeInlineValue) {
+        values[i].swap(addrs[i]);
+      } else {
+        vlog_addrs.push_back(addrs[i]);
+        vlog_values.push_back(&values[i]);
+        vlog_keys.push_back(i);
+      }
+    }
+  }
+
+  std::vector<Status> vlog_statuses(vlog_addrs.size());
+  vlog_manager_.FetchValuesFromVlog(vlog_addrs.size(), vlog_addrs.data(),
+                                    vlog_values.data(), vlog_statuses.data(),
+                                    prefetch_executor_);
+  for (size_t i = 0; i < vlog_keys.size(); i++) {
+    statuses[vlog_keys[i]] = vlog_statuses[i];
+  }
+
+  for (const Version::GetStats& key_stats : stats) {
+    if (current->ChargeSeek(key_stats)) {
+      MutexLock l(&mutex_);
+      if (current->UpdateSeekCompaction(key_stats)) {
+        MaybeScheduleCompaction();
+      }
+    }
+  }
+  ReturnSuperVersion(sv);
+}
+
 Status DBImpl::Fetch(Slice addr, std::string* value) {
   return vlog_manager_.FetchValueFromVlog(addr, value);
 }
 
+void DBImpl::Fetch(size_t n, const Slice* addrs, std::string* const* values,
+                   Status* statuses) {
+  vlog_manager_.FetchValuesFromVlog(n, addrs, values, statuses, nullptr);
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
@@ -1172,7 +2176,8 @@ Iterator* DBImpl::NewIterator(const ReadOptions& options) {
                             ? static_cast<const SnapshotImpl*>(options.snapshot)
                                   ->sequence_number()
                             : latest_snapshot),
-                       seed);
+                       seed, options.readahead_hint,
+                       options_.max_readahead_bytes);
 }
 
 Iterator* DBImpl::NewAddrIterator(const ReadOptions& options) {
@@ -1214,68 +2219,404 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
   return DB::Delete(options, key);
 }
 
+namespace {
+
+// Finds the vlog partition of the keys of a batch.
+class PartitionFinder : public WriteBatch::Handler {
+ public:
+  explicit PartitionFinder(const Options& options)
+      : partition(0), first(0), empty(true), options_(options) {}
+
+  void Put(const Slice& key, const Slice& /*value*/) override { Add(key); }
+  void Delete(const Slice& key) override { Add(key); }
+
+  int partition;  // -1 if the keys belong to several partitions
+  int first;      // Partition of the first key
+  bool empty;
+
+ private:
+  void Add(const Slice& key) {
+    const int p = vlog::PartitionOf(options_, key);
+    if (empty) {
+      partition = p;
+      first = p;
+      empty = false;
+    } else if (partition != p) {
+      partition = -1;
+    }
+  }
+
+  const Options& options_;
+};
+
+// Splits the entries of a batch into one batch per vlog partition.
+class PartitionSplitter : public WriteBatch::Handler {
+ public:
+  PartitionSplitter(const Options& options, std::vector<WriteBatch>* batches)
+      : options_(options), batches_(batches) {}
+
+  void Put(const Slice& key, const Slice& value) override {
+    (*batches_)[vlog::PartitionOf(options_, key)].Put(key, value);
+  }
+  void Delete(const Slice& key) override {
+    (*batches_)[vlog::PartitionOf(options_, key)].Delete(key);
+  }
+
+ private:
+  const Options& options_;
+  std::vector<WriteBatch>* const batches_;
+};
+
+}  // anonymous namespace
+
+void DBImpl::AssignPartition(Writer* w) const {
+  w->partition = 0;
+  if (options_.vlog_partitions.empty() || w->batch == nullptr) {
+    return;
+  }
+  PartitionFinder finder(options_);
+  w->batch->Iterate(&finder);
+  w->partition = finder.partition;
+  if (w->partition >= 0) {
+    return;
+  }
+  if (!w->clean) {
+    // A user batch stays one vlog record, in the partition of its first
+    // key, so that it is recovered as a whole.  Garbage collection moves
+    // its values to their own partitions later.
+    w->partition = finder.first;
+    return;
+  }
+  // The values moved by garbage collection need not be recovered together:
+  // their old copies stay until the vlog tail is advanced past them.
+  std::vector<WriteBatch> batches(options_.vlog_partitions.size() + 1);
+  PartitionSplitter splitter(options_, &batches);
+  w->batch->Iterate(&splitter);
+  for (size_t p = 0; p < batches.size(); p++) {
+    if (WriteBatchInternal::Count(&batches[p]) > 0) {
+      w->parts.emplace_back();
+      w->parts.back().partition = p;
+      w->parts.back().batch = batches[p];
+    }
+  }
+}
+
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   Writer w(&mutex_);
   w.batch = updates;
   w.sync = options.sync;
   w.done = false;
+  AssignPartition(&w);
 
   MutexLock l(&mutex_);
+  if (updates != nullptr) {
+    vlog_bytes_written_ += WriteBatchInternal::ByteSize(updates);
+  }
   writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  while (true) {
+    if (w.fill) {
+      // Copy the batch into the vlog record the leader reserved for it, in
+      // parallel with the other writers of the group.  A follower of a
+      // pipelined group inserts the batch into the memtable as well.
+      w.fill = false;
+      PendingGroup* group = w.group;
+      mutex_.Unlock();
+      Status s = vlog_manager_.FillRecord(
+          w.partition, w.vlog_offset, WriteBatchInternal::Contents(w.batch));
+      uint64_t inline_count = 0, inline_bytes = 0;
+      if (group != nullptr && s.ok()) {
+        size_t offset = w.vlog_offset + vlog::kVHeaderSize;
+        s = WriteBatchInternal::InsertAddressInto(
+            w.batch, w.vlog_number, options_.min_blob_size, group->mem, true,
+            &offset, &inline_count, &inline_bytes);
+      }
+      mutex_.Lock();
+      if (group != nullptr) {
+        if (inline_count > 0) {
+          vlog_manager_.AddGarbage(w.vlog_number, inline_count, inline_bytes);
+          unpersisted_garbage_ += inline_count;
+        }
+        if (!s.ok() && group->status.ok()) {
+          group->status = s;
+        }
+        if (--group->inserting == 0) {
+          group->writers.front()->cv.Signal();
+        }
+      }
+    }
+    // Members of a pending group have left the queue before they are
+    // done, and may find it empty.
+    if (w.done || (!writers_.empty() && &w == writers_.front())) {
+      break;
+    }
     w.cv.Wait();
   }
   if (w.done) {
     return w.status;
   }
+  return WriteLeaderGroup(&w);
+}
+
+// REQUIRES: mutex_ is held
+// REQUIRES: *w is at the front of the writer queue
+Status DBImpl::WriteLeaderGroup(Writer* w) {
+  mutex_.AssertHeld();
+  assert(w == writers_.front());
+  WriteBatch* updates = w->batch;
+
+  if (w->sync) {
+    // Sync writers that arrive while the previous sync is in flight are
+    // written as one group and share the next sync.  Waiting a little
+    // longer lets even more of them join.
+    WaitForPendingGroups();
+    if (options_.max_sync_delay_micros > 0) {
+      mutex_.Unlock();
+      env_->SleepForMicroseconds(options_.max_sync_delay_micros);
+      mutex_.Lock();
+    }
+  }
 
   // May temporarily unlock and wait.
   Status status = MakeRoomForWrite(updates == nullptr);
-  uint64_t last_sequence = versions_->LastSequence();
-  Writer* last_writer = &w;
+  // Groups that are still synced or applied hold the sequence numbers
+  // before ours.
+  uint64_t last_sequence = pending_groups_.empty()
+                               ? versions_->LastSequence()
+                               : pending_groups_.back()->last_sequence;
+  Writer* last_writer = w;
   if (status.ok() && updates != nullptr) {  // nullptr batch is for compactions
-    WriteBatch* write_batch = BuildBatchGroup(&last_writer);
-    WriteBatchInternal::SetSequence(write_batch, last_sequence + 1);
-    last_sequence += WriteBatchInternal::Count(write_batch);
-
-    // Add to log and apply to memtable.  We can release the lock
-    // during this phase since &w is currently responsible for logging
-    // and protects against concurrent loggers and concurrent writes
-    // into mem_.
-    uint64_t vlog_file_number = vlogfile_number_;
-    {
-      mutex_.Unlock();
-      status =
-          vlog_manager_.AddRecord(WriteBatchInternal::Contents(write_batch));
-      vlog_head_ += vlog::kVHeaderSize;
-      bool sync_error = false;
-      if (status.ok() && options.sync) {
-        status = vlog_manager_.Sync();
+    BuildBatchGroup(&write_group_);
+    last_writer = write_group_.back();
+    const std::vector<Writer*>* members = &write_group_;
+
+    // Every batch of the group gets a vlog record of its own.  The records
+    // are reserved here in queue order, and followers with large batches
+    // copy them in while the leader applies the group to the memtable;
+    // small batches are not worth waking their writers for.  We can
+    // release the lock during this phase since &w is currently responsible
+    // for logging and protects against concurrent loggers and concurrent
+    // writes into mem_.  Pipelined groups write into mem_ concurrently.
+    // The values moved by garbage collection get a record in the vlog
+    // partition of each of their keys, filled by the leader.
+    const size_t num_streams = vlog_streams_.size();
+    std::vector<uint64_t> vlog_ends(num_streams);
+    for (size_t p = 0; p < num_streams; p++) {
+      vlog_ends[p] = vlog_streams_[p].head;
+    }
+    bool sync = false;
+    bool handed_off = false;
+    for (Writer* member : *members) {
+      sync |= member->sync;
+      if (member->batch == nullptr) {
+        continue;
+      }
+      WriteBatchInternal::SetSequence(member->batch, last_sequence + 1);
+      if (member->partition < 0) {
+        for (BatchPart& part : member->parts) {
+          WriteBatchInternal::SetSequence(&part.batch, last_sequence + 1);
+          last_sequence += WriteBatchInternal::Count(&part.batch);
+          const Slice contents = WriteBatchInternal::Contents(&part.batch);
+          status = vlog_manager_.ReserveRecord(part.partition, contents.size(),
+                                               &part.vlog_offset);
+          if (!status.ok()) {
+            break;
+          }
+          assert(part.vlog_offset == vlog_ends[part.partition]);
+          vlog_ends[part.partition] =
+              part.vlog_offset + vlog::kVHeaderSize + contents.size();
+          part.vlog_number = vlog_streams_[part.partition].number;
+        }
         if (!status.ok()) {
-          sync_error = true;
+          break;
         }
+        continue;
       }
+      last_sequence += WriteBatchInternal::Count(member->batch);
+      const Slice contents = WriteBatchInternal::Contents(member->batch);
+      const int p = member->partition;
+      status = vlog_manager_.ReserveRecord(p, contents.size(),
+                                           &member->vlog_offset);
+      if (!status.ok()) {
+        break;
+      }
+      assert(member->vlog_offset == vlog_ends[p]);
+      vlog_ends[p] = member->vlog_offset + vlog::kVHeaderSize + contents.size();
+      member->vlog_number = vlog_streams_[p].number;
+      if (member != w && contents.size() >= kMinFollowerFillBytes) {
+        member->fill = true;
+        member->cv.Signal();
+        handed_off = true;
+      }
+    }
+    std::vector<uint64_t> vlog_starts(num_streams);
+    for (size_t p = 0; p < num_streams; p++) {
+      vlog_starts[p] = vlog_streams_[p].head;
+      vlog_streams_[p].head = vlog_ends[p];
+    }
+
+    // With pipelined writes the group leaves the writer queue as soon as
+    // its records are reserved, so that the next group is appended to the
+    // vlog while this one is applied to the memtable.  mem_ is not
+    // replaced while the group is pending.  The followers that fill their
+    // records also insert their batches, in parallel with the leader.
+    PendingGroup group;
+    MemTable* mem = mem_;
+    const bool pipelined = options_.enable_pipelined_write && status.ok();
+    if (pipelined) {
+      group.last_sequence = last_sequence;
+      group.applied = false;
+      group.mem = mem;
+      group.inserting = 0;
+      AddPendingGroup(&group, last_writer);
+      members = &group.writers;
+      for (Writer* member : group.writers) {
+        if (member->fill) {
+          member->group = &group;
+          group.inserting++;
+        }
+      }
+    }
+
+    // Inline values per partition: <count, bytes>
+    std::vector<std::pair<uint64_t, uint64_t>> inline_values(num_streams);
+    if (status.ok()) {
+      mutex_.Unlock();
+      if (address_cache_ != nullptr) {
+        // The cached addresses of the keys go away before the sequence is
+        // published, which also covers the values moved by garbage
+        // collection.
+        for (Writer* member : *members) {
+          if (member->batch != nullptr) {
+            address_cache_->Invalidate(member->batch, last_sequence);
+          }
+        }
+      }
+      for (Writer* member : *members) {
+        if (member->batch == nullptr || !status.ok()) {
+          continue;
+        }
+        if (member->partition < 0) {
+          for (const BatchPart& part : member->parts) {
+            status = vlog_manager_.FillRecord(
+                part.partition, part.vlog_offset,
+                WriteBatchInternal::Contents(&part.batch));
+            if (!status.ok()) {
+              break;
+            }
+          }
+        } else if (member == w ||
+                   WriteBatchInternal::Contents(member->batch).size() <
+                       kMinFollowerFillBytes) {
+          status = vlog_manager_.FillRecord(
+              member->partition, member->vlog_offset,
+              WriteBatchInternal::Contents(member->batch));
+        }
+      }
+      bool vlog_error = !status.ok();
       if (status.ok()) {
-        status = WriteBatchInternal::InsertAddressInto(
-            write_batch, vlog_file_number, mem_, &vlog_head_);
+        for (Writer* member : *members) {
+          if (member->batch == nullptr || member->group != nullptr) {
+            continue;
+          }
+          uint64_t count, bytes;
+          if (member->partition < 0) {
+            for (BatchPart& part : member->parts) {
+              size_t offset = part.vlog_offset + vlog::kVHeaderSize;
+              status = WriteBatchInternal::InsertAddressInto(
+                  &part.batch, part.vlog_number, options_.min_blob_size, mem,
+                  pipelined, &offset, &count, &bytes);
+              if (!status.ok()) {
+                break;
+              }
+              inline_values[part.partition].first += count;
+              inline_values[part.partition].second += bytes;
+            }
+          } else {
+            size_t offset = member->vlog_offset + vlog::kVHeaderSize;
+            status = WriteBatchInternal::InsertAddressInto(
+                member->batch, member->vlog_number, options_.min_blob_size,
+                mem, pipelined, &offset, &count, &bytes);
+            if (status.ok()) {
+              inline_values[member->partition].first += count;
+              inline_values[member->partition].second += bytes;
+            }
+          }
+          if (!status.ok()) {
+            break;
+          }
+        }
+      }
+      // Readers may find the values in the vlog buffer once the sequence
+      // is published, so every record of the group, and of the pipelined
+      // groups before it, must be in place by then.
+      if (status.ok() && (handed_off || pipelined)) {
+        for (size_t p = 0; p < num_streams && status.ok(); p++) {
+          if (vlog_ends[p] != vlog_starts[p]) {
+            status = vlog_manager_.WaitFilled(p, vlog_ends[p]);
+          }
+        }
+        vlog_error = !status.ok();
       }
       mutex_.Lock();
-      if (sync_error) {
+      if (pipelined) {
+        while (group.inserting > 0) {
+          w->cv.Wait();
+        }
+        if (status.ok()) {
+          status = group.status;
+        }
+      }
+      if (vlog_error) {
         // The state of the log file is indeterminate: the log record we
         // just added may or may not show up when the DB is re-opened.
         // So we force the DB into a mode where all future writes fail.
         RecordBackgroundError(status);
       }
     }
-    if (write_batch == tmp_batch_) tmp_batch_->Clear();
+    for (size_t p = 0; p < num_streams; p++) {
+      if (inline_values[p].first > 0) {
+        // The vlog copy of an inline value is only needed to replay the
+        // write, so it is garbage as soon as the memtable is flushed.
+        vlog_manager_.AddGarbage(vlog_streams_[p].number,
+                                 inline_values[p].first,
+                                 inline_values[p].second);
+        unpersisted_garbage_ += inline_values[p].first;
+      }
+    }
 
+    if (pipelined || sync || !pending_groups_.empty()) {
+      // The group is published once its vlog records are synced and the
+      // groups before it are published.  It leaves the writer queue now,
+      // so that the next groups can be appended meanwhile and share the
+      // sync of their records with this one.
+      if (!pipelined) {
+        group.last_sequence = last_sequence;
+        group.applied = false;
+        AddPendingGroup(&group, last_writer);
+      }
+      group.status = status;
+      if (sync && group.status.ok()) {
+        mutex_.Unlock();
+        group.status = vlog_manager_.Sync();
+        mutex_.Lock();
+        if (!group.status.ok()) {
+          RecordBackgroundError(group.status);
+        }
+      }
+      group.applied = true;
+      PublishPendingGroups();
+      while (!w->done) {
+        w->cv.Wait();
+      }
+      return w->status;
+    }
     versions_->SetLastSequence(last_sequence);
   }
 
   while (true) {
     Writer* ready = writers_.front();
     writers_.pop_front();
-    if (ready != &w) {
+    if (ready != w) {
       ready->status = status;
       ready->done = true;
       ready->cv.Signal();
@@ -1291,14 +2632,58 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   return status;
 }
 
+void DBImpl::AddPendingGroup(PendingGroup* group, Writer* last_writer) {
+  mutex_.AssertHeld();
+  while (true) {
+    Writer* ready = writers_.front();
+    writers_.pop_front();
+    group->writers.push_back(ready);
+    if (ready == last_writer) break;
+  }
+  pending_groups_.push_back(group);
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+}
+
+void DBImpl::PublishPendingGroups() {
+  mutex_.AssertHeld();
+  while (!pending_groups_.empty() && pending_groups_.front()->applied) {
+    PendingGroup* group = pending_groups_.front();
+    pending_groups_.pop_front();
+    if (bg_error_.ok()) {
+      versions_->SetLastSequence(group->last_sequence);
+    } else if (group->status.ok()) {
+      // A sync in front of this group failed, so its writes stay invisible.
+      group->status = bg_error_;
+    }
+    for (Writer* writer : group->writers) {
+      writer->status = group->status;
+      writer->done = true;
+      writer->cv.Signal();
+    }
+  }
+  if (pending_groups_.empty()) {
+    pending_groups_published_.SignalAll();
+  }
+}
+
+void DBImpl::WaitForPendingGroups() {
+  mutex_.AssertHeld();
+  while (!pending_groups_.empty()) {
+    pending_groups_published_.Wait();
+  }
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-null batch
-WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
+void DBImpl::BuildBatchGroup(std::vector<Writer*>* group) {
   mutex_.AssertHeld();
   assert(!writers_.empty());
   Writer* first = writers_.front();
-  WriteBatch* result = first->batch;
-  assert(result != nullptr);
+  assert(first->batch != nullptr);
+  group->clear();
+  group->push_back(first);
 
   size_t size = WriteBatchInternal::ByteSize(first->batch);
 
@@ -1309,36 +2694,30 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   if (size <= (128 << 10)) {
     max_size = size + (128 << 10);
   }
+  // The vlog records of the group, headers included, should also fit in
+  // the vlog write buffer; those that do not bypass it.
+  size_t vlog_size = vlog::kVHeaderSize + size;
 
-  *last_writer = first;
   std::deque<Writer*>::iterator iter = writers_.begin();
   ++iter;  // Advance past "first"
   for (; iter != writers_.end(); ++iter) {
     Writer* w = *iter;
-    if (w->sync && !first->sync) {
-      // Do not include a sync write into a batch handled by a non-sync write.
+    if (w->clean) {
+      // A garbage collection writer has to check liveness itself once it
+      // reaches the front of the queue.
       break;
     }
 
     if (w->batch != nullptr) {
       size += WriteBatchInternal::ByteSize(w->batch);
-      if (size > max_size) {
+      vlog_size += vlog::kVHeaderSize + WriteBatchInternal::ByteSize(w->batch);
+      if (size > max_size || vlog_size > options_.vlog_write_buffer_size) {
         // Do not make batch too big
         break;
       }
-
-      // Append to *result
-      if (result == first->batch) {
-        // Switch to temporary batch instead of disturbing caller's batch
-        result = tmp_batch_;
-        assert(WriteBatchInternal::Count(result) == 0);
-        WriteBatchInternal::Append(result, first->batch);
-      }
-      WriteBatchInternal::Append(result, w->batch);
     }
-    *last_writer = w;
+    group->push_back(w);
   }
-  return result;
 }
 
 // REQUIRES: mutex_ is held
@@ -1348,14 +2727,38 @@ Status DBImpl::MakeRoomForWrite(bool force) {
   assert(!writers_.empty());
   bool allow_delay = !force;
   Status s;
-  if (vlog_head_ >= options_.max_vlog_size) {
+  for (size_t p = 0; p < vlog_streams_.size(); p++) {
+    VlogStream* stream = &vlog_streams_[p];
+    if (stream->head < vlog::MaxVlogSize(options_, p)) {
+      continue;
+    }
+    // Pending groups sync the current vlog.
+    WaitForPendingGroups();
     //新生成的vlog文件的编号会和imm生成的sst文件一起应用到version中，见CompactMemTable
     uint32_t new_log_number = versions_->NewVlogNumber();
-    vlog_head_ = 0;
-
-    vlogfile_number_ = new_log_number;
-    vlog_manager_.AddVlog(dbname_, options_, new_log_number);
-    Log(options_.info_log, "new vlog %d...\n", new_log_number);
+    stream->head = 0;
+
+    stream->number = new_log_number;
+    bool recycled = false;
+    if (!recycled_vlogs_.empty()) {
+      const std::pair<uint64_t, int> old = recycled_vlogs_.back();
+      recycled_vlogs_.pop_back();
+      Status r = vlog_manager_.RecycleVlog(dbname_, options_, old.first,
+                                           old.second, new_log_number, p);
+      recycled = r.ok();
+      if (!recycled) {
+        Log(options_.info_log, "Recycling vlog #%llu failed: %s",
+            (unsigned long long)old.first, r.ToString().c_str());
+        env_->RemoveFile(VlogFileName(dbname_, old.first, old.second));
+      }
+    }
+    if (!recycled) {
+      vlog_manager_.AddVlog(dbname_, options_, new_log_number, p);
+    }
+    Log(options_.info_log, "new vlog %d of partition %d...\n", new_log_number,
+        static_cast<int>(p));
+    // The previous vlog is sealed now and may be garbage collected.
+    MaybeScheduleCompaction();
   }
   while (true) {
     if (!bg_error_.ok()) {
@@ -1382,16 +2785,26 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // We have filled up the current memtable, but the previous
       // one is still being compacted, so we wait.
       Log(options_.info_log, "Current memtable full; waiting...\n");
+      DismissCleanWriters();
       background_work_finished_signal_.Wait();
     } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
       // There are too many level-0 files.
       Log(options_.info_log, "Too many L0 files; waiting...\n");
+      DismissCleanWriters();
       background_work_finished_signal_.Wait();
+    } else if (!pending_groups_.empty()) {
+      // The memtable must not be flushed with unpublished entries.
+      WaitForPendingGroups();
     } else {
       imm_ = mem_;
       has_imm_.store(true, std::memory_order_release);
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
+      for (VlogStream& stream : vlog_streams_) {
+        stream.mem_number = stream.number;
+        stream.mem_head = stream.head;
+      }
+      InstallSuperVersion();
       force = false;  // Do not force another compaction if have room
       MaybeScheduleCompaction();
     }
@@ -1443,8 +2856,60 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
+  } else if (in == "vlog-garbage") {
+    char buf[200];
+    std::snprintf(buf, sizeof(buf),
+                  "  Vlog  Size(MB) Garbage(MB) Dropped  Ratio\n"
+                  "--------------------------------------------\n");
+    value->append(buf);
+    std::vector<uint64_t> numbers;
+    vlog_manager_.GetVlogNumbers(&numbers);
+    for (uint64_t n : numbers) {
+      uint64_t count, garbage;
+      vlog_manager_.GetGarbage(n, &count, &garbage);
+      const uint64_t size = vlog_manager_.GetVlogSize(n);
+      std::snprintf(buf, sizeof(buf), "%6llu %9.1f %11.1f %7llu %5.2f\n",
+                    static_cast<unsigned long long>(n), size / 1048576.0,
+                    garbage / 1048576.0, static_cast<unsigned long long>(count),
+                    size > 0 ? static_cast<double>(garbage) / size : 0.0);
+      value->append(buf);
+    }
+    return true;
+  } else if (in == "value-cache") {
+    uint64_t hits, misses;
+    vlog_manager_.GetValueCacheStats(&hits, &misses);
+    char buf[100];
+    std::snprintf(buf, sizeof(buf), "hits: %llu misses: %llu usage: %llu",
+                  static_cast<unsigned long long>(hits),
+                  static_cast<unsigned long long>(misses),
+                  static_cast<unsigned long long>(
+                      options_.value_cache != nullptr
+                          ? options_.value_cache->TotalCharge()
+                          : 0));
+    value->append(buf);
+    return true;
+  } else if (in == "address-cache") {
+    uint64_t hits = 0, misses = 0;
+    if (address_cache_ != nullptr) {
+      address_cache_->GetStats(&hits, &misses);
+    }
+    char buf[100];
+    std::snprintf(buf, sizeof(buf), "hits: %llu misses: %llu",
+                  static_cast<unsigned long long>(hits),
+                  static_cast<unsigned long long>(misses));
+    value->append(buf);
+    return true;
   } else if (in == "approximate-memory-usage") {
     size_t total_usage = options_.block_cache->TotalCharge();
+    if (options_.value_cache != nullptr &&
+        options_.value_cache != options_.block_cache) {
+      total_usage += options_.value_cache->TotalCharge();
+    }
+    if (options_.address_cache != nullptr &&
+        options_.address_cache != options_.block_cache &&
+        options_.address_cache != options_.value_cache) {
+      total_usage += options_.address_cache->TotalCharge();
+    }
     if (mem_) {
       total_usage += mem_->ApproximateMemoryUsage();
     }
@@ -1493,6 +2958,22 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+void DB::MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                  std::string* values, Status* statuses) {
+  ReadOptions read_options = options;
+  const Snapshot* snapshot = nullptr;
+  if (read_options.snapshot == nullptr) {
+    snapshot = GetSnapshot();
+    read_options.snapshot = snapshot;
+  }
+  for (int i = 0; i < n; i++) {
+    statuses[i] = Get(read_options, keys[i], &values[i]);
+  }
+  if (snapshot != nullptr) {
+    ReleaseSnapshot(snapshot);
+  }
+}
+
 DB::~DB() = default;
 
 Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
@@ -1504,23 +2985,38 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
   // Recover handles create_if_missing, error_if_exists
   bool save_manifest = false;
   Status s = impl->Recover(&edit, &save_manifest);
-  if (s.ok() && impl->mem_ == nullptr) {
-    assert(impl->vlog_head_ == 0);
-    // Create new log and a corresponding memtable.
-    uint64_t new_log_number = impl->versions_->NewVlogNumber();
-    edit.SetLogNumber(new_log_number);
-    impl->vlogfile_number_ = new_log_number;
-    impl->mem_ = new MemTable(impl->internal_comparator_);
-    impl->mem_->Ref();
-    impl->vlog_manager_.AddVlog(dbname, options, new_log_number);
+  if (s.ok()) {
+    // Create new logs for the partitions whose last log is not reused, and
+    // a memtable if there is none yet.
+    for (size_t p = 0; p < impl->vlog_streams_.size(); p++) {
+      DBImpl::VlogStream* stream = &impl->vlog_streams_[p];
+      if (stream->number != 0) {
+        continue;
+      }
+      uint64_t new_log_number = impl->versions_->NewVlogNumber();
+      stream->number = new_log_number;
+      stream->head = 0;
+      stream->mem_number = new_log_number;
+      stream->mem_head = 0;
+      impl->vlog_manager_.AddVlog(dbname, impl->options_, new_log_number, p);
+    }
+    impl->SetReplayHeads(&edit);
+    if (impl->mem_ == nullptr) {
+      impl->mem_ = new MemTable(impl->internal_comparator_);
+      impl->mem_->Ref();
+    }
   }
   if (s.ok() && save_manifest) {
     edit.SetPrevLogNumber(0);  // No older logs needed after recovery.
-    edit.SetLogNumber(impl->vlogfile_number_);
+    std::string vlog_info;
+    impl->vlog_manager_.EncodeGarbageTo(&vlog_info);
+    edit.SetVlogInfo(vlog_info);
     s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
   }
   if (s.ok()) {
+    impl->InstallSuperVersion();
     impl->RemoveObsoleteFiles();
+    impl->DeallocateCleanedVlogSpace();
     impl->MaybeScheduleCompaction();
   }
   impl->mutex_.Unlock();
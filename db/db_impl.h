@@ -15,6 +15,7 @@
 #include <deque>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "leveldb/db.h"
 #include "leveldb/env.h"
@@ -26,7 +27,9 @@
 
 namespace leveldb {
 
+class AddressCache;
 class MemTable;
+class PrefetchExecutor;
 class TableCache;
 class Version;
 class VersionEdit;
@@ -48,7 +51,14 @@ class DBImpl : public DB {
   Status Write(const WriteOptions& options, WriteBatch* updates) override;
   Status Get(const ReadOptions& options, const Slice& key,
              std::string* value) override;
+  void MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                std::string* values, Status* statuses) override;
   Status Fetch(Slice addr, std::string* value);
+  // Fetches the values at addrs[0,n-1] with sorted, coalesced vlog reads.
+  void Fetch(size_t n, const Slice* addrs, std::string* const* values,
+             Status* statuses);
+  // Runs the vlog reads that iterators issue ahead of the caller.
+  PrefetchExecutor* prefetch_executor() { return prefetch_executor_; }
   Iterator* NewIterator(const ReadOptions&) override;
   Iterator* NewAddrIterator(const ReadOptions&) override;
   const Snapshot* GetSnapshot() override;
@@ -82,7 +92,24 @@ class DBImpl : public DB {
  private:
   friend class DB;
   struct CompactionState;
+  struct SuperVersion;
+  struct SuperVersionSlot;
   struct Writer;
+  struct BatchPart;
+  struct PendingGroup;
+  struct VlogCleanEntry;
+  class VlogReplayReader;
+  struct RecoveredTable;
+
+  // The vlog that a vlog partition appends to, see Options::vlog_partitions.
+  struct VlogStream {
+    VlogStream() : number(0), head(0), mem_number(0), mem_head(0) {}
+
+    uint64_t number;      // Current vlog, 0 until one is opened
+    size_t head;          // End of the records of the current vlog
+    uint64_t mem_number;  // Oldest vlog with mem_ records
+    uint64_t mem_head;    // Offset of mem_'s first record in it
+  };
 
   // Information for a manual compaction
   struct ManualCompaction {
@@ -115,6 +142,26 @@ class DBImpl : public DB {
 
   Status NewDB();
 
+  // Return a referenced SuperVersion to read from.  In the steady state it
+  // is taken from the slot of the calling thread without locking mutex_.
+  // Hand it back with ReturnSuperVersion() once the read is done.
+  SuperVersion* AcquireSuperVersion() LOCKS_EXCLUDED(mutex_);
+  void ReturnSuperVersion(SuperVersion* sv) LOCKS_EXCLUDED(mutex_);
+
+  // Drop a reference to "sv", which is deleted with the last one.
+  void UnrefSuperVersion(SuperVersion* sv) LOCKS_EXCLUDED(mutex_);
+  void UnrefSuperVersionLocked(SuperVersion* sv)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void DeleteSuperVersion(SuperVersion* sv) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Iterator cleanup function that drops the SuperVersion "arg2" of the
+  // DBImpl "arg1".
+  static void CleanupIteratorSuperVersion(void* arg1, void* arg2);
+
+  // Publish a SuperVersion of mem_, imm_ and the current version if any of
+  // them changed, and drop the SuperVersions cached in the slots.
+  void InstallSuperVersion() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   // Recover the descriptor from persistent storage.  May do a significant
   // amount of work to recover recently logged updates.  Any changes to
   // be made to the descriptor are added to *edit.
@@ -131,17 +178,60 @@ class DBImpl : public DB {
   // Errors are recorded in bg_error_.
   void CompactMemTable() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status RecoverLogFile(uint64_t log_number, bool last_log, bool* save_manifest,
-                        VersionEdit* edit, SequenceNumber* max_sequence)
+  Status RecoverLogFile(uint64_t log_number, int partition,
+                        uint64_t initial_offset,
+                        VlogReplayReader* reader, bool last_log,
+                        bool* save_manifest, VersionEdit* edit,
+                        std::deque<RecoveredTable*>* tables,
+                        SequenceNumber* max_sequence)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Start building the level-0 table of a memtable filled by recovery on a
+  // thread of its own, so that the replay can go on meanwhile.  Takes over
+  // the reference to "mem".
+  void FlushRecoveredMemTable(MemTable* mem,
+                              std::deque<RecoveredTable*>* tables)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Wait for the oldest "n" tables of "*tables" and add them to *edit.
+  Status FinishRecoveredTables(size_t n, std::deque<RecoveredTable*>* tables,
+                               VersionEdit* edit)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Record in *edit that replay starts at the first record of mem_ in every
+  // vlog partition.
+  void SetReplayHeads(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Set w->partition to the vlog partition of the keys of w->batch.  If
+  // they belong to several partitions, a user batch gets the partition of
+  // its first key, while garbage collection gets -1 and its batch is split
+  // into w->parts.
+  void AssignPartition(Writer* w) const;
+
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
-  WriteBatch* BuildBatchGroup(Writer** last_writer)
+  // Store in *group the writers at the front of writers_ whose batches
+  // are written together, starting with the leader.
+  void BuildBatchGroup(std::vector<Writer*>* group)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Write the batch group led by *w, which is at the front of writers_, and
+  // wake up the writers it covers.
+  Status WriteLeaderGroup(Writer* w) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Move the writers from the front of the writer queue to "last_writer"
+  // into *group, queue it in pending_groups_ and wake up the next writer.
+  void AddPendingGroup(PendingGroup* group, Writer* last_writer)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Publish the sequence numbers of the applied groups at the front of
+  // pending_groups_ and wake up their writers.
+  void PublishPendingGroups() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Wait until every pending group is published, so that mem_ holds no
+  // unpublished entries and every vlog record is synced as requested.
+  void WaitForPendingGroups() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   void RecordBackgroundError(const Status& s);
 
@@ -159,6 +249,19 @@ class DBImpl : public DB {
   Status InstallCompactionResults(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Vlog garbage collection.  Sealed vlogs are read from the tail cursor
+  // recorded in the descriptor, live values are appended at the head and
+  // fully processed vlogs are retired.
+  bool NeedsVlogClean() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void DismissCleanWriters() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool PickVlogToClean(uint64_t* number, uint64_t* offset)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void BackgroundVlogClean() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status RewriteLiveValues(const std::vector<VlogCleanEntry>& entries,
+                           bool* deferred, uint64_t* live_bytes)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void DeallocateCleanedVlogSpace() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   const Comparator* user_comparator() const {
     return internal_comparator_.user_comparator();
   }
@@ -185,16 +288,46 @@ class DBImpl : public DB {
   MemTable* mem_;
   MemTable* imm_ GUARDED_BY(mutex_);  // Memtable being compacted
   std::atomic<bool> has_imm_;         // So bg thread can detect non-null imm_
-  uint64_t vlogfile_number_ GUARDED_BY(mutex_);
-  size_t vlog_head_;
+  // vlog_streams_[p] is the vlog of partition p.
+  std::vector<VlogStream> vlog_streams_ GUARDED_BY(mutex_);
   vlog::VlogManager vlog_manager_;
+  PrefetchExecutor* const prefetch_executor_;
+  AddressCache* const address_cache_;  // nullptr without Options::address_cache
+  // Values dropped by compaction or stored inline since the garbage table
+  // was last persisted.
+  uint64_t unpersisted_garbage_ GUARDED_BY(mutex_);
+  // Bytes handed to Write() and the value it must reach before garbage
+  // collection resumes after a pass that reclaimed too little.
+  uint64_t vlog_bytes_written_ GUARDED_BY(mutex_);
+  uint64_t clean_resume_bytes_ GUARDED_BY(mutex_);
+  // Bytes read from and rewritten for the vlog being collected.
+  uint64_t clean_bytes_read_ GUARDED_BY(mutex_);
+  uint64_t clean_bytes_live_ GUARDED_BY(mutex_);
+  // Retired vlogs whose zeroed files become the next new vlogs, with the
+  // partitions their file names belong to.
+  std::vector<std::pair<uint64_t, int>> recycled_vlogs_ GUARDED_BY(mutex_);
   static const int buffer_size_ = 409600;
   char buffer_[buffer_size_] GUARDED_BY(mutex_);
-  uint32_t seed_ GUARDED_BY(mutex_);  // For sampling.
+  std::atomic<uint32_t> seed_;  // For sampling.
+
+  // The SuperVersion of mem_, imm_ and the current version.  Readers cache
+  // references to it in sv_slots_, so that a read only locks mutex_ when
+  // it has changed.
+  SuperVersion* super_version_ GUARDED_BY(mutex_);
+  std::atomic<uint64_t> super_version_number_;
+  SuperVersionSlot* const sv_slots_;
 
   // Queue of writers.
   std::deque<Writer*> writers_ GUARDED_BY(mutex_);
-  WriteBatch* tmp_batch_ GUARDED_BY(mutex_);
+  std::vector<Writer*> write_group_;  // Only used by the leading writer
+
+  // Groups applied to mem_ whose sequence numbers are not published yet,
+  // in sequence order.  A sync group leaves the writer queue before its
+  // vlog records are synced, so that the groups behind it can share the
+  // sync.  With Options::enable_pipelined_write every group leaves the
+  // queue before it is applied.
+  std::deque<PendingGroup*> pending_groups_ GUARDED_BY(mutex_);
+  port::CondVar pending_groups_published_ GUARDED_BY(mutex_);
 
   SnapshotList snapshots_ GUARDED_BY(mutex_);
 
@@ -7,8 +7,9 @@
 #include "db/db_impl.h"
 #include "db/dbformat.h"
 #include "db/filename.h"
-#include <queue>
-#include <thread>
+#include "db/prefetch_executor.h"
+#include <atomic>
+#include <deque>
 #include <vector>
 
 #include "leveldb/env.h"
@@ -39,6 +40,11 @@ static void DumpInternalIter(Iterator* iter) {
 // combines multiple entries for the same userkey found in the DB
 // representation into a single entry while accounting for sequence
 // numbers, deletion markers, overwrites, etc.
+//
+// The raw value of an entry is either the address of the value in a vlog
+// or, for values smaller than Options::min_blob_size, the value itself.
+// If "addresses_only" is true, entries whose value is stored inline are
+// skipped so that every yielded value is an address.
 class DBAddrIter : public Iterator {
   friend class ConcurrenceDBIter;
 
@@ -51,12 +57,14 @@ class DBAddrIter : public Iterator {
   enum Direction { kForward, kReverse };
 
   DBAddrIter(DBImpl* db, const Comparator* cmp, Iterator* iter,
-             SequenceNumber s, uint32_t seed)
+             SequenceNumber s, uint32_t seed, bool addresses_only)
       : db_(db),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        addresses_only_(addresses_only),
         direction_(kForward),
+        saved_type_(kTypeValue),
         valid_(false),
         rnd_(seed),
         bytes_until_read_sampling_(RandomCompactionPeriod()) {}
@@ -88,9 +96,21 @@ class DBAddrIter : public Iterator {
   void SeekToFirst() override;
   void SeekToLast() override;
 
+  // Returns true if value() is the value itself rather than its address.
+  bool IsInlineValue() const {
+    assert(valid_);
+    if (direction_ == kForward) {
+      const Slice k = iter_->key();
+      return static_cast<ValueType>(DecodeFixed64(k.data() + k.size() - 8) &
+                                    0xff) == kTypeInlineValue;
+    }
+    return saved_type_ == kTypeInlineValue;
+  }
+
  private:
   void FindNextUserEntry(bool skipping, std::string* skip);
   void FindPrevUserEntry();
+  void SkipInlineValues();
   bool ParseKey(ParsedInternalKey* key);
 
   inline void SaveKey(const Slice& k, std::string* dst) {
@@ -115,233 +135,347 @@ class DBAddrIter : public Iterator {
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  const bool addresses_only_;
   Status status_;
   std::string saved_key_;    // == current key when direction_==kReverse
   std::string saved_value_;  // == current raw value when direction_==kReverse
   Direction direction_;
+  ValueType saved_type_;  // == current value type when direction_==kReverse
   bool valid_;
   Random rnd_;
   size_t bytes_until_read_sampling_;
 };
 
-class IterCache {
- public:
-  IterCache() : valid_(false), sequence(0) {}
-  ~IterCache() = default;
-  IterCache(const IterCache& r)
-      : key_(r.key_),
-        addr_(r.addr_),
-        val_(r.val_),
-        valid_(r.valid_),
-        status(r.status),
-        sequence(r.sequence.load(std::memory_order_relaxed)) {}
+class ConcurrenceDBIter;
+
+// An entry that ConcurrenceDBIter has read ahead.
+struct IterCache {
+  IterCache() : bytes(0), pending(false), ready(false), dropped(false) {}
+
   std::string key_;
   std::string addr_;
   std::string val_;
-  bool valid_;
   Status status;
-  std::atomic<uint64_t> sequence;
-};
-
-class TaskQueue {
- public:
-  TaskQueue() : head_(0), tail_(0), con_(&mutex_) { que_.resize(512); }
-  bool Empty() const { return head_ == tail_; }
-  std::pair<uint64_t, uint64_t> Pop() { return que_[tail_++ % que_.size()]; }
-  void Push(uint64_t i, uint64_t seq) {
-    que_[head_++ % que_.size()] = std::make_pair(i, seq);
-  }
-  void TryExpand() {
-    if (head_ - tail_ == que_.size()) {
-      que_.resize(que_.size() * 2);
-    }
-  }
-  std::vector<std::pair<uint64_t, uint64_t>> que_;
-  size_t head_;
-  size_t tail_;
-  port::Mutex mutex_;
-  port::CondVar con_;
+  uint64_t bytes;  // Approximate size of the key and the value
+  // A fetch of addr_ is scheduled; only cleared with the iterator's mu_
+  std::atomic<bool> pending;
+  std::atomic<bool> ready;  // val_ and status are filled
+  bool dropped;  // Left the window while pending; guarded by the same mu_
 };
 
+// Reads the values of the entries following the current one from the vlogs
+// in parallel, on the DB's PrefetchExecutor.
+//
+// The number of entries read ahead starts small and doubles every time the
+// caller has consumed as many entries as are read ahead, like TCP slow
+// start, so that short scans do not read values they never use.  The
+// entries read ahead are bounded by a byte budget.  A readahead hint skips
+// the slow start and stops the read ahead once the hinted number of entries
+// has been read after a seek.
 class ConcurrenceDBIter : public Iterator {
   friend class DBImpl;
-  static constexpr size_t MAX_SIZE = 1024;
+
+  // Entries read ahead after a seek when the caller gave no hint.
+  static constexpr size_t kInitialReadahead = 2;
+
+  // Upper bounds of the entries, and their approximate bytes, that a single
+  // prefetch task fetches.  Larger batches coalesce more reads, smaller
+  // ones spread the reads over more threads.
+  static constexpr size_t kMaxBatchEntries = 64;
+  static constexpr uint64_t kMaxBatchBytes = 256 * 1024;
 
  public:
   ConcurrenceDBIter(DBImpl* db, const Comparator* cmp, Iterator* iter,
-                    SequenceNumber s, uint32_t seed)
-      : dbIter_(db, cmp, iter, s, seed),
-        front_(1ULL << 63),
-        back_(1ULL << 63),
-        cur_index_(1ULL << 63),
-        tot_tasks_(0),
-        completed_tasks_(0),
-        data_size_(0),
-        closing_(false) {
-    buffer_queue_.resize(MAX_SIZE);
-    for (int i = 0; i < 32; i++) {
-      threads_.emplace_back(Worker, this, i);
-    }
-  }
+                    SequenceNumber s, uint32_t seed, size_t readahead_hint,
+                    uint64_t max_readahead_bytes)
+      : dbIter_(db, cmp, iter, s, seed, false),
+        executor_(db->prefetch_executor()),
+        initial_readahead_(readahead_hint > 0 ? readahead_hint
+                                              : kInitialReadahead),
+        max_readahead_bytes_(max_readahead_bytes),
+        readahead_limit_(readahead_hint > 0 ? readahead_hint : SIZE_MAX),
+        forward_(true),
+        readahead_(initial_readahead_),
+        consumed_(0),
+        unread_limit_(readahead_limit_),
+        window_bytes_(0),
+        done_cv_(&mu_),
+        pending_tasks_(0),
+        waiting_(false),
+        data_size_(0) {}
 
   ConcurrenceDBIter(const ConcurrenceDBIter&) = delete;
   ConcurrenceDBIter& operator=(const ConcurrenceDBIter&) = delete;
 
   ~ConcurrenceDBIter() override {
-    while (completed_tasks_.load(std::memory_order_acquire) != tot_tasks_)
-      ;
-    closing_.store(true, std::memory_order_release);
-    sched_yield();
-    task_ques_.con_.SignalAll();
-    for (auto& t : threads_) t.join();
+    WaitForPendingFetches();
+    for (IterCache* item : window_) {
+      delete item;
+    }
   }
 
-  bool Valid() const override {
-    return buffer_queue_[cur_index_ % MAX_SIZE].valid_;
-  }
+  bool Valid() const override { return !window_.empty(); }
   Slice key() const override {
-    size_t i = cur_index_ % MAX_SIZE;
-    assert(buffer_queue_[i].valid_);
-    return buffer_queue_[i].key_;
+    assert(Valid());
+    return window_.front()->key_;
   }
 
   uint64_t datasize() const override {
-    while (completed_tasks_.load(std::memory_order_acquire) != tot_tasks_)
-      ;
+    WaitForPendingFetches();
     return data_size_;
   }
 
   Slice value() const override {
-    size_t i = cur_index_ % MAX_SIZE;
-    assert(buffer_queue_[i].valid_);
-    while (buffer_queue_[i].sequence.load(std::memory_order_acquire) !=
-           cur_index_)
-      ;
-    return buffer_queue_[i].val_;
-  }
-
-  Status status() const override {
-    return buffer_queue_[cur_index_ % MAX_SIZE].status;
-  }
-
-  void Next() override {
-    cur_index_++;
-    if (cur_index_ == back_) {
-      for (uint64_t s = cur_index_; s < cur_index_ + 256; s++) {
-        dbIter_.Next();
-        if (!GetValue(back_++ % MAX_SIZE, s)) break;
+    assert(Valid());
+    const IterCache* item = window_.front();
+    if (!item->ready.load(std::memory_order_acquire)) {
+      MutexLock l(&mu_);
+      while (!item->ready.load(std::memory_order_relaxed)) {
+        waiting_ = true;
+        done_cv_.Wait();
       }
-      while (back_ - front_ > MAX_SIZE) front_++;
+      waiting_ = false;
     }
+    return item->val_;
   }
 
-  void Prev() override {
-    if (cur_index_ == front_) {
-      for (uint64_t s = cur_index_ - 1; s >= cur_index_ - 256; s--) {
-        dbIter_.Prev();
-        if (!GetValue(--front_ % MAX_SIZE, s)) break;
+  Status status() const override {
+    Status s = dbIter_.status();
+    if (s.ok() && Valid()) {
+      const IterCache* item = window_.front();
+      if (item->ready.load(std::memory_order_acquire)) {
+        s = item->status;
       }
-      while (back_ - front_ > MAX_SIZE) back_--;
     }
-    cur_index_--;
+    return s;
   }
 
+  void Next() override { Step(true); }
+  void Prev() override { Step(false); }
+
   void Seek(const Slice& target) override {
+    Reset(true);
     dbIter_.Seek(target);
-    AfterSeek();
+    Fill();
   }
 
   void SeekToFirst() override {
+    Reset(true);
     dbIter_.SeekToFirst();
-    AfterSeek();
+    Fill();
   }
 
   void SeekToLast() override {
+    Reset(false);
     dbIter_.SeekToLast();
-    AfterSeek();
+    Fill();
   }
 
  private:
-  DBAddrIter dbIter_;
-  std::vector<IterCache> buffer_queue_;
-  size_t cur_index_;
-  size_t back_;
-  size_t front_;
-
-  void AfterSeek() {
-    front_ = 1ULL << 63;
-    back_ = 1ULL << 63;
-    cur_index_ = 1ULL << 63;
-    while (completed_tasks_.load(std::memory_order_acquire) != tot_tasks_)
-      ;
-    completed_tasks_ = 0;
-    tot_tasks_ = 0;
-    GetValue(back_++ % MAX_SIZE, cur_index_);
-  }
-
-  static void Worker(ConcurrenceDBIter* iter, int q) {
-    auto& queue = iter->task_ques_;
-    auto db = iter->dbIter_.db_;
-    while (true) {
-      queue.mutex_.Lock();
-      while (queue.Empty()) {
-        if (iter->closing_.load(std::memory_order_acquire)) {
-          break;
-        };
-        queue.con_.Wait();
+  // Drops all entries read ahead before dbIter_ is repositioned for
+  // iterating in the given direction.
+  void Reset(bool forward) {
+    Clear();
+    forward_ = forward;
+    readahead_ = initial_readahead_;
+    consumed_ = 0;
+    unread_limit_ = readahead_limit_;
+  }
+
+  void Step(bool forward) {
+    assert(Valid());
+    if (forward == forward_) {
+      PopFront();
+      if (++consumed_ >= readahead_) {
+        readahead_ *= 2;
+        consumed_ = 0;
       }
-
-      if (iter->closing_.load(std::memory_order_acquire)) {
-        break;
+      // Top up once half of the window is consumed, so that fetches are
+      // scheduled in batches rather than one per step.
+      if (window_.size() > 1 && ((window_.size() - 1) * 2 > readahead_ ||
+                                 window_bytes_ * 2 > max_readahead_bytes_)) {
+        return;
       }
+    } else {
+      // dbIter_ is positioned past the entries read ahead; reposition it
+      // at the current entry and step from there.
+      std::string current = window_.front()->key_;
+      Clear();
+      forward_ = forward;
+      unread_limit_ = readahead_limit_;
+      dbIter_.Seek(current);
+      assert(dbIter_.Valid());
+      if (forward) {
+        dbIter_.Next();
+      } else {
+        dbIter_.Prev();
+      }
+    }
+    Fill();
+  }
+
+  // Reads ahead until readahead_ entries follow the current one, the byte
+  // budget is spent or the hinted number of entries has been read.  dbIter_
+  // is positioned at the entry that follows the last one in window_, if any.
+  void Fill() {
+    FetchBatch* batch = nullptr;
+    while (dbIter_.Valid() &&
+           (window_.size() < 2 ||
+            (window_.size() <= readahead_ &&
+             window_bytes_ < max_readahead_bytes_ && unread_limit_ > 0))) {
+      if (unread_limit_ != SIZE_MAX && unread_limit_ > 0) {
+        unread_limit_--;
+      }
+      window_.push_back(new IterCache);
+      IterCache& item = *window_.back();
+      item.key_ = dbIter_.key().ToString();
+      data_size_.fetch_add(item.key_.size(), std::memory_order_relaxed);
+      if (dbIter_.IsInlineValue()) {
+        // Small values live in the LSM-tree, there is nothing to fetch.
+        item.val_ = dbIter_.value().ToString();
+        data_size_.fetch_add(item.val_.size(), std::memory_order_relaxed);
+        item.bytes = item.key_.size() + item.val_.size();
+        item.ready.store(true, std::memory_order_relaxed);
+      } else {
+        item.addr_ = dbIter_.value().ToString();
+        // address is <vlog_number, vlog_offset, size>
+        Slice addr(item.addr_);
+        uint64_t vlog_number, offset, size;
+        item.bytes = item.key_.size();
+        if (GetVarint64(&addr, &vlog_number) && GetVarint64(&addr, &offset) &&
+            GetVarint64(&addr, &size)) {
+          item.bytes += size;
+        }
+        if (batch == nullptr) {
+          batch = new FetchBatch(this);
+        }
+        item.pending.store(true, std::memory_order_relaxed);
+        batch->items.push_back(&item);
+        batch->bytes += item.bytes;
+        if (batch->items.size() >= kMaxBatchEntries ||
+            batch->bytes >= kMaxBatchBytes) {
+          Schedule(batch);
+          batch = nullptr;
+        }
+      }
+      window_bytes_ += item.bytes;
 
-      auto cur = queue.Pop();
-      auto& item = iter->buffer_queue_[cur.first];
-      uint64_t seq = cur.second;
-      queue.mutex_.Unlock();
-
-      db->Fetch(item.addr_, &item.val_);
-      item.sequence.store(seq, std::memory_order_release);
-      iter->data_size_.fetch_add(item.val_.size(), std::memory_order_release);
-      iter->completed_tasks_.fetch_add(1, std::memory_order_relaxed);
+      if (forward_) {
+        dbIter_.Next();
+      } else {
+        dbIter_.Prev();
+      }
+    }
+    if (batch != nullptr) {
+      Schedule(batch);
     }
-    queue.mutex_.Unlock();
   }
 
-  bool GetValue(size_t i, uint64_t seq) {
-    buffer_queue_[i].sequence = 0;
-    if (!dbIter_.valid_) {
-      buffer_queue_[i].valid_ = false;
-      return false;
+  void PopFront() {
+    IterCache* item = window_.front();
+    window_.pop_front();
+    window_bytes_ -= item->bytes;
+    if (item->pending.load(std::memory_order_acquire)) {
+      MutexLock l(&mu_);
+      if (item->pending.load(std::memory_order_relaxed)) {
+        // The caller moved on without the value; FetchValues frees it.
+        item->dropped = true;
+        return;
+      }
     }
-    buffer_queue_[i].valid_ = true;
-    buffer_queue_[i].key_ = dbIter_.key().ToString();
-    data_size_.fetch_add(buffer_queue_[i].key_.size(),
-                         std::memory_order_relaxed);
-    if (dbIter_.direction_ == DBAddrIter::kForward) {
-      buffer_queue_[i].addr_ = dbIter_.iter_->value().ToString();
-    } else {
-      buffer_queue_[i].addr_ = dbIter_.saved_value_;
+    delete item;
+  }
+
+  void Clear() {
+    while (!window_.empty()) {
+      PopFront();
     }
-    tot_tasks_++;
-    task_ques_.mutex_.Lock();
-    if (task_ques_.Empty()) {
-      task_ques_.con_.Signal();
+    assert(window_bytes_ == 0);
+  }
+
+  void WaitForPendingFetches() const {
+    MutexLock l(&mu_);
+    while (pending_tasks_ > 0) {
+      waiting_ = true;
+      done_cv_.Wait();
     }
-    task_ques_.TryExpand();
-    task_ques_.Push(i, seq);
-    task_ques_.mutex_.Unlock();
-    return true;
+    waiting_ = false;
   }
 
-  std::vector<std::thread> threads_;
-  TaskQueue task_ques_;
-  std::atomic<bool> closing_;
+  // Entries read ahead together are fetched by one task, which reads the
+  // values that lie close to each other in a vlog with a single read.
+  struct FetchBatch {
+    explicit FetchBatch(ConcurrenceDBIter* it) : iter(it), bytes(0) {}
 
-  uint64_t tot_tasks_;
+    ConcurrenceDBIter* const iter;
+    std::vector<IterCache*> items;
+    uint64_t bytes;
+  };
 
-  alignas(64) std::atomic<uint64_t> completed_tasks_;
-  alignas(64) std::atomic<uint64_t> data_size_;
+  void Schedule(FetchBatch* batch) {
+    {
+      MutexLock l(&mu_);
+      pending_tasks_++;
+    }
+    executor_->Schedule(&ConcurrenceDBIter::FetchValues, batch);
+  }
+
+  static void FetchValues(void* arg) {
+    FetchBatch* batch = reinterpret_cast<FetchBatch*>(arg);
+    ConcurrenceDBIter* iter = batch->iter;
+    const size_t n = batch->items.size();
+    std::vector<Slice> addrs(n);
+    std::vector<std::string*> values(n);
+    std::vector<Status> statuses(n);
+    for (size_t i = 0; i < n; i++) {
+      addrs[i] = batch->items[i]->addr_;
+      values[i] = &batch->items[i]->val_;
+    }
+    iter->dbIter_.db_->Fetch(n, addrs.data(), values.data(), statuses.data());
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+      batch->items[i]->status = statuses[i];
+      bytes += batch->items[i]->val_.size();
+    }
+    iter->data_size_.fetch_add(bytes, std::memory_order_relaxed);
+
+    MutexLock l(&iter->mu_);
+    for (IterCache* item : batch->items) {
+      item->pending.store(false, std::memory_order_release);
+      item->ready.store(true, std::memory_order_release);
+      if (item->dropped) {
+        delete item;
+      }
+    }
+    delete batch;
+    iter->pending_tasks_--;
+    if (iter->waiting_) {
+      iter->done_cv_.Signal();
+    }
+  }
+
+  DBAddrIter dbIter_;
+  PrefetchExecutor* const executor_;
+  const size_t initial_readahead_;
+  const uint64_t max_readahead_bytes_;
+  const size_t readahead_limit_;  // SIZE_MAX when the caller gave no hint
+
+  // window_.front() is the current entry, followed by the entries read
+  // ahead in the direction of iteration.
+  std::deque<IterCache*> window_;
+  bool forward_;
+  size_t readahead_;  // Entries to read ahead of the current one
+  size_t consumed_;   // Entries consumed since readahead_ last grew
+  size_t unread_limit_;  // Entries left to read ahead before the hint
+  uint64_t window_bytes_;
+
+  // Signalled whenever a fetch completes.
+  mutable port::Mutex mu_;
+  mutable port::CondVar done_cv_ GUARDED_BY(mu_);
+  uint64_t pending_tasks_ GUARDED_BY(mu_);
+  mutable bool waiting_ GUARDED_BY(mu_);  // The caller waits on done_cv_
+
+  std::atomic<uint64_t> data_size_;
 };
 
 inline bool DBAddrIter::ParseKey(ParsedInternalKey* ikey) {
@@ -397,6 +531,7 @@ void DBAddrIter::Next() {
   }
 
   FindNextUserEntry(true, &saved_key_);
+  SkipInlineValues();
 }
 
 void DBAddrIter::FindNextUserEntry(bool skipping, std::string* skip) {
@@ -414,6 +549,7 @@ void DBAddrIter::FindNextUserEntry(bool skipping, std::string* skip) {
           skipping = true;
           break;
         case kTypeValue:
+        case kTypeInlineValue:
           if (skipping &&
               user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
             // Entry hidden
@@ -456,6 +592,7 @@ void DBAddrIter::Prev() {
   }
 
   FindPrevUserEntry();
+  SkipInlineValues();
 }
 
 void DBAddrIter::FindPrevUserEntry() {
@@ -497,6 +634,28 @@ void DBAddrIter::FindPrevUserEntry() {
     direction_ = kForward;
   } else {
     valid_ = true;
+    saved_type_ = value_type;
+  }
+}
+
+void DBAddrIter::SkipInlineValues() {
+  if (!addresses_only_) {
+    return;
+  }
+  while (valid_ && IsInlineValue()) {
+    if (direction_ == kForward) {
+      SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+      iter_->Next();
+      if (!iter_->Valid()) {
+        valid_ = false;
+        saved_key_.clear();
+        return;
+      }
+      FindNextUserEntry(true, &saved_key_);
+    } else {
+      // iter_ is already positioned before all entries of the current key.
+      FindPrevUserEntry();
+    }
   }
 }
 
@@ -509,6 +668,7 @@ void DBAddrIter::Seek(const Slice& target) {
   iter_->Seek(saved_key_);
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
+    SkipInlineValues();
   } else {
     valid_ = false;
   }
@@ -520,6 +680,7 @@ void DBAddrIter::SeekToFirst() {
   iter_->SeekToFirst();
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
+    SkipInlineValues();
   } else {
     valid_ = false;
   }
@@ -530,19 +691,22 @@ void DBAddrIter::SeekToLast() {
   ClearSavedValue();
   iter_->SeekToLast();
   FindPrevUserEntry();
+  SkipInlineValues();
 }
 
 Iterator* NewDBIterator(DBImpl* db, const Comparator* user_key_comparator,
                         Iterator* internal_iter, SequenceNumber sequence,
-                        uint32_t seed) {
+                        uint32_t seed, size_t readahead_hint,
+                        uint64_t max_readahead_bytes) {
   return new ConcurrenceDBIter(db, user_key_comparator, internal_iter, sequence,
-                               seed);
+                               seed, readahead_hint, max_readahead_bytes);
 }
 
 Iterator* NewDBAddrIterator(DBImpl* db, const Comparator* user_key_comparator,
                             Iterator* internal_iter, SequenceNumber sequence,
                             uint32_t seed) {
-  return new DBAddrIter(db, user_key_comparator, internal_iter, sequence, seed);
+  return new DBAddrIter(db, user_key_comparator, internal_iter, sequence, seed,
+                        true);
 }
 
 }  // namespace leveldb
@@ -17,10 +17,13 @@ class DBImpl;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
-// into appropriate user keys.
+// into appropriate user keys.  Values are read from the vlogs ahead of the
+// caller, starting with "readahead_hint" entries (a small default if 0) and
+// never more than "max_readahead_bytes" at a time.
 Iterator* NewDBIterator(DBImpl* db, const Comparator* user_key_comparator,
                         Iterator* internal_iter, SequenceNumber sequence,
-                        uint32_t seed);
+                        uint32_t seed, size_t readahead_hint,
+                        uint64_t max_readahead_bytes);
 
 Iterator* NewDBAddrIterator(DBImpl* db, const Comparator* user_key_comparator,
                             Iterator* internal_iter, SequenceNumber sequence,
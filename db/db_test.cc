@@ -6,10 +6,13 @@
 
 #include "db/db_impl.h"
 #include "db/filename.h"
+#include "db/memtable.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
 #include <atomic>
 #include <cinttypes>
+#include <map>
+#include <sstream>
 #include <string>
 
 #include "leveldb/cache.h"
@@ -342,6 +345,20 @@ class DBTest : public testing::Test {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kInlineValues:
+        options.min_blob_size = 100;
+        break;
+      case kPipelinedWrite:
+        options.enable_pipelined_write = true;
+        break;
+      case kDataBlockHashIndex:
+        options.use_data_block_hash_index = true;
+        break;
+      case kPartitionedIndex:
+        options.partition_index_and_filters = true;
+        options.metadata_block_size = 256;
+        options.filter_policy = filter_policy_;
+        break;
       default:
         break;
     }
@@ -455,6 +472,9 @@ class DBTest : public testing::Test {
               dbfull()->Fetch(iter->value(), &val);
               result += val;
             } break;
+            case kTypeInlineValue:
+              result += iter->value().ToString();
+              break;
             case kTypeDeletion:
               result += "DEL";
               break;
@@ -600,7 +620,17 @@ class DBTest : public testing::Test {
 
  private:
   // Sequence of option configurations to try
-  enum OptionConfig { kDefault, kReuse, kFilter, kUncompressed, kEnd };
+  enum OptionConfig {
+    kDefault,
+    kReuse,
+    kFilter,
+    kUncompressed,
+    kInlineValues,
+    kPipelinedWrite,
+    kDataBlockHashIndex,
+    kPartitionedIndex,
+    kEnd
+  };
 
   const FilterPolicy* filter_policy_;
   int option_config_;
@@ -683,6 +713,62 @@ TEST_F(DBTest, GetFromVersions) {
   } while (ChangeOptions());
 }
 
+TEST_F(DBTest, IterPinsSuperVersion) {
+  do {
+    ASSERT_LEVELDB_OK(Put("a", "va"));
+    Iterator* iter = db_->NewIterator(ReadOptions());
+
+    // Switch the memtable and compact it away while the iterator is alive.
+    ASSERT_LEVELDB_OK(Put("b", "vb"));
+    dbfull()->TEST_CompactMemTable();
+    Compact("a", "z");
+    ASSERT_EQ("va", Get("a"));
+    ASSERT_EQ("vb", Get("b"));
+
+    iter->SeekToFirst();
+    ASSERT_EQ(IterStatus(iter), "a->va");
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+    delete iter;
+  } while (ChangeOptions());
+}
+
+TEST_F(DBTest, MultiGet) {
+  do {
+    ASSERT_LEVELDB_OK(Put("a", "va"));
+    ASSERT_LEVELDB_OK(Put("b", std::string(1000, 'b')));
+    ASSERT_LEVELDB_OK(Put("c", "vc"));
+    dbfull()->TEST_CompactMemTable();
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_LEVELDB_OK(Put("c", "vc2"));
+    ASSERT_LEVELDB_OK(Delete("a"));
+    ASSERT_LEVELDB_OK(Put("d", "vd"));
+
+    const Slice keys[] = {"d", "a", "b", "missing", "c", "b"};
+    const int n = sizeof(keys) / sizeof(keys[0]);
+    std::string values[n];
+    Status statuses[n];
+    db_->MultiGet(ReadOptions(), n, keys, values, statuses);
+    ASSERT_EQ("vd", values[0]);
+    ASSERT_TRUE(statuses[1].IsNotFound());
+    ASSERT_EQ(std::string(1000, 'b'), values[2]);
+    ASSERT_TRUE(statuses[3].IsNotFound());
+    ASSERT_EQ("vc2", values[4]);
+    ASSERT_EQ(std::string(1000, 'b'), values[5]);
+    for (int i : {0, 2, 4, 5}) {
+      ASSERT_LEVELDB_OK(statuses[i]);
+    }
+
+    ReadOptions options;
+    options.snapshot = snapshot;
+    db_->MultiGet(options, n, keys, values, statuses);
+    ASSERT_TRUE(statuses[0].IsNotFound());
+    ASSERT_EQ("va", values[1]);
+    ASSERT_EQ("vc", values[4]);
+    db_->ReleaseSnapshot(snapshot);
+  } while (ChangeOptions());
+}
+
 TEST_F(DBTest, GetMemUsage) {
   do {
     ASSERT_LEVELDB_OK(Put("foo", "v1"));
@@ -1052,6 +1138,46 @@ TEST_F(DBTest, IterMultiWithDeleteAndCompaction) {
   } while (ChangeOptions());
 }
 
+TEST_F(DBTest, IterReadahead) {
+  do {
+    char buf[100];
+    for (int i = 0; i < 200; i++) {
+      std::snprintf(buf, sizeof(buf), "key%06d", i);
+      ASSERT_LEVELDB_OK(Put(buf, std::string(i % 50, 'v')));
+    }
+
+    for (size_t hint : {0, 1, 10, 1000}) {
+      ReadOptions options;
+      options.readahead_hint = hint;
+      Iterator* iter = db_->NewIterator(options);
+      // Walk far enough forward for the readahead window to grow, then
+      // turn around and step over the entries that were read ahead.
+      iter->SeekToFirst();
+      for (int i = 0; i < 150; i++) {
+        ASSERT_TRUE(iter->Valid());
+        std::snprintf(buf, sizeof(buf), "key%06d", i);
+        ASSERT_EQ(iter->key().ToString(), buf);
+        ASSERT_EQ(iter->value().ToString(), std::string(i % 50, 'v'));
+        iter->Next();
+      }
+      for (int i = 150; i > 20; i--) {
+        ASSERT_TRUE(iter->Valid());
+        std::snprintf(buf, sizeof(buf), "key%06d", i);
+        ASSERT_EQ(iter->key().ToString(), buf);
+        // Skip some values without reading them.
+        if (i % 3 == 0) {
+          ASSERT_EQ(iter->value().ToString(), std::string(i % 50, 'v'));
+        }
+        iter->Prev();
+      }
+      iter->SeekToLast();
+      ASSERT_EQ(IterStatus(iter), "key000199->" + std::string(199 % 50, 'v'));
+      ASSERT_LEVELDB_OK(iter->status());
+      delete iter;
+    }
+  } while (ChangeOptions());
+}
+
 TEST_F(DBTest, Recover) {
   do {
     ASSERT_LEVELDB_OK(Put("foo", "v1"));
@@ -1111,12 +1237,97 @@ TEST_F(DBTest, RecoverDuringMemtableCompaction) {
   } while (ChangeOptions());
 }
 
+// Check that recovery starts at the vlog head checkpointed by the last
+// memtable flush instead of replaying the records already in the tables.
+TEST_F(DBTest, RecoverFromVlogHead) {
+  Options options = CurrentOptions();
+  options.min_blob_size = 10;
+  Reopen(&options);
+  ASSERT_LEVELDB_OK(Put("foo", "v1"));
+  ASSERT_LEVELDB_OK(Put("bar", std::string(100, 'b')));
+  dbfull()->TEST_CompactMemTable();
+  const int tables = TotalTableFiles();
+
+  // Nothing is left to replay.
+  Reopen(&options);
+  ASSERT_EQ(tables, TotalTableFiles());
+  ASSERT_EQ("v1", Get("foo"));
+  ASSERT_EQ(std::string(100, 'b'), Get("bar"));
+
+  // Only the unflushed tail is replayed.
+  ASSERT_LEVELDB_OK(Put("baz", std::string(100, 'z')));
+  ASSERT_LEVELDB_OK(Put("foo", "v2"));
+  Reopen(&options);
+  ASSERT_EQ(tables + 1, TotalTableFiles());
+  Reopen(&options);
+  ASSERT_EQ(tables + 1, TotalTableFiles());
+  ASSERT_EQ("v2", Get("foo"));
+  ASSERT_EQ(std::string(100, 'b'), Get("bar"));
+  ASSERT_EQ(std::string(100, 'z'), Get("baz"));
+}
+
 static std::string Key(int i) {
   char buf[100];
   std::snprintf(buf, sizeof(buf), "key%06d", i);
   return std::string(buf);
 }
 
+TEST_F(DBTest, RepairKeepsVlogs) {
+  Options options = CurrentOptions();
+  options.min_blob_size = 50;
+  Reopen(&options);
+
+  // Some values end up addressed by tables, the rest only in the vlogs.
+  const int N = 500;
+  for (int i = 0; i < N; i++) {
+    ASSERT_LEVELDB_OK(Put(Key(i), Key(i) + std::string(i % 100, 'v')));
+    if (i == N / 2) {
+      dbfull()->TEST_CompactMemTable();
+    }
+  }
+  for (int i = 0; i < N; i += 7) {
+    ASSERT_LEVELDB_OK(Delete(Key(i)));
+  }
+  ASSERT_LEVELDB_OK(Put(Key(1), "overwritten"));
+  ASSERT_GT(TotalTableFiles(), 0);
+  Close();
+
+  // Lose the descriptor.
+  std::vector<std::string> filenames;
+  ASSERT_LEVELDB_OK(env_->GetChildren(dbname_, &filenames));
+  uint64_t number;
+  FileType type;
+  int vlogs = 0;
+  for (const std::string& filename : filenames) {
+    if (ParseFileName(filename, &number, &type)) {
+      if (type == kDescriptorFile || type == kCurrentFile) {
+        ASSERT_LEVELDB_OK(env_->RemoveFile(dbname_ + "/" + filename));
+      } else if (type == kLogFile) {
+        vlogs++;
+      }
+    }
+  }
+  ASSERT_GT(vlogs, 0);
+
+  ASSERT_LEVELDB_OK(RepairDB(dbname_, options));
+  Reopen(&options);
+  for (int i = 0; i < N; i++) {
+    if (i == 1) {
+      ASSERT_EQ("overwritten", Get(Key(i)));
+    } else if (i % 7 == 0) {
+      ASSERT_EQ("NOT_FOUND", Get(Key(i)));
+    } else {
+      ASSERT_EQ(Key(i) + std::string(i % 100, 'v'), Get(Key(i)));
+    }
+  }
+
+  // The repaired database keeps working.
+  ASSERT_LEVELDB_OK(Put(Key(0), "v0"));
+  Reopen(&options);
+  ASSERT_EQ("v0", Get(Key(0)));
+  ASSERT_EQ(Key(2) + std::string(2, 'v'), Get(Key(2)));
+}
+
 TEST_F(DBTest, MinorCompactionsHappen) {
   Options options = CurrentOptions();
   options.write_buffer_size = 10000;
@@ -1171,6 +1382,27 @@ TEST_F(DBTest, RecoverWithLargeLog) {
   ASSERT_GT(NumTableFilesAtLevel(0), 1);
 }
 
+// Recovery replays several vlogs into many level-0 tables built
+// concurrently; the newest value of every key must still win.
+TEST_F(DBTest, RecoverManyVlogs) {
+  Options options = CurrentOptions();
+  options.max_vlog_size = 20000;
+  options.write_buffer_size = 10 << 20;
+  Reopen(&options);
+  const int kKeys = 50;
+  for (int i = 0; i < 2000; i++) {
+    ASSERT_LEVELDB_OK(Put(Key(i % kKeys), Key(i) + std::string(100, 'v')));
+  }
+  ASSERT_EQ(0, TotalTableFiles());
+
+  options.write_buffer_size = 10000;
+  Reopen(&options);
+  ASSERT_GT(NumTableFilesAtLevel(0), 2);
+  for (int i = 2000 - kKeys; i < 2000; i++) {
+    ASSERT_EQ(Key(i) + std::string(100, 'v'), Get(Key(i % kKeys)));
+  }
+}
+
 TEST_F(DBTest, CompactionsGenerateMultipleFiles) {
   Options options = CurrentOptions();
   options.write_buffer_size = 100000000;  // Large write buffer
@@ -1967,6 +2199,383 @@ TEST_F(DBTest, FilesDeletedAfterCompaction) {
   ASSERT_EQ(CountFiles(), num_files);
 }
 
+TEST_F(DBTest, VlogGarbageCollection) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.write_buffer_size = 64 << 10;
+  options.max_vlog_size = 32 << 10;
+  options.clean_threshold = 8 << 10;
+  options.min_clean_threshold = 0;
+  options.clean_rate_limit = 0;
+  Reopen(&options);
+
+  auto count_vlogs = [&]() {
+    std::vector<std::string> files;
+    env_->GetChildren(dbname_, &files);
+    int count = 0;
+    uint64_t number;
+    FileType type;
+    for (const std::string& f : files) {
+      if (ParseFileName(f, &number, &type) && type == kLogFile) count++;
+    }
+    return count;
+  };
+
+  // Overwrite a small set of keys until many vlogs are full of garbage.
+  Random rnd(301);
+  const int kNumKeys = 100;
+  std::vector<std::string> values(kNumKeys);
+  for (int round = 0; round < 100; round++) {
+    for (int i = 0; i < kNumKeys; i++) {
+      values[i] = RandomString(&rnd, 100);
+      ASSERT_LEVELDB_OK(Put(Key(i), values[i]));
+    }
+  }
+  const int written_vlogs = count_vlogs();
+  ASSERT_GT(written_vlogs, 10);
+
+  // Garbage is accounted when compaction drops the shadowed addresses.  A
+  // snapshot holds off collection until the accounting is checked.
+  const Snapshot* snapshot = db_->GetSnapshot();
+  db_->CompactRange(nullptr, nullptr);
+  std::string garbage;
+  ASSERT_TRUE(db_->GetProperty("leveldb.vlog-garbage", &garbage));
+  int vlogs_with_garbage = 0;
+  std::istringstream lines(garbage);
+  std::string line;
+  while (std::getline(lines, line)) {
+    unsigned long long number, dropped;
+    double size_mb, garbage_mb, ratio;
+    if (std::sscanf(line.c_str(), "%llu %lf %lf %llu %lf", &number, &size_mb,
+                    &garbage_mb, &dropped, &ratio) == 5 &&
+        dropped > 0 && ratio > 0) {
+      vlogs_with_garbage++;
+    }
+  }
+  ASSERT_GT(vlogs_with_garbage, written_vlogs / 2) << garbage;
+
+  // Collection then runs in the background.
+  db_->ReleaseSnapshot(snapshot);
+  db_->CompactRange(nullptr, nullptr);
+  for (int i = 0; i < 1000 && count_vlogs() >= written_vlogs / 2; i++) {
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_LT(count_vlogs(), written_vlogs / 2);
+  for (int i = 0; i < kNumKeys; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+
+  Reopen(&options);
+  for (int i = 0; i < kNumKeys; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+}
+
+TEST_F(DBTest, VlogPartitions) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.write_buffer_size = 64 << 10;
+  options.max_vlog_size = 32 << 10;
+  options.clean_threshold = 8 << 10;
+  options.min_clean_threshold = 0;
+  options.clean_rate_limit = 0;
+  options.vlog_partitions.resize(1);
+  options.vlog_partitions[0].prefix = "hot";
+  options.vlog_partitions[0].max_vlog_size = 16 << 10;
+  Reopen(&options);
+
+  auto count_vlogs = [&](int partition) {
+    std::vector<std::string> files;
+    env_->GetChildren(dbname_, &files);
+    int count = 0;
+    uint64_t number;
+    FileType type;
+    int p;
+    for (const std::string& f : files) {
+      if (ParseFileName(f, &number, &type, &p) && type == kLogFile &&
+          p == partition) {
+        count++;
+      }
+    }
+    return count;
+  };
+
+  // Cold values are written once, hot ones over and over, and some batches
+  // span both partitions.
+  Random rnd(301);
+  const int kNumKeys = 100;
+  std::vector<std::string> cold(kNumKeys), hot(kNumKeys);
+  for (int i = 0; i < kNumKeys; i++) {
+    cold[i] = RandomString(&rnd, 1000);
+    ASSERT_LEVELDB_OK(Put(Key(i), cold[i]));
+  }
+  for (int round = 0; round < 100; round++) {
+    for (int i = 0; i < kNumKeys; i++) {
+      hot[i] = RandomString(&rnd, 100);
+      if (i % 10 == 0) {
+        cold[i] = RandomString(&rnd, 1000);
+        WriteBatch batch;
+        batch.Put("hot" + Key(i), hot[i]);
+        batch.Put(Key(i), cold[i]);
+        ASSERT_LEVELDB_OK(dbfull()->Write(WriteOptions(), &batch));
+      } else {
+        ASSERT_LEVELDB_OK(Put("hot" + Key(i), hot[i]));
+      }
+    }
+    if (round == 50) {
+      Reopen(&options);
+    }
+  }
+  const int cold_vlogs = count_vlogs(0);
+  const int hot_vlogs = count_vlogs(1);
+  ASSERT_GT(hot_vlogs, 10);
+
+  // Collection reclaims the hot vlogs, mostly without moving cold values.
+  db_->CompactRange(nullptr, nullptr);
+  for (int i = 0; i < 1000 && count_vlogs(1) >= hot_vlogs / 2; i++) {
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_LT(count_vlogs(1), hot_vlogs / 2);
+  ASSERT_LE(count_vlogs(0), cold_vlogs);
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < kNumKeys; i++) {
+      ASSERT_EQ(cold[i], Get(Key(i)));
+      ASSERT_EQ(hot[i], Get("hot" + Key(i)));
+    }
+    Reopen(&options);
+  }
+
+  // Partitions can not be dropped.
+  Options fewer = options;
+  fewer.vlog_partitions.clear();
+  ASSERT_TRUE(TryReopen(&fewer).IsInvalidArgument());
+}
+
+TEST_F(DBTest, PreallocatedVlogs) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.preallocate_vlog = true;
+  options.write_buffer_size = 64 << 10;
+  options.max_vlog_size = 32 << 10;
+  options.clean_threshold = 8 << 10;
+  options.min_clean_threshold = 0;
+  options.clean_rate_limit = 0;
+  DestroyAndReopen(&options);
+
+  // Every write may create a vlog, either a new file or a retired vlog
+  // renamed.  A new file is allocated at its full size right away.
+  std::map<uint64_t, std::string> vlogs;
+  int created = 0;
+  int recycled = 0;
+  auto check_vlogs = [&]() {
+    std::vector<std::string> files;
+    ASSERT_LEVELDB_OK(env_->GetChildren(dbname_, &files));
+    std::map<uint64_t, std::string> current;
+    uint64_t number;
+    FileType type;
+    for (const std::string& f : files) {
+      if (ParseFileName(f, &number, &type) && type == kLogFile) {
+        current[number] = f;
+      }
+    }
+    bool retired_gone = false;
+    for (const auto& vlog : vlogs) {
+      if (current.find(vlog.first) == current.end()) retired_gone = true;
+    }
+    for (const auto& vlog : current) {
+      if (vlogs.find(vlog.first) != vlogs.end()) {
+        continue;
+      }
+      if (current.size() > vlogs.size()) {
+        uint64_t size;
+        ASSERT_LEVELDB_OK(
+            env_->GetFileSize(dbname_ + "/" + vlog.second, &size));
+        ASSERT_EQ(options.max_vlog_size, size) << vlog.second;
+        created++;
+      } else if (retired_gone && current.size() == vlogs.size()) {
+        recycled++;
+      }
+    }
+    vlogs = current;
+  };
+  ASSERT_NO_FATAL_FAILURE(check_vlogs());
+
+  // The vlogs end in zeros, so recovery has to find where their records
+  // end, and appending after a reopen has to write over the zeros.
+  Random rnd(301);
+  const int kNumKeys = 100;
+  std::vector<std::string> values(kNumKeys);
+  for (int round = 0; round < 100; round++) {
+    for (int i = 0; i < kNumKeys; i++) {
+      values[i] = RandomString(&rnd, 100);
+      ASSERT_LEVELDB_OK(Put(Key(i), values[i]));
+      ASSERT_NO_FATAL_FAILURE(check_vlogs());
+    }
+    if (round % 25 == 0) {
+      Reopen(&options);
+      ASSERT_NO_FATAL_FAILURE(check_vlogs());
+    }
+  }
+  ASSERT_GT(created, 0);
+
+  // Garbage collection retires vlogs, whose files become new vlogs: the
+  // retired number goes away and no file is added.
+  db_->CompactRange(nullptr, nullptr);
+  for (int round = 0; round < 1000 && recycled == 0; round++) {
+    for (int i = 0; i < kNumKeys; i++) {
+      values[i] = RandomString(&rnd, 100);
+      ASSERT_LEVELDB_OK(Put(Key(i), values[i]));
+      ASSERT_NO_FATAL_FAILURE(check_vlogs());
+    }
+  }
+  ASSERT_GT(recycled, 0);
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < kNumKeys; i++) {
+      ASSERT_EQ(values[i], Get(Key(i)));
+    }
+    Reopen(&options);
+  }
+}
+
+TEST_F(DBTest, DirectIOVlogs) {
+  for (int preallocate = 0; preallocate < 2; preallocate++) {
+    Options options = CurrentOptions();
+    options.env = env_;
+    options.create_if_missing = true;
+    options.use_direct_io_for_vlog = true;
+    options.preallocate_vlog = (preallocate != 0);
+    options.write_buffer_size = 64 << 10;
+    options.max_vlog_size = 128 << 10;
+    options.vlog_write_buffer_size = 64 << 10;
+    options.clean_threshold = 32 << 10;
+    options.min_clean_threshold = 0;
+    options.clean_rate_limit = 0;
+    DestroyAndReopen(&options);
+
+    // Records end at any offset, so every write leaves a partial block
+    // behind, and some records bypass the write buffer.
+    Random rnd(301);
+    const int kNumKeys = 50;
+    std::vector<std::string> values(kNumKeys);
+    for (int round = 0; round < 40; round++) {
+      for (int i = 0; i < kNumKeys; i++) {
+        values[i] = RandomString(&rnd, rnd.OneIn(50) ? 70000 : rnd.Skewed(10));
+        ASSERT_LEVELDB_OK(Put(Key(i), values[i]));
+      }
+      ASSERT_EQ(values[round % kNumKeys], Get(Key(round % kNumKeys)));
+      if (round % 10 == 0) {
+        Reopen(&options);
+      }
+    }
+    db_->CompactRange(nullptr, nullptr);
+    for (int pass = 0; pass < 2; pass++) {
+      for (int i = 0; i < kNumKeys; i++) {
+        ASSERT_EQ(values[i], Get(Key(i)));
+      }
+      Reopen(&options);
+    }
+  }
+}
+
+TEST_F(DBTest, InlineValues) {
+  Options options = CurrentOptions();
+  options.min_blob_size = 16;
+  Reopen(&options);
+
+  const std::string big(100, 'x');
+  ASSERT_LEVELDB_OK(Put("a", "small"));
+  ASSERT_LEVELDB_OK(Put("b", big));
+  ASSERT_LEVELDB_OK(Put("c", "v1"));
+  ASSERT_LEVELDB_OK(Put("c", big));
+  ASSERT_LEVELDB_OK(Put("d", big));
+  ASSERT_LEVELDB_OK(Put("d", "v2"));
+  ASSERT_EQ("[ " + big + ", v1 ]", AllEntriesFor("c"));
+  ASSERT_EQ("[ v2, " + big + " ]", AllEntriesFor("d"));
+
+  for (int pass = 0; pass < 3; pass++) {
+    ASSERT_EQ("small", Get("a"));
+    ASSERT_EQ(big, Get("b"));
+    ASSERT_EQ(big, Get("c"));
+    ASSERT_EQ("v2", Get("d"));
+    ASSERT_EQ("(a->small)(b->" + big + ")(c->" + big + ")(d->v2)", Contents());
+
+    // Only "b" and "c" have their values in the vlog.
+    Iterator* iter = db_->NewAddrIterator(ReadOptions());
+    std::string keys;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      keys += iter->key().ToString();
+    }
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+      keys += iter->key().ToString();
+    }
+    ASSERT_EQ("bccb", keys);
+    delete iter;
+
+    if (pass == 0) {
+      dbfull()->TEST_CompactMemTable();
+    } else {
+      Reopen(&options);
+    }
+  }
+}
+
+TEST_F(DBTest, ValueCache) {
+  Cache* value_cache = NewLRUCache(1 << 20);
+  Options options = CurrentOptions();
+  options.value_cache = value_cache;
+  Reopen(&options);
+
+  ASSERT_LEVELDB_OK(Put("foo", "v1"));
+  ASSERT_EQ("v1", Get("foo"));
+  ASSERT_EQ("v1", Get("foo"));
+  ASSERT_LEVELDB_OK(Put("foo", "v2"));
+  ASSERT_EQ("v2", Get("foo"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("v2", Get("foo"));
+
+  std::string stats;
+  ASSERT_TRUE(db_->GetProperty("leveldb.value-cache", &stats));
+  ASSERT_EQ("hits: 2 misses: 2 usage: 4", stats);
+
+  Close();
+  delete value_cache;
+}
+
+TEST_F(DBTest, AddressCache) {
+  Cache* address_cache = NewLRUCache(1 << 20);
+  Options options = CurrentOptions();
+  options.address_cache = address_cache;
+  Reopen(&options);
+
+  ASSERT_LEVELDB_OK(Put("foo", "v1"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("v1", Get("foo"));
+  ASSERT_EQ("v1", Get("foo"));  // Hit
+
+  // The write drops the entry, and a read at an older snapshot must not
+  // bring the old value back.
+  const Snapshot* s1 = db_->GetSnapshot();
+  ASSERT_LEVELDB_OK(Put("foo", "v2"));
+  ASSERT_EQ("v2", Get("foo"));
+  ASSERT_EQ("v1", Get("foo", s1));
+  ASSERT_EQ("v2", Get("foo"));
+  db_->ReleaseSnapshot(s1);
+
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("v2", Get("foo"));
+  ASSERT_EQ("v2", Get("foo"));  // Hit
+  ASSERT_LEVELDB_OK(Delete("foo"));
+  ASSERT_EQ("NOT_FOUND", Get("foo"));
+
+  std::string stats;
+  ASSERT_TRUE(db_->GetProperty("leveldb.address-cache", &stats));
+  ASSERT_EQ("hits: 2 misses: 6", stats);
+
+  Close();
+  delete address_cache;
+}
+
 TEST_F(DBTest, BloomFilter) {
   env_->count_random_reads_ = true;
   Options options = CurrentOptions();
@@ -2014,6 +2623,50 @@ TEST_F(DBTest, BloomFilter) {
   delete options.filter_policy;
 }
 
+TEST_F(DBTest, PartitionedBloomFilter) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_size = 256;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  options.filter_policy = NewBloomFilterPolicy(10);
+  options.partition_index_and_filters = true;
+  Reopen(&options);
+
+  // Populate multiple layers
+  const int N = 10000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_LEVELDB_OK(Put(Key(i), Key(i)));
+  }
+  Compact("a", "z");
+  for (int i = 0; i < N; i += 100) {
+    ASSERT_LEVELDB_OK(Put(Key(i), Key(i)));
+  }
+  dbfull()->TEST_CompactMemTable();
+
+  // Prevent auto compactions triggered by seeks
+  env_->delay_data_sync_.store(true, std::memory_order_release);
+
+  // Lookup missing keys.  Should read an index partition and a filter
+  // partition of both sstables, and rarely a data block.
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+  }
+  int reads = env_->random_read_counter_.Read();
+  std::fprintf(stderr, "%d missing => %d reads\n", N, reads);
+  ASSERT_LE(reads, 4 * N + 3 * N / 100);
+
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i), Get(Key(i)));
+  }
+
+  env_->delay_data_sync_.store(false, std::memory_order_release);
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+}
+
 // Multi-threaded test:
 namespace {
 
@@ -2111,6 +2764,248 @@ TEST_F(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+namespace {
+
+struct ConcurrentWriter {
+  ConcurrentWriter()
+      : db(nullptr), id(0), sync(false), value_size(0), num_writes(200) {}
+
+  DB* db;
+  int id;
+  bool sync;
+  size_t value_size;  // If zero, sizes come from ConcurrentValueSize()
+  int num_writes;
+  std::atomic<bool> done;
+};
+
+// Every writer overwrites its own keys with small values and, now and
+// then, with values large enough to be filled by a follower or larger
+// than the vlog write buffer.  Each write must be visible as soon as it
+// returns.
+static size_t ConcurrentValueSize(int i) {
+  if (i % 50 == 49) return 2 << 20;
+  if (i % 10 == 5) return 40 << 10;
+  return 100 + i;
+}
+
+static size_t ConcurrentValueSize(const ConcurrentWriter& writer, int i) {
+  return (writer.value_size != 0) ? writer.value_size : ConcurrentValueSize(i);
+}
+
+static void ConcurrentWriterBody(void* arg) {
+  ConcurrentWriter* writer = reinterpret_cast<ConcurrentWriter*>(arg);
+  WriteOptions write_options;
+  write_options.sync = writer->sync;
+  std::string result;
+  for (int i = 0; i < writer->num_writes; i++) {
+    char key[100];
+    std::snprintf(key, sizeof(key), "%d.%d", writer->id, i % 20);
+    const size_t size = ConcurrentValueSize(*writer, i);
+    std::string value(size, static_cast<char>('a' + i % 26));
+    ASSERT_LEVELDB_OK(writer->db->Put(write_options, key, value));
+    ASSERT_LEVELDB_OK(writer->db->Get(ReadOptions(), key, &result));
+    ASSERT_TRUE(result == value);
+  }
+  writer->done.store(true, std::memory_order_release);
+}
+
+}  // namespace
+
+TEST_F(DBTest, ConcurrentVlogAppends) {
+  static const int kWriters = 4;
+  ConcurrentWriter writers[kWriters];
+  for (int id = 0; id < kWriters; id++) {
+    writers[id].db = db_;
+    writers[id].id = id;
+    writers[id].sync = false;
+    writers[id].done.store(false, std::memory_order_release);
+    env_->StartThread(ConcurrentWriterBody, &writers[id]);
+  }
+  for (int id = 0; id < kWriters; id++) {
+    while (!writers[id].done.load(std::memory_order_acquire)) {
+      DelayMilliseconds(10);
+    }
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int id = 0; id < kWriters; id++) {
+      for (int i = 180; i < 200; i++) {
+        char key[100];
+        std::snprintf(key, sizeof(key), "%d.%d", id, i % 20);
+        const size_t size = ConcurrentValueSize(i);
+        ASSERT_EQ(std::string(size, static_cast<char>('a' + i % 26)),
+                  Get(key));
+      }
+    }
+    Reopen();
+  }
+}
+
+TEST_F(DBTest, ConcurrentVlogRecordsFillBuffer) {
+  // The records of a write group together exceed the vlog write buffer,
+  // while each of them fits in it.
+  static const int kWriters = 4;
+  static const int kNumWrites = 20;
+  ConcurrentWriter writers[kWriters];
+  for (int id = 0; id < kWriters; id++) {
+    writers[id].db = db_;
+    writers[id].id = id;
+    writers[id].sync = (id == 0);
+    writers[id].value_size = 524260;
+    writers[id].num_writes = kNumWrites;
+    writers[id].done.store(false, std::memory_order_release);
+    env_->StartThread(ConcurrentWriterBody, &writers[id]);
+  }
+  for (int id = 0; id < kWriters; id++) {
+    while (!writers[id].done.load(std::memory_order_acquire)) {
+      DelayMilliseconds(10);
+    }
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int id = 0; id < kWriters; id++) {
+      for (int i = 0; i < kNumWrites; i++) {
+        char key[100];
+        std::snprintf(key, sizeof(key), "%d.%d", id, i);
+        ASSERT_EQ(std::string(writers[id].value_size,
+                              static_cast<char>('a' + i % 26)),
+                  Get(key));
+      }
+    }
+    Reopen();
+  }
+}
+
+TEST_F(DBTest, ConcurrentSyncWrites) {
+  // Sync writers share syncs, and non-sync writers are mixed in.
+  static const int kWriters = 4;
+  ConcurrentWriter writers[kWriters];
+  for (int id = 0; id < kWriters; id++) {
+    writers[id].db = db_;
+    writers[id].id = id;
+    writers[id].sync = (id % 2 == 0);
+    writers[id].done.store(false, std::memory_order_release);
+    env_->StartThread(ConcurrentWriterBody, &writers[id]);
+  }
+  for (int id = 0; id < kWriters; id++) {
+    while (!writers[id].done.load(std::memory_order_acquire)) {
+      DelayMilliseconds(10);
+    }
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int id = 0; id < kWriters; id++) {
+      for (int i = 180; i < 200; i++) {
+        char key[100];
+        std::snprintf(key, sizeof(key), "%d.%d", id, i % 20);
+        const size_t size = ConcurrentValueSize(i);
+        ASSERT_EQ(std::string(size, static_cast<char>('a' + i % 26)),
+                  Get(key));
+      }
+    }
+    Reopen();
+  }
+}
+
+TEST_F(DBTest, PipelinedWrites) {
+  Options options = CurrentOptions();
+  options.enable_pipelined_write = true;
+  options.write_buffer_size = 256 << 10;
+  options.max_vlog_size = 1 << 20;
+  Reopen(&options);
+
+  // Groups are applied while the next ones are appended, across memtable
+  // and vlog switches, with and without syncs.
+  static const int kWriters = 4;
+  ConcurrentWriter writers[kWriters];
+  for (int id = 0; id < kWriters; id++) {
+    writers[id].db = db_;
+    writers[id].id = id;
+    writers[id].sync = (id == 0);
+    writers[id].done.store(false, std::memory_order_release);
+    env_->StartThread(ConcurrentWriterBody, &writers[id]);
+  }
+  for (int id = 0; id < kWriters; id++) {
+    while (!writers[id].done.load(std::memory_order_acquire)) {
+      DelayMilliseconds(10);
+    }
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int id = 0; id < kWriters; id++) {
+      for (int i = 180; i < 200; i++) {
+        char key[100];
+        std::snprintf(key, sizeof(key), "%d.%d", id, i % 20);
+        const size_t size = ConcurrentValueSize(i);
+        ASSERT_EQ(std::string(size, static_cast<char>('a' + i % 26)),
+                  Get(key));
+      }
+    }
+    Reopen(&options);
+  }
+}
+
+TEST_F(DBTest, SmallVlogWriteBuffer) {
+  Options options = CurrentOptions();
+  options.vlog_write_buffer_size = 64 << 10;
+  Reopen(&options);
+
+  // Records that wrap around the end of the buffer, and records too large
+  // for it.  Values are read back while they may still be buffered.
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 60; i++) {
+    const int size = (i % 7 == 6) ? 100000 : rnd.Uniform(30000);
+    values.push_back(RandomString(&rnd, size));
+    ASSERT_LEVELDB_OK(Put(Key(i), values[i]));
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < 60; i++) {
+      ASSERT_EQ(values[i], Get(Key(i)));
+    }
+    Reopen(&options);
+  }
+}
+
+TEST_F(DBTest, SmallVlogWriteBufferConcurrentWriters) {
+  Options options = CurrentOptions();
+  options.vlog_write_buffer_size = 64 << 10;
+  Reopen(&options);
+
+  // Groups of ordinary values outgrow the smallest buffer.
+  static const int kWriters = 8;
+  static const int kNumWrites = 40;
+  ConcurrentWriter writers[kWriters];
+  for (int id = 0; id < kWriters; id++) {
+    writers[id].db = db_;
+    writers[id].id = id;
+    writers[id].sync = (id % 4 == 0);
+    writers[id].value_size = 30 << 10;
+    writers[id].num_writes = kNumWrites;
+    writers[id].done.store(false, std::memory_order_release);
+    env_->StartThread(ConcurrentWriterBody, &writers[id]);
+  }
+  for (int id = 0; id < kWriters; id++) {
+    while (!writers[id].done.load(std::memory_order_acquire)) {
+      DelayMilliseconds(10);
+    }
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int id = 0; id < kWriters; id++) {
+      for (int i = kNumWrites - 20; i < kNumWrites; i++) {
+        char key[100];
+        std::snprintf(key, sizeof(key), "%d.%d", id, i % 20);
+        ASSERT_EQ(std::string(writers[id].value_size,
+                              static_cast<char>('a' + i % 26)),
+                  Get(key));
+      }
+    }
+    Reopen(&options);
+  }
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
@@ -2429,6 +3324,44 @@ static void BM_LogAndApply(benchmark::State& state) {
 }
 
 BENCHMARK(BM_LogAndApply)->Arg(1)->Arg(100)->Arg(10000)->Arg(100000);
+
+// Inserts into one memtable from state.threads() threads, with
+// MemTable::AddConcurrently() if state.range(0) is set and with MemTable::Add()
+// under a mutex otherwise.
+static void BM_MemTableInsert(benchmark::State& state) {
+  static InternalKeyComparator cmp(BytewiseComparator());
+  static MemTable* mem;
+  static port::Mutex mu;
+  const bool concurrent = state.range(0) != 0;
+  if (state.thread_index() == 0) {
+    mem = new MemTable(cmp);
+    mem->Ref();
+  }
+
+  Random rnd(301 + state.thread_index());
+  const std::string value(16, 'v');
+  char key[20];
+  SequenceNumber seq = state.thread_index();
+  for (auto st : state) {
+    // Random keys; the sequence numbers keep the entries distinct.
+    std::snprintf(key, sizeof(key), "%010u", rnd.Next());
+    seq += state.threads();
+    if (concurrent) {
+      mem->AddConcurrently(seq, kTypeValue, key, value);
+    } else {
+      MutexLock l(&mu);
+      mem->Add(seq, kTypeValue, key, value);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  if (state.thread_index() == 0) {
+    mem->Unref();
+    mem = nullptr;
+  }
+}
+
+BENCHMARK(BM_MemTableInsert)->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
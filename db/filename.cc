@@ -30,6 +30,17 @@ std::string LogFileName(const std::string& dbname, uint64_t number) {
   return MakeFileName(dbname, number, "log");
 }
 
+std::string VlogFileName(const std::string& dbname, uint64_t number,
+                         int partition) {
+  assert(partition >= 0);
+  if (partition == 0) {
+    return LogFileName(dbname, number);
+  }
+  char suffix[30];
+  std::snprintf(suffix, sizeof(suffix), "p%d.log", partition);
+  return MakeFileName(dbname, number, suffix);
+}
+
 std::string TableFileName(const std::string& dbname, uint64_t number) {
   assert(number > 0);
   return MakeFileName(dbname, number, "ldb");
@@ -75,8 +86,16 @@ std::string OldInfoLogFileName(const std::string& dbname) {
 //    dbname/LOG.old
 //    dbname/MANIFEST-[0-9]+
 //    dbname/[0-9]+.(log|sst|ldb)
+//    dbname/[0-9]+.p[0-9]+.log
 bool ParseFileName(const std::string& filename, uint64_t* number,
                    FileType* type) {
+  int partition;
+  return ParseFileName(filename, number, type, &partition);
+}
+
+bool ParseFileName(const std::string& filename, uint64_t* number,
+                   FileType* type, int* partition) {
+  *partition = 0;
   Slice rest(filename);
   if (rest == "CURRENT") {
     *number = 0;
@@ -106,8 +125,17 @@ bool ParseFileName(const std::string& filename, uint64_t* number,
       return false;
     }
     Slice suffix = rest;
+    uint64_t part;
     if (suffix == Slice(".log")) {
       *type = kLogFile;
+    } else if (suffix.starts_with(".p")) {
+      suffix.remove_prefix(2);
+      if (!ConsumeDecimalNumber(&suffix, &part) || part == 0 ||
+          part > 0xffff || suffix != Slice(".log")) {
+        return false;
+      }
+      *type = kLogFile;
+      *partition = static_cast<int>(part);
     } else if (suffix == Slice(".sst") || suffix == Slice(".ldb")) {
       *type = kTableFile;
     } else if (suffix == Slice(".dbtmp")) {
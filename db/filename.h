@@ -33,6 +33,13 @@ enum FileType {
 // "dbname".
 std::string LogFileName(const std::string& dbname, uint64_t number);
 
+// Return the name of the vlog with the specified number of the vlog
+// partition "partition" (see Options::vlog_partitions) in the db named by
+// "dbname".  The vlogs of partition 0 are named like log files.  The
+// result will be prefixed with "dbname".
+std::string VlogFileName(const std::string& dbname, uint64_t number,
+                         int partition);
+
 // Return the name of the sstable with the specified number
 // in the db named by "dbname".  The result will be prefixed with
 // "dbname".
@@ -73,6 +80,11 @@ std::string OldInfoLogFileName(const std::string& dbname);
 bool ParseFileName(const std::string& filename, uint64_t* number,
                    FileType* type);
 
+// Like ParseFileName(), and if the file is a vlog, store its partition in
+// *partition.
+bool ParseFileName(const std::string& filename, uint64_t* number,
+                   FileType* type, int* partition);
+
 // Make the CURRENT file point to the descriptor file with the
 // specified number.
 Status SetCurrentFile(Env* env, const std::string& dbname,
@@ -63,7 +63,11 @@ TEST(FileNameTest, Parse) {
                                  "184467440737095516150.log",
                                  "100",
                                  "100.",
-                                 "100.lop"};
+                                 "100.lop",
+                                 "100.p.log",
+                                 "100.p0.log",
+                                 "100.p1.lo",
+                                 "100.p1x.log"};
   for (int i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
     std::string f = errors[i];
     ASSERT_TRUE(!ParseFileName(f, &number, &type)) << f;
@@ -93,6 +97,19 @@ TEST(FileNameTest, Construction) {
   ASSERT_EQ(192, number);
   ASSERT_EQ(kLogFile, type);
 
+  int partition;
+  fname = VlogFileName("foo", 192, 0);
+  ASSERT_EQ(LogFileName("foo", 192), fname);
+  ASSERT_TRUE(ParseFileName(fname.c_str() + 4, &number, &type, &partition));
+  ASSERT_EQ(0, partition);
+
+  fname = VlogFileName("foo", 193, 3);
+  ASSERT_EQ("foo/", std::string(fname.data(), 4));
+  ASSERT_TRUE(ParseFileName(fname.c_str() + 4, &number, &type, &partition));
+  ASSERT_EQ(193, number);
+  ASSERT_EQ(kLogFile, type);
+  ASSERT_EQ(3, partition);
+
   fname = TableFileName("bar", 200);
   ASSERT_EQ("bar/", std::string(fname.data(), 4));
   ASSERT_TRUE(ParseFileName(fname.c_str() + 4, &number, &type));
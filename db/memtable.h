@@ -56,11 +56,18 @@ class MemTable {
   void Add(SequenceNumber seq, ValueType type, const Slice& key,
            const Slice& value);
 
-  // If memtable contains a value for key, store it in *value and return true.
+  // Like Add(), but may be called from many threads at once.
+  // REQUIRES: no Add() runs at the same time.
+  void AddConcurrently(SequenceNumber seq, ValueType type, const Slice& key,
+                       const Slice& value);
+
+  // If memtable contains a value for key, store it in *value, store its
+  // type (an address or an inline value) in *type and return true.
   // If memtable contains a deletion for key, store a NotFound() error
   // in *status and return true.
   // Else, return false.
-  bool Get(const LookupKey& key, std::string* value, Status* s);
+  bool Get(const LookupKey& key, std::string* value, ValueType* type,
+           Status* s);
 
  private:
   friend class MemTableIterator;
@@ -76,6 +83,10 @@ class MemTable {
 
   ~MemTable();  // Private since only Unref() should be used to delete it
 
+  // Encode an entry into memory allocated from arena_.
+  const char* NewEntry(SequenceNumber seq, ValueType type, const Slice& key,
+                       const Slice& value, bool concurrent);
+
   KeyComparator comparator_;
   int refs_;
   Arena arena_;
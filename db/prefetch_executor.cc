@@ -0,0 +1,73 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/prefetch_executor.h"
+
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+PrefetchExecutor::PrefetchExecutor(int max_threads)
+    : max_threads_(max_threads > 0 ? max_threads : 1),
+      work_cv_(&mu_),
+      idle_threads_(0),
+      waking_threads_(0),
+      shutting_down_(false) {}
+
+PrefetchExecutor::~PrefetchExecutor() {
+  std::vector<std::thread> threads;
+  {
+    MutexLock l(&mu_);
+    shutting_down_ = true;
+    work_cv_.SignalAll();
+    threads.swap(threads_);
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+}
+
+void PrefetchExecutor::Schedule(void (*function)(void*), void* arg) {
+  MutexLock l(&mu_);
+  assert(!shutting_down_);
+  queue_.push_back(Task{function, arg});
+  if (waking_threads_ > 0) {
+    // A woken thread will pass the work on, see WorkerLoop().
+  } else if (idle_threads_ > 0) {
+    waking_threads_++;
+    work_cv_.Signal();
+  } else if (threads_.size() < static_cast<size_t>(max_threads_)) {
+    threads_.emplace_back(&PrefetchExecutor::WorkerLoop, this);
+  }
+}
+
+void PrefetchExecutor::WorkerLoop() {
+  mu_.Lock();
+  while (true) {
+    while (queue_.empty() && !shutting_down_) {
+      idle_threads_++;
+      work_cv_.Wait();
+      idle_threads_--;
+      if (waking_threads_ > 0) waking_threads_--;
+    }
+    if (queue_.empty()) {
+      // Shutting down and nothing left to run.
+      break;
+    }
+    Task task = queue_.front();
+    queue_.pop_front();
+    // Wake threads one at a time while work is left, rather than one per
+    // task, so that a burst of short tasks does not wake every thread.
+    if (!queue_.empty() && idle_threads_ > 0 && waking_threads_ == 0) {
+      waking_threads_++;
+      work_cv_.Signal();
+    }
+    mu_.Unlock();
+    (*task.function)(task.arg);
+    mu_.Lock();
+  }
+  mu_.Unlock();
+}
+
+}  // namespace leveldb
@@ -0,0 +1,55 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_PREFETCH_EXECUTOR_H_
+#define STORAGE_LEVELDB_DB_PREFETCH_EXECUTOR_H_
+
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "port/port.h"
+#include "port/thread_annotations.h"
+
+namespace leveldb {
+
+// A pool of threads shared by all iterators of a DB to read values from the
+// vlogs ahead of the caller.  Threads are started on demand, up to
+// "max_threads", and live until the executor is destroyed, so iterators do
+// not pay for thread creation.
+class PrefetchExecutor {
+ public:
+  explicit PrefetchExecutor(int max_threads);
+
+  PrefetchExecutor(const PrefetchExecutor&) = delete;
+  PrefetchExecutor& operator=(const PrefetchExecutor&) = delete;
+
+  // Waits for the queued tasks to finish.
+  ~PrefetchExecutor();
+
+  // Arrange to run "(*function)(arg)" once on one of the threads.
+  void Schedule(void (*function)(void* arg), void* arg);
+
+ private:
+  struct Task {
+    void (*function)(void*);
+    void* arg;
+  };
+
+  void WorkerLoop();
+
+  const int max_threads_;
+
+  port::Mutex mu_;
+  port::CondVar work_cv_ GUARDED_BY(mu_);
+  std::deque<Task> queue_ GUARDED_BY(mu_);
+  std::vector<std::thread> threads_ GUARDED_BY(mu_);
+  int idle_threads_ GUARDED_BY(mu_);
+  int waking_threads_ GUARDED_BY(mu_);  // Signalled but not yet running
+  bool shutting_down_ GUARDED_BY(mu_);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_PREFETCH_EXECUTOR_H_
@@ -3,18 +3,30 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 //
 // We recover the contents of the descriptor from the other files we find.
-// (1) Any log files are first converted to tables
-// (2) We scan every table to compute
+// (1) We scan every table to compute
 //     (a) smallest/largest for the table
 //     (b) largest sequence number in the table
+// (2) Every record of every vlog is converted to a table holding the
+//     addresses of its values, like recovery does, also the records
+//     whose values the tables already address.  The sequence numbers
+//     hide the stale versions.  The vlogs are scanned in parallel.  Vlogs
+//     hold the values, so unlike the logs of leveldb they are kept in
+//     place.
 // (3) We generate descriptor contents:
-//      - log number is set to zero
+//      - log number is set past every vlog, so that none is replayed
+//        again and a new vlog is started on open
 //      - next-file-number is set to 1 + largest file number we found
 //      - last-sequence-number is set to largest sequence# found across
-//        all tables (see 2c)
+//        all tables (see 1b)
 //      - compaction pointers are cleared
+//      - the garbage statistics of the vlogs and the progress of garbage
+//        collection are reset
 //      - every table file is added at level 0
 //
+// A vlog whose retirement by garbage collection is lost with the old
+// descriptor is treated as live.  The values it held were rewritten with
+// newer sequence numbers, so they stay hidden.
+//
 // Possible optimization 1:
 //   (a) Compute total size and use to pick appropriate max-level M
 //   (b) Sort tables by largest sequence# in the table
@@ -28,16 +40,25 @@
 #include "db/db_impl.h"
 #include "db/dbformat.h"
 #include "db/filename.h"
-#include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
 #include "db/table_cache.h"
 #include "db/version_edit.h"
+#include "db/vlog_manager.h"
+#include "db/vlog_reader.h"
 #include "db/write_batch_internal.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include "leveldb/comparator.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 
+#include "port/port.h"
+#include "util/coding.h"
+#include "util/mutexlock.h"
+
 namespace leveldb {
 
 namespace {
@@ -70,8 +91,10 @@ class Repairer {
   Status Run() {
     Status status = FindFiles();
     if (status.ok()) {
-      ConvertLogFilesToTables();
+      // Only the tables found are scanned: the tables written from the
+      // vlogs are added to tables_ as they are written.
       ExtractMetaData();
+      ConvertVlogsToTables();
       status = WriteDescriptor();
     }
     if (status.ok()) {
@@ -107,8 +130,9 @@ class Repairer {
 
     uint64_t number;
     FileType type;
+    int partition;
     for (size_t i = 0; i < filenames.size(); i++) {
-      if (ParseFileName(filenames[i], &number, &type)) {
+      if (ParseFileName(filenames[i], &number, &type, &partition)) {
         if (type == kDescriptorFile) {
           manifests_.push_back(filenames[i]);
         } else {
@@ -116,7 +140,7 @@ class Repairer {
             next_file_number_ = number + 1;
           }
           if (type == kLogFile) {
-            logs_.push_back(number);
+            vlogs_.push_back(std::make_pair(number, partition));
           } else if (type == kTableFile) {
             table_numbers_.push_back(number);
           } else {
@@ -128,92 +152,150 @@ class Repairer {
     return status;
   }
 
-  void ConvertLogFilesToTables() {
-    for (size_t i = 0; i < logs_.size(); i++) {
-      std::string logname = LogFileName(dbname_, logs_[i]);
-      Status status = ConvertLogToTable(logs_[i]);
-      if (!status.ok()) {
-        Log(options_.info_log, "Log #%llu: ignoring conversion error: %s",
-            (unsigned long long)logs_[i], status.ToString().c_str());
+  void ConvertVlogsToTables() {
+    // Each vlog is converted on its own, so the vlogs are scanned in
+    // parallel.
+    std::atomic<size_t> next_vlog(0);
+    auto convert = [this, &next_vlog]() {
+      size_t i;
+      while ((i = next_vlog.fetch_add(1)) < vlogs_.size()) {
+        Status status = ConvertVlogToTables(vlogs_[i].first, vlogs_[i].second);
+        if (!status.ok()) {
+          Log(options_.info_log, "Vlog #%llu: ignoring conversion error: %s",
+              (unsigned long long)vlogs_[i].first, status.ToString().c_str());
+        }
       }
-      ArchiveFile(logname);
+    };
+    const size_t num_threads = std::min<size_t>(
+        vlogs_.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+      threads.emplace_back(convert);
+    }
+    convert();
+    for (std::thread& thread : threads) {
+      thread.join();
     }
   }
 
-  Status ConvertLogToTable(uint64_t log) {
-    struct LogReporter : public log::Reader::Reporter {
+  Status ConvertVlogToTables(uint64_t vlog_number, int partition) {
+    struct LogReporter : public vlog::VReader::Reporter {
       Env* env;
       Logger* info_log;
       uint64_t lognum;
       void Corruption(size_t bytes, const Status& s) override {
         // We print error messages for corruption, but continue repairing.
-        Log(info_log, "Log #%llu: dropping %d bytes; %s",
+        Log(info_log, "Vlog #%llu: dropping %d bytes; %s",
             (unsigned long long)lognum, static_cast<int>(bytes),
             s.ToString().c_str());
       }
     };
 
-    // Open the log file
-    std::string logname = LogFileName(dbname_, log);
+    // Open the vlog file
+    std::string logname = VlogFileName(dbname_, vlog_number, partition);
     SequentialFile* lfile;
     Status status = env_->NewSequentialFile(logname, &lfile);
     if (!status.ok()) {
       return status;
     }
 
-    // Create the log reader.
+    // Create the vlog reader, which owns lfile.
     LogReporter reporter;
     reporter.env = env_;
     reporter.info_log = options_.info_log;
-    reporter.lognum = log;
-    // We intentionally make log::Reader do checksumming so that
-    // corruptions cause entire commits to be skipped instead of
-    // propagating bad information (like overly large sequence
-    // numbers).
-    log::Reader reader(lfile, &reporter, false /*do not checksum*/,
-                       0 /*initial_offset*/);
-
-    // Read all the records and add to a memtable
+    reporter.lognum = vlog_number;
+    // We intentionally make VReader do checksumming so that corruptions
+    // cause the rest of the vlog to be skipped instead of propagating bad
+    // information (like overly large sequence numbers).  The records have
+    // no framing, so nothing past a corruption can be recovered.
+    vlog::VReader reader(lfile, &reporter, true /*checksum*/,
+                         0 /*initial_offset*/);
+
+    // Every record is converted, also those that surviving tables already
+    // address: a lost table may have held older records of the vlog than
+    // a surviving one.  The sequence numbers hide the stale versions.
+    // Read the records and add the addresses of their values to memtables
     std::string scratch;
     Slice record;
     WriteBatch batch;
-    MemTable* mem = new MemTable(icmp_);
-    mem->Ref();
+    MemTable* mem = nullptr;
+    SequenceNumber max_sequence = 0;
+    uint64_t record_offset = 0;
     int counter = 0;
     while (reader.ReadRecord(&record, &scratch)) {
+      size_t vlog_head = record_offset + vlog::kVHeaderSize;
+      record_offset = vlog_head + record.size();
       if (record.size() < 12) {
         reporter.Corruption(record.size(),
                             Status::Corruption("log record too small"));
         continue;
       }
       WriteBatchInternal::SetContents(&batch, record);
-      status = WriteBatchInternal::InsertInto(&batch, mem);
+
+      if (mem == nullptr) {
+        mem = new MemTable(icmp_);
+        mem->Ref();
+      }
+      uint64_t inline_count, inline_bytes;
+      status = WriteBatchInternal::InsertAddressInto(
+          &batch, vlog_number, options_.min_blob_size, mem, false,
+          &vlog_head, &inline_count, &inline_bytes);
       if (status.ok()) {
         counter += WriteBatchInternal::Count(&batch);
+        max_sequence =
+            std::max(max_sequence, WriteBatchInternal::Sequence(&batch) +
+                                       WriteBatchInternal::Count(&batch) - 1);
       } else {
-        Log(options_.info_log, "Log #%llu: ignoring %s",
-            (unsigned long long)log, status.ToString().c_str());
+        Log(options_.info_log, "Vlog #%llu: ignoring %s",
+            (unsigned long long)vlog_number, status.ToString().c_str());
         status = Status::OK();  // Keep going with rest of file
       }
+
+      if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
+        status = WriteTable(vlog_number, mem, max_sequence);
+        mem->Unref();
+        mem = nullptr;
+        max_sequence = 0;
+        if (!status.ok()) {
+          break;
+        }
+      }
     }
-    delete lfile;
+    if (mem != nullptr) {
+      if (status.ok()) {
+        status = WriteTable(vlog_number, mem, max_sequence);
+      }
+      mem->Unref();
+    }
+    Log(options_.info_log,
+        "Vlog #%llu: %d ops converted; %llu bytes readable %s",
+        (unsigned long long)vlog_number, counter,
+        (unsigned long long)record_offset, status.ToString().c_str());
+    return status;
+  }
 
+  // Save the contents of "mem", converted from the vlog "vlog_number", to a
+  // table.
+  Status WriteTable(uint64_t vlog_number, MemTable* mem,
+                    SequenceNumber max_sequence) {
     // Do not record a version edit for this conversion to a Table
-    // since ExtractMetaData() will also generate edits.
-    FileMetaData meta;
-    meta.number = next_file_number_++;
+    // since WriteDescriptor() will add every table.
+    TableInfo t;
+    {
+      MutexLock l(&mutex_);
+      t.meta.number = next_file_number_++;
+    }
+    t.max_sequence = max_sequence;
     Iterator* iter = mem->NewIterator();
-    status = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    Status status =
+        BuildTable(dbname_, env_, options_, table_cache_, iter, &t.meta);
     delete iter;
-    mem->Unref();
-    mem = nullptr;
-    if (status.ok()) {
-      if (meta.file_size > 0) {
-        table_numbers_.push_back(meta.number);
-      }
+    if (status.ok() && t.meta.file_size > 0) {
+      MutexLock l(&mutex_);
+      tables_.push_back(t);
     }
-    Log(options_.info_log, "Log #%llu: %d ops saved to Table #%llu %s",
-        (unsigned long long)log, counter, (unsigned long long)meta.number,
+    Log(options_.info_log, "Vlog #%llu: saved to Table #%llu %s",
+        (unsigned long long)vlog_number, (unsigned long long)t.meta.number,
         status.ToString().c_str());
     return status;
   }
@@ -361,8 +443,16 @@ class Repairer {
     }
 
     edit_.SetComparatorName(icmp_.user_comparator()->Name());
-    edit_.SetLogNumber(0);
-    edit_.SetNextFile(next_file_number_);
+    // Every vlog has been converted, open starts a new one.
+    edit_.SetLogNumber(next_file_number_);
+    edit_.SetVlogHeadPos(0);
+    for (const auto& vlog : vlogs_) {
+      if (vlog.second > 0) {
+        edit_.SetVlogPartitionHead(vlog.second, next_file_number_, 0);
+      }
+    }
+    edit_.SetVlogTailPos(0, 0);
+    edit_.SetNextFile(next_file_number_ + 1);
     edit_.SetLastSequence(max_sequence);
 
     for (size_t i = 0; i < tables_.size(); i++) {
@@ -437,7 +527,11 @@ class Repairer {
 
   std::vector<std::string> manifests_;
   std::vector<uint64_t> table_numbers_;
-  std::vector<uint64_t> logs_;
+  std::vector<std::pair<uint64_t, int>> vlogs_;  // number, partition
+
+  // Protects tables_ and next_file_number_ while the vlogs are converted
+  // in parallel.
+  port::Mutex mutex_;
   std::vector<TableInfo> tables_;
   uint64_t next_file_number_;
 };
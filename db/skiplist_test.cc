@@ -6,6 +6,8 @@
 
 #include <atomic>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "leveldb/env.h"
@@ -207,8 +209,8 @@ class ConcurrentTest {
 
   Arena arena_;
 
-  // SkipList is not protected by mu_.  We just use a single writer
-  // thread to modify it.
+  // SkipList is not protected by mu_.  We either use a single writer
+  // thread to modify it, or writers that only insert concurrently.
   SkipList<Key, Comparator> list_;
 
  public:
@@ -223,6 +225,18 @@ class ConcurrentTest {
     current_.Set(k, g);
   }
 
+  // Like WriteStep(), but inserts concurrently, and only the keys that
+  // belong to writer "id" of "n", so that each key keeps a single writer.
+  // REQUIRES: n divides K
+  void ConcurrentWriteStep(Random* rnd, int id, int n) {
+    assert(K % n == 0);
+    const uint32_t k = (rnd->Next() % (K / n)) * n + id;
+    const intptr_t g = current_.Get(k) + 1;
+    const Key key = MakeKey(k, g);
+    list_.InsertConcurrently(key);
+    current_.Set(k, g);
+  }
+
   void ReadStep(Random* rnd) {
     // Remember the initial committed state of the skiplist.
     State initial_state;
@@ -359,12 +373,75 @@ static void RunConcurrent(int run) {
   }
 }
 
+// Like RunConcurrent(), with "num_writers" threads inserting at once.
+static void RunConcurrentInserts(int run, int num_writers) {
+  const int seed = test::RandomSeed() + (run * 100);
+  const int N = 1000;
+  const int kSize = 1000;
+  for (int i = 0; i < N; i++) {
+    if ((i % 100) == 0) {
+      std::fprintf(stderr, "Run %d of %d\n", i, N);
+    }
+    TestState state(seed + 1);
+    Env::Default()->Schedule(ConcurrentReader, &state);
+    state.Wait(TestState::RUNNING);
+    std::vector<std::thread> writers;
+    for (int id = 0; id < num_writers; id++) {
+      writers.emplace_back([&state, seed, i, id, num_writers]() {
+        Random rnd(seed + i * num_writers + id);
+        for (int j = 0; j < kSize / num_writers; j++) {
+          state.t_.ConcurrentWriteStep(&rnd, id, num_writers);
+        }
+      });
+    }
+    for (std::thread& writer : writers) {
+      writer.join();
+    }
+    state.quit_flag_.store(true, std::memory_order_release);
+    state.Wait(TestState::DONE);
+  }
+}
+
 TEST(SkipTest, Concurrent1) { RunConcurrent(1); }
 TEST(SkipTest, Concurrent2) { RunConcurrent(2); }
 TEST(SkipTest, Concurrent3) { RunConcurrent(3); }
 TEST(SkipTest, Concurrent4) { RunConcurrent(4); }
 TEST(SkipTest, Concurrent5) { RunConcurrent(5); }
 
+TEST(SkipTest, ConcurrentInserts1) { RunConcurrentInserts(1, 2); }
+TEST(SkipTest, ConcurrentInserts2) { RunConcurrentInserts(2, 4); }
+TEST(SkipTest, ConcurrentInserts3) { RunConcurrentInserts(3, 4); }
+
+// Every key inserted by concurrent writers is found, in order.
+TEST(SkipTest, InsertConcurrentlyAndLookup) {
+  const int kThreads = 4;
+  const int kPerThread = 5000;
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &arena);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&list, t]() {
+      for (int i = 0; i < kPerThread; i++) {
+        list.InsertConcurrently(static_cast<Key>(i) * kThreads + t);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (Key i = 0; i < kThreads * kPerThread; i++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(i, iter.key());
+    ASSERT_TRUE(list.Contains(i));
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
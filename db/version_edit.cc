@@ -24,7 +24,9 @@ enum Tag {
   kPrevLogNumber = 9,
   kHead = 10,
   kVlogInfo = 11,
-  kTail = 12
+  kTail = 12,
+  kDeletedVlog = 13,
+  kPartitionHead = 14
 };
 
 void VersionEdit::Clear() {
@@ -40,6 +42,8 @@ void VersionEdit::Clear() {
   has_last_sequence_ = false;
   deleted_files_.clear();
   new_files_.clear();
+  deleted_vlogs_.clear();
+  partition_heads_.clear();
 
   vlog_info_.clear();
   has_vlog_info_ = false;
@@ -80,6 +84,12 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutVarint64(dst, tail_vlog_number_);
     PutVarint64(dst, tail_info_);
   }
+  for (const auto& kvp : partition_heads_) {
+    PutVarint32(dst, kPartitionHead);
+    PutVarint32(dst, kvp.first);
+    PutVarint64(dst, kvp.second.first);
+    PutVarint64(dst, kvp.second.second);
+  }
   if (has_vlog_info_) {
     PutVarint32(dst, kVlogInfo);
     PutLengthPrefixedSlice(dst, vlog_info_);
@@ -97,6 +107,11 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutVarint64(dst, deleted_file_kvp.second);  // file number
   }
 
+  for (uint64_t vlog_number : deleted_vlogs_) {
+    PutVarint32(dst, kDeletedVlog);
+    PutVarint64(dst, vlog_number);
+  }
+
   for (size_t i = 0; i < new_files_.size(); i++) {
     const FileMetaData& f = new_files_[i].second;
     PutVarint32(dst, kNewFile);
@@ -236,6 +251,26 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kPartitionHead: {
+        uint32_t partition;
+        uint64_t head;
+        if (GetVarint32(&input, &partition) && partition > 0 &&
+            GetVarint64(&input, &number) && GetVarint64(&input, &head)) {
+          partition_heads_[partition] = std::make_pair(number, head);
+        } else {
+          msg = "partition head";
+        }
+        break;
+      }
+
+      case kDeletedVlog:
+        if (GetVarint64(&input, &number)) {
+          deleted_vlogs_.insert(number);
+        } else {
+          msg = "deleted vlog";
+        }
+        break;
+
       default:
         msg = "unknown tag";
         break;
@@ -276,6 +311,24 @@ std::string VersionEdit::DebugString() const {
     r.append("\n  LastSeq: ");
     AppendNumberTo(&r, last_sequence_);
   }
+  if (has_head_info_) {
+    r.append("\n  VlogHead: ");
+    AppendNumberTo(&r, head_info_);
+  }
+  if (has_tail_info_) {
+    r.append("\n  VlogTail: ");
+    AppendNumberTo(&r, tail_vlog_number_);
+    r.append(" ");
+    AppendNumberTo(&r, tail_info_);
+  }
+  for (const auto& kvp : partition_heads_) {
+    r.append("\n  PartitionHead: ");
+    AppendNumberTo(&r, kvp.first);
+    r.append(" ");
+    AppendNumberTo(&r, kvp.second.first);
+    r.append(" ");
+    AppendNumberTo(&r, kvp.second.second);
+  }
   for (size_t i = 0; i < compact_pointers_.size(); i++) {
     r.append("\n  CompactPointer: ");
     AppendNumberTo(&r, compact_pointers_[i].first);
@@ -288,6 +341,10 @@ std::string VersionEdit::DebugString() const {
     r.append(" ");
     AppendNumberTo(&r, deleted_files_kvp.second);
   }
+  for (uint64_t vlog_number : deleted_vlogs_) {
+    r.append("\n  RemoveVlog: ");
+    AppendNumberTo(&r, vlog_number);
+  }
   for (size_t i = 0; i < new_files_.size(); i++) {
     const FileMetaData& f = new_files_[i].second;
     r.append("\n  AddFile: ");
@@ -6,6 +6,8 @@
 #define STORAGE_LEVELDB_DB_VERSION_EDIT_H_
 
 #include "db/dbformat.h"
+#include <atomic>
+#include <map>
 #include <set>
 #include <utility>
 #include <vector>
@@ -16,9 +18,22 @@ class VersionSet;
 
 struct FileMetaData {
   FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0) {}
+  FileMetaData(const FileMetaData& f) { *this = f; }
+  FileMetaData& operator=(const FileMetaData& f) {
+    refs = f.refs;
+    allowed_seeks.store(f.allowed_seeks.load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+    number = f.number;
+    file_size = f.file_size;
+    smallest = f.smallest;
+    largest = f.largest;
+    return *this;
+  }
 
   int refs;
-  int allowed_seeks;  // Seeks allowed until compaction
+  // Seeks allowed until compaction.  Reads charge their seeks without
+  // holding the lock.
+  std::atomic<int> allowed_seeks;
   uint64_t number;
   uint64_t file_size;    // File size in bytes
   InternalKey smallest;  // Smallest internal key served by table
@@ -44,6 +59,11 @@ class VersionEdit {
     has_head_info_ = true;
     head_info_ = head;
   }
+  // Set where the replay of vlog partition "partition" (> 0) starts, the
+  // way SetLogNumber() and SetVlogHeadPos() do for partition 0.
+  void SetVlogPartitionHead(int partition, uint64_t number, uint64_t head) {
+    partition_heads_[partition] = std::make_pair(number, head);
+  }
   void SetVlogTailPos(uint64_t num, uint64_t tail) {
     has_tail_info_ = true;
     tail_info_ = tail;
@@ -87,6 +107,11 @@ class VersionEdit {
     deleted_files_.insert(std::make_pair(level, file));
   }
 
+  // Mark the vlog "number" as reclaimed by garbage collection.  Every live
+  // value it held has been rewritten at the vlog head, so the file can be
+  // deleted once no reader may still hold an address into it.
+  void RemoveVlog(uint64_t number) { deleted_vlogs_.insert(number); }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(const Slice& src);
 
@@ -128,8 +153,12 @@ class VersionEdit {
   bool has_vlog_info_;
   std::string vlog_info_;
 
+  // partition -> (vlog number, offset) where its replay starts.
+  std::map<int, std::pair<uint64_t, uint64_t>> partition_heads_;
+
   std::vector<std::pair<int, InternalKey>> compact_pointers_;
   DeletedFileSet deleted_files_;
+  std::set<uint64_t> deleted_vlogs_;
   std::vector<std::pair<int, FileMetaData>> new_files_;
 };
 
@@ -35,6 +35,10 @@ TEST(VersionEditTest, EncodeDecode) {
   edit.SetLogNumber(kBig + 100);
   edit.SetNextFile(kBig + 200);
   edit.SetLastSequence(kBig + 1000);
+  edit.SetVlogHeadPos(kBig + 1100);
+  edit.SetVlogTailPos(kBig + 1200, kBig + 1300);
+  edit.RemoveVlog(kBig + 1400);
+  edit.SetVlogPartitionHead(2, kBig + 1500, kBig + 1600);
   TestEncodeDecode(edit);
 }
 
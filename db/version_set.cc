@@ -258,6 +258,7 @@ struct Saver {
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  ValueType* type;
 };
 }  // namespace
 static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
@@ -267,9 +268,10 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
     s->state = kCorrupt;
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
-      s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
+      s->state = (parsed_key.type == kTypeDeletion) ? kDeleted : kFound;
       if (s->state == kFound) {
         s->value->assign(v.data(), v.size());
+        *s->type = parsed_key.type;
       }
     }
   }
@@ -323,7 +325,7 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key, void* arg,
 }
 
 Status Version::Get(const ReadOptions& options, const LookupKey& k,
-                    std::string* value, GetStats* stats) {
+                    std::string* value, ValueType* type, GetStats* stats) {
   stats->seek_file = nullptr;
   stats->seek_file_level = -1;
 
@@ -394,6 +396,7 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
   state.saver.ucmp = vset_->icmp_.user_comparator();
   state.saver.user_key = k.user_key();
   state.saver.value = value;
+  state.saver.type = type;
 
   ForEachOverlapping(state.saver.user_key, state.ikey, &state, &State::Match);
 
@@ -401,14 +404,20 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
 }
 
 bool Version::UpdateStats(const GetStats& stats) {
+  return ChargeSeek(stats) && UpdateSeekCompaction(stats);
+}
+
+bool Version::ChargeSeek(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
-  if (f != nullptr) {
-    f->allowed_seeks--;
-    if (f->allowed_seeks <= 0 && file_to_compact_ == nullptr) {
-      file_to_compact_ = f;
-      file_to_compact_level_ = stats.seek_file_level;
-      return true;
-    }
+  return f != nullptr &&
+         f->allowed_seeks.fetch_sub(1, std::memory_order_relaxed) <= 1;
+}
+
+bool Version::UpdateSeekCompaction(const GetStats& stats) {
+  if (file_to_compact_ == nullptr) {
+    file_to_compact_ = stats.seek_file;
+    file_to_compact_level_ = stats.seek_file_level;
+    return true;
   }
   return false;
 }
@@ -747,6 +756,7 @@ VersionSet::VersionSet(const std::string& dbname, const Options* options,
       head_info_(0),
       tail_info_(0),
       tail_vlog_number_(0),
+      version_epoch_(0),
       descriptor_file_(nullptr),
       descriptor_log_(nullptr),
       dummy_versions_(this),
@@ -770,6 +780,7 @@ void VersionSet::AppendVersion(Version* v) {
   }
   current_ = v;
   v->Ref();
+  v->epoch_ = ++version_epoch_;
 
   // Append to linked list
   v->prev_ = dummy_versions_.prev_;
@@ -791,7 +802,7 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
 
   edit->SetNextFile(next_file_number_);
-  edit->SetLastSequence(last_sequence_);
+  edit->SetLastSequence(LastSequence());
 
   Version* v = new Version(this);
   {
@@ -849,6 +860,22 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
     AppendVersion(v);
     log_number_ = edit->log_number_;
     prev_log_number_ = edit->prev_log_number_;
+    if (edit->has_head_info_) {
+      head_info_ = edit->head_info_;
+    }
+    if (edit->has_tail_info_) {
+      tail_info_ = edit->tail_info_;
+      tail_vlog_number_ = edit->tail_vlog_number_;
+    }
+    if (edit->has_vlog_info_) {
+      vlog_info_ = edit->vlog_info_;
+    }
+    for (const auto& kvp : edit->partition_heads_) {
+      partition_heads_[kvp.first] = kvp.second;
+    }
+    for (uint64_t vlog_number : edit->deleted_vlogs_) {
+      retired_vlogs_[vlog_number] = v->epoch_;
+    }
   } else {
     delete v;
     if (!new_manifest_file.empty()) {
@@ -907,6 +934,7 @@ Status VersionSet::Recover(bool* save_manifest) {
   uint64_t head_info = 0;
   uint64_t tail_info = 0;
   uint64_t tail_vlog_number = 0;
+  std::map<int, std::pair<uint64_t, uint64_t>> partition_heads;
   std::string vlog_info;
   Builder builder(this, current_);
   int read_records = 0;
@@ -970,6 +998,16 @@ Status VersionSet::Recover(bool* save_manifest) {
         vlog_info = edit.vlog_info_;
         have_vlog_info = true;
       }
+
+      for (const auto& kvp : edit.partition_heads_) {
+        partition_heads[kvp.first] = kvp.second;
+      }
+
+      // No reader survives a restart, so every retired vlog may be
+      // deleted right away.
+      for (uint64_t vlog_number : edit.deleted_vlogs_) {
+        retired_vlogs_[vlog_number] = 0;
+      }
     }
   }
   delete file;
@@ -1008,6 +1046,7 @@ Status VersionSet::Recover(bool* save_manifest) {
     tail_info_ = tail_info;
     tail_vlog_number_ = tail_vlog_number;
     vlog_info_ = vlog_info;
+    partition_heads_ = partition_heads;
     // See if we can reuse the existing MANIFEST file.
     if (ReuseManifest(dscname, current)) {
       // No need to save new manifest
@@ -1123,6 +1162,19 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     }
   }
 
+  // Save vlog state
+  edit.SetVlogHeadPos(head_info_);
+  edit.SetVlogTailPos(tail_vlog_number_, tail_info_);
+  for (const auto& kvp : partition_heads_) {
+    edit.SetVlogPartitionHead(kvp.first, kvp.second.first, kvp.second.second);
+  }
+  if (!vlog_info_.empty()) {
+    edit.SetVlogInfo(vlog_info_);
+  }
+  for (const auto& kvp : retired_vlogs_) {
+    edit.RemoveVlog(kvp.first);
+  }
+
   std::string record;
   edit.EncodeTo(&record);
   return log->AddRecord(record);
@@ -1178,6 +1230,16 @@ uint64_t VersionSet::ApproximateOffsetOf(Version* v, const InternalKey& ikey) {
   return result;
 }
 
+bool VersionSet::CanDeleteVlog(uint64_t number) const {
+  auto iter = retired_vlogs_.find(number);
+  if (iter == retired_vlogs_.end()) {
+    return false;
+  }
+  // Versions are linked in installation order, so the first one is the
+  // oldest version still referenced by a reader.
+  return dummy_versions_.next_->epoch_ >= iter->second;
+}
+
 void VersionSet::AddLiveFiles(std::set<uint64_t>* live) {
   for (Version* v = dummy_versions_.next_; v != &dummy_versions_;
        v = v->next_) {
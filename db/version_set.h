@@ -17,6 +17,7 @@
 
 #include "db/dbformat.h"
 #include "db/version_edit.h"
+#include <atomic>
 #include <map>
 #include <set>
 #include <vector>
@@ -59,8 +60,9 @@ bool SomeFileOverlapsRange(const InternalKeyComparator& icmp,
 
 class Version {
  public:
-  // Lookup the value for key.  If found, store it in *val and
-  // return OK.  Else return a non-OK status.  Fills *stats.
+  // Lookup the value for key.  If found, store it in *val, store whether
+  // it is a vlog address or an inline value in *type and return OK.
+  // Else return a non-OK status.  Fills *stats.
   // REQUIRES: lock is not held
   struct GetStats {
     FileMetaData* seek_file;
@@ -73,13 +75,24 @@ class Version {
   void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters);
 
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
-             GetStats* stats);
+             ValueType* type, GetStats* stats);
 
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
   bool UpdateStats(const GetStats& stats);
 
+  // Charge the seek of "stats" to its file.  Returns true if the file has
+  // used up its allowed seeks, in which case UpdateSeekCompaction() has to
+  // be called with the lock held.  May be called without holding the lock.
+  bool ChargeSeek(const GetStats& stats);
+
+  // Pick the file of "stats", which has used up its allowed seeks, for
+  // compaction unless another file is picked already.  Returns true if a
+  // new compaction may need to be triggered.
+  // REQUIRES: lock is held
+  bool UpdateSeekCompaction(const GetStats& stats);
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
   // bytes.  Returns true if a new compaction may need to be triggered.
@@ -125,6 +138,7 @@ class Version {
         next_(this),
         prev_(this),
         refs_(0),
+        epoch_(0),
         file_to_compact_(nullptr),
         file_to_compact_level_(-1),
         compaction_score_(-1),
@@ -149,6 +163,7 @@ class Version {
   Version* next_;     // Next version in linked list
   Version* prev_;     // Previous version in linked list
   int refs_;          // Number of live refs to this version
+  uint64_t epoch_;    // Order in which this version was installed
 
   // List of files per level
   std::vector<FileMetaData*> files_[config::kNumLevels];
@@ -193,7 +208,9 @@ class VersionSet {
   // Allocate and return a new file number
   uint64_t NewFileNumber() { return next_file_number_++; }
 
-  uint64_t NewVlogNumber() { return ++log_number_; }
+  // Allocate and return a new vlog file number.  Vlogs share the file
+  // number space, so LogNumber() only moves when a memtable is flushed.
+  uint64_t NewVlogNumber() { return NewFileNumber(); }
 
   // Arrange to reuse "file_number" unless a newer file number has
   // already been allocated.
@@ -204,12 +221,6 @@ class VersionSet {
     }
   }
 
-  void ReuseVlogNumber(uint64_t file_number) {
-    if (log_number_ == file_number) {
-      log_number_ = file_number - 1;
-    }
-  }
-
   // Return the number of Table files at the specified level.
   int NumLevelFiles(int level) const;
 
@@ -217,12 +228,16 @@ class VersionSet {
   int64_t NumLevelBytes(int level) const;
 
   // Return the last sequence number.
-  uint64_t LastSequence() const { return last_sequence_; }
+  // May be called without holding the lock: the entries of the writes up
+  // to the returned sequence are visible in the memtables.
+  uint64_t LastSequence() const {
+    return last_sequence_.load(std::memory_order_acquire);
+  }
 
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
-    assert(s >= last_sequence_);
-    last_sequence_ = s;
+    assert(s >= LastSequence());
+    last_sequence_.store(s, std::memory_order_release);
   }
 
   // Mark the specified file number as used.
@@ -233,12 +248,36 @@ class VersionSet {
 
   uint64_t VlogHeadPos() const { return head_info_; }
 
+  // Return the vlog where the replay of vlog partition "partition" starts
+  // and the offset in it.  Partition 0 is LogNumber() and VlogHeadPos();
+  // a partition that never had a head recorded returns 0.
+  uint64_t PartitionLogNumber(int partition) const {
+    if (partition == 0) return log_number_;
+    auto it = partition_heads_.find(partition);
+    return it == partition_heads_.end() ? 0 : it->second.first;
+  }
+  uint64_t PartitionHeadPos(int partition) const {
+    if (partition == 0) return head_info_;
+    auto it = partition_heads_.find(partition);
+    return it == partition_heads_.end() ? 0 : it->second.second;
+  }
+
   uint64_t VlogTailPos() const { return tail_info_; }
 
   uint64_t VlogTailNumber() const { return tail_vlog_number_; }
 
   const std::string& VlogInfo() const { return vlog_info_; }
 
+  // Returns true iff the vlog "number" has been reclaimed by garbage
+  // collection (see VersionEdit::RemoveVlog).
+  bool IsVlogRetired(uint64_t number) const {
+    return retired_vlogs_.find(number) != retired_vlogs_.end();
+  }
+
+  // Returns true iff the vlog "number" is retired and no live version
+  // predates its retirement, so no reader can still hold an address into it.
+  bool CanDeleteVlog(uint64_t number) const;
+
   // Return the log file number for the log file that is currently
   // being compacted, or zero if there is no such log file.
   uint64_t PrevLogNumber() const { return prev_log_number_; }
@@ -316,7 +355,7 @@ class VersionSet {
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
-  uint64_t last_sequence_;
+  std::atomic<uint64_t> last_sequence_;
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
 
@@ -324,6 +363,12 @@ class VersionSet {
   uint64_t tail_info_;
   uint64_t tail_vlog_number_;
   std::string vlog_info_;
+  // Heads of vlog partitions > 0, see VersionEdit::SetVlogPartitionHead().
+  std::map<int, std::pair<uint64_t, uint64_t>> partition_heads_;
+
+  // Retired vlog number -> epoch of the version that retired it.
+  std::map<uint64_t, uint64_t> retired_vlogs_;
+  uint64_t version_epoch_;
 
   // Opened lazily
   WritableFile* descriptor_file_;
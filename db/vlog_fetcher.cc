@@ -26,33 +26,32 @@ Status VlogFetcher::Get(const uint64_t offset, const uint64_t size,
   Slice result;
   Status s;
 
-  // It seems that additional cache is useless for the cost of insert is
-  // remarkable.
+  // Recently read values are cached by VlogManager (Options::value_cache).
 
   char buf[1 << 16];
   bool need_deallocate = false;
   bool in_buffer = false;
+  if (size <= (1 << 16)) {
+    scratch = buf;
+  } else {
+    scratch = new char[size];
+    need_deallocate = true;
+  }
 
   my_info_->rwlock_->SharedLock();
   if (offset >= my_info_->head_) {
-    assert(offset - my_info_->head_ < my_info_->size_);
-    scratch = &my_info_->buffer_[offset - my_info_->head_];
-    result = Slice(scratch, size);
-    s = Parse(&result, value);
+    my_info_->vlog_write_->ReadBuffered(offset, size,
+                                        const_cast<char*>(scratch));
     in_buffer = true;
   }
   my_info_->rwlock_->SharedUnlock();
 
-  if (!in_buffer) {
-    if (size <= (1 << 16)) {
-      scratch = buf;
-    } else {
-      scratch = new char[size];
-      need_deallocate = true;
-    }
+  if (in_buffer) {
+    result = Slice(scratch, size);
+  } else {
     file_->Read(offset, size, &result, const_cast<char*>(scratch));
-    s = Parse(&result, value);
   }
+  s = Parse(&result, value);
 
   if (need_deallocate) {
     delete[] scratch;
@@ -61,10 +60,32 @@ Status VlogFetcher::Get(const uint64_t offset, const uint64_t size,
   return s;
 }
 
-VlogFetcher::VlogFetcher(const std::string& dbname, const Options& options,
-                         const uint32_t log_number) {
-  Status s = options.env->NewNonMmapRandomAccessFile(
-      LogFileName(dbname, log_number), &file_);
+bool VlogFetcher::Flushed(uint64_t offset) {
+  my_info_->rwlock_->SharedLock();
+  bool flushed = offset <= my_info_->head_;
+  my_info_->rwlock_->SharedUnlock();
+  return flushed;
+}
+
+void VlogFetcher::MultiRead(RandomAccessFile::ReadRequest* reqs, size_t n) {
+  file_->MultiRead(reqs, n);
+  for (size_t i = 0; i < n; i++) {
+    if (reqs[i].status.ok() && reqs[i].result.size() != reqs[i].n) {
+      reqs[i].status = Status::Corruption("truncated vlog read");
+    }
+  }
+}
+
+Status VlogFetcher::ParseValue(Slice entry, std::string* value) {
+  return Parse(&entry, value);
+}
+
+VlogFetcher::VlogFetcher(const Options& options, const std::string& fname) {
+  Status s;
+  if (!options.use_direct_io_for_vlog ||
+      !options.env->NewDirectRandomAccessFile(fname, &file_).ok()) {
+    s = options.env->NewNonMmapRandomAccessFile(fname, &file_);
+  }
   assert(s.ok());
 }
 
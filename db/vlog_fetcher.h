@@ -26,13 +26,25 @@ class VlogManager;
 
 class VlogFetcher {
  public:
-  VlogFetcher(const std::string& dbname, const Options& options,
-              uint32_t log_number);
+  // Read the vlog file "fname".
+  VlogFetcher(const Options& options, const std::string& fname);
 
   ~VlogFetcher();
 
   Status Get(uint64_t offset, uint64_t size, std::string* value);
 
+  // Returns true if all the vlog bytes before "offset" have been written
+  // to the file.  Once true, it stays true.
+  bool Flushed(uint64_t offset);
+
+  // Perform the reads of vlog bytes reqs[0,n-1] from the file, bypassing
+  // the write buffer.  The reads may be in flight at the same time.
+  // REQUIRES: Flushed(req.offset + req.n) for each request
+  void MultiRead(RandomAccessFile::ReadRequest* reqs, size_t n);
+
+  // Decode the value of the vlog entry "entry" into *value.
+  static Status ParseValue(Slice entry, std::string* value);
+
   friend class VlogManager;
 
  private:
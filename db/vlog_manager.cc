@@ -1,93 +1,694 @@
 
 #include "db/vlog_manager.h"
 
+#include "db/prefetch_executor.h"
 #include "db/vlog_reader.h"
+#include <algorithm>
+
+#include "leveldb/cache.h"
 
 #include "util/coding.h"
+#include "util/mutexlock.h"
 
 #include "filename.h"
 
 namespace leveldb {
 namespace vlog {
 
-VlogManager::VlogManager(uint64_t clean_threshold)
-    : clean_threshold_(clean_threshold), cur_vlog_(0) {}
+int PartitionOf(const Options& options, const Slice& user_key) {
+  for (size_t i = 0; i < options.vlog_partitions.size(); i++) {
+    if (user_key.starts_with(options.vlog_partitions[i].prefix)) {
+      return static_cast<int>(i) + 1;
+    }
+  }
+  return 0;
+}
+
+uint64_t MaxVlogSize(const Options& options, int partition) {
+  if (partition > 0 && options.vlog_partitions[partition - 1].max_vlog_size) {
+    return options.vlog_partitions[partition - 1].max_vlog_size;
+  }
+  return options.max_vlog_size;
+}
+
+uint64_t CleanThreshold(const Options& options, int partition) {
+  if (partition > 0 &&
+      options.vlog_partitions[partition - 1].clean_threshold) {
+    return options.vlog_partitions[partition - 1].clean_threshold;
+  }
+  return options.clean_threshold;
+}
+
+VlogManager::VlogManager(uint64_t clean_threshold, Cache* value_cache)
+    : clean_threshold_(clean_threshold),
+      value_cache_(value_cache),
+      value_cache_id_(value_cache != nullptr ? value_cache->NewId() : 0),
+      value_cache_hits_(0),
+      value_cache_misses_(0) {}
 
 VlogManager::~VlogManager() {
   for (auto& it : manager_) {
-    if (it.first == cur_vlog_) {
-      it.second->vlog_write_->dest_->SyncedAppend(
-          Slice(it.second->buffer_, it.second->size_));
-    }
-    delete it.second->vlog_fetch_;
-    delete it.second->vlog_write_->dest_;
+    // Deleting the writer writes out the records still buffered.
+    WritableFile* dest = it.second->vlog_write_->dest_;
     delete it.second->vlog_write_;
+    delete dest;
+    delete it.second->vlog_fetch_;
     delete it.second;
   }
 }
 
+// Open the vlog "fname" for writing from "offset" on with direct I/O.
+// Returns false if options.use_direct_io_for_vlog is not set or the Env can
+// not do direct I/O on the file, and the caller should use buffered I/O.
+static bool OpenDirectVlogFile(const Options& options, const std::string& fname,
+                               uint64_t offset, WritableFile** dest) {
+  return options.use_direct_io_for_vlog &&
+         options.env->NewDirectWritableFileAt(fname, offset, dest).ok();
+}
+
+// Create the file of a new vlog, with space for "max_size" bytes allocated
+// if options.preallocate_vlog is set.
+static Status NewVlogFile(const Options& options, const std::string& fname,
+                          uint64_t max_size, WritableFile** dest) {
+  if (OpenDirectVlogFile(options, fname, 0, dest)) {
+    if (options.preallocate_vlog) {
+      (*dest)->Allocate(0, max_size,
+                        options.vlog_preallocate_keep_size);
+    }
+    return Status::OK();
+  }
+  if (options.preallocate_vlog) {
+    Status s = options.vlog_preallocate_keep_size
+                   ? options.env->NewAppendableFile(fname, dest)
+                   : options.env->NewWritableFileAt(fname, 0, dest);
+    if (s.ok()) {
+      // Without the space allocated, the file grows as it is written.
+      (*dest)->Allocate(0, max_size,
+                        options.vlog_preallocate_keep_size);
+      return s;
+    }
+  }
+  return options.env->NewAppendableFile(fname, dest);
+}
+
 void VlogManager::AddVlog(const std::string& dbname, const Options& options,
-                          uint64_t vlog_numb) {
+                          uint64_t vlog_numb, int partition) {
+  const std::string fname = VlogFileName(dbname, vlog_numb, partition);
+  WritableFile* dest;
+  Status s;
+  // Everything already in the file is served by the fetcher, not the
+  // write buffer.
+  uint64_t file_size = 0;
+  if (options.env->GetFileSize(fname, &file_size).ok()) {
+    if (!OpenDirectVlogFile(options, fname, file_size, &dest)) {
+      s = options.env->NewAppendableFile(fname, &dest);
+    }
+  } else {
+    s = NewVlogFile(options, fname, MaxVlogSize(options, partition), &dest);
+  }
+  assert(s.ok());
+  RegisterVlog(dbname, options, vlog_numb, partition, dest, file_size);
+}
+
+Status VlogManager::RecycleVlog(const std::string& dbname,
+                                const Options& options, uint64_t old_numb,
+                                int old_partition, uint64_t vlog_numb,
+                                int partition) {
+  const std::string old_fname = VlogFileName(dbname, old_numb, old_partition);
+  uint64_t file_size = 0;
+  WritableFile* dest = nullptr;
+  Status s = options.env->GetFileSize(old_fname, &file_size);
+  if (s.ok() && !OpenDirectVlogFile(options, old_fname, 0, &dest)) {
+    s = options.env->NewWritableFileAt(old_fname, 0, &dest);
+  }
+  if (s.ok()) {
+    // Recovery reads up to the first zero header, so no old record may
+    // survive under the new name.
+    s = dest->Allocate(0,
+                       std::max(file_size, MaxVlogSize(options, partition)),
+                       false /*keep_size*/);
+    if (s.ok()) {
+      s = dest->Sync();
+    }
+  }
+  if (s.ok()) {
+    s = options.env->RenameFile(old_fname,
+                                VlogFileName(dbname, vlog_numb, partition));
+  }
+  if (!s.ok()) {
+    delete dest;
+    return s;
+  }
+  RegisterVlog(dbname, options, vlog_numb, partition, dest, 0);
+  return s;
+}
+
+void VlogManager::RegisterVlog(const std::string& dbname,
+                               const Options& options, uint64_t vlog_numb,
+                               int partition, WritableFile* dest,
+                               uint64_t head) {
+  WLock l(&mutex_);
   VlogInfo* old = manager_[vlog_numb];
   if (old != nullptr) {
-    old->vlog_write_->dest_->SyncedAppend(Slice(old->buffer_, old->size_));
+    old->vlog_write_->Flush();
+  }
+  if (cur_vlogs_.size() <= static_cast<size_t>(partition)) {
+    cur_vlogs_.resize(partition + 1, 0);
+  }
+  // Records buffered for the previous current vlog must reach its file,
+  // since nothing will be appended to it any more.
+  std::map<uint64_t, VlogInfo*>::const_iterator prev =
+      manager_.find(cur_vlogs_[partition]);
+  if (prev != manager_.end() && prev->second != nullptr &&
+      prev->second != old) {
+    prev->second->vlog_write_->Flush();
   }
   VlogInfo* v = new VlogInfo;
-  v->vlog_write_ = new VWriter;
-  Status s = options.env->NewAppendableFile(LogFileName(dbname, vlog_numb),
-                                            &v->vlog_write_->dest_);
-  assert(s.ok());
+  v->vlog_write_ = new VWriter(dest, options.vlog_write_buffer_size);
+  v->head_ = head;
+  v->partition_ = partition;
   // VlogFetcher must initialize after WritableFile is created;
-  v->vlog_fetch_ = new VlogFetcher(dbname, options, vlog_numb);
+  v->vlog_fetch_ =
+      new VlogFetcher(options, VlogFileName(dbname, vlog_numb, partition));
   v->vlog_write_->my_info_ = v;
+  v->vlog_write_->SetOffset(v->head_);
   v->vlog_fetch_->my_info_ = v;
-  v->count_ = 0;
   manager_[vlog_numb] = v;
-  cur_vlog_ = vlog_numb;
+  cur_vlogs_[partition] = vlog_numb;
+}
+
+void VlogManager::RemoveVlog(uint64_t vlog_numb) {
+  WLock l(&mutex_);
+  std::map<uint64_t, VlogInfo*>::iterator iter = manager_.find(vlog_numb);
+  if (iter == manager_.end()) {
+    return;
+  }
+  VlogInfo* v = iter->second;
+  assert(v == nullptr || vlog_numb != cur_vlogs_[v->partition_]);
+  manager_.erase(iter);
+  if (v != nullptr) {
+    WritableFile* dest = v->vlog_write_->dest_;
+    delete v->vlog_write_;
+    delete dest;
+    delete v->vlog_fetch_;
+    delete v;
+  }
 }
 
-void VlogManager::SetCurrentVlog(uint64_t vlog_numb) { cur_vlog_ = vlog_numb; }
+void VlogManager::GetVlogNumbers(std::vector<uint64_t>* numbers) {
+  RLock l(&mutex_);
+  numbers->clear();
+  for (const auto& it : manager_) {
+    if (it.second != nullptr) {
+      numbers->push_back(it.first);
+    }
+  }
+}
 
-Status VlogManager::FetchValueFromVlog(Slice addr, std::string* value) {
-  Status s;
-  uint64_t file_numb, offset, size;
-  // address is <vlog_number, vlog_offset, size>
-  if (!GetVarint64(&addr, &file_numb))
+int VlogManager::GetVlogPartition(uint64_t vlog_numb) {
+  RLock l(&mutex_);
+  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(vlog_numb);
+  if (iter == manager_.end() || iter->second == nullptr) {
+    return -1;
+  }
+  return iter->second->partition_;
+}
+
+uint64_t VlogManager::GetVlogSize(uint64_t vlog_numb) {
+  RLock l(&mutex_);
+  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(vlog_numb);
+  if (iter == manager_.end() || iter->second == nullptr) {
+    return 0;
+  }
+  return iter->second->vlog_write_->Size();
+}
+
+void VlogManager::AddGarbage(uint64_t vlog_numb, uint64_t count,
+                             uint64_t bytes) {
+  WLock l(&mutex_);
+  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(vlog_numb);
+  if (iter != manager_.end() && iter->second != nullptr) {
+    iter->second->count_ += count;
+    iter->second->garbage_ += bytes;
+  }
+}
+
+void VlogManager::ClearGarbage(uint64_t vlog_numb) {
+  WLock l(&mutex_);
+  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(vlog_numb);
+  if (iter != manager_.end() && iter->second != nullptr) {
+    iter->second->count_ = 0;
+    iter->second->garbage_ = 0;
+  }
+}
+
+void VlogManager::GetGarbage(uint64_t vlog_numb, uint64_t* count,
+                             uint64_t* bytes) {
+  RLock l(&mutex_);
+  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(vlog_numb);
+  if (iter != manager_.end() && iter->second != nullptr) {
+    *count = iter->second->count_;
+    *bytes = iter->second->garbage_;
+  } else {
+    *count = 0;
+    *bytes = 0;
+  }
+}
+
+void VlogManager::EncodeGarbageTo(std::string* dst) {
+  RLock l(&mutex_);
+  for (const auto& it : manager_) {
+    if (it.second != nullptr && it.second->count_ > 0) {
+      PutVarint64(dst, it.first);
+      PutVarint64(dst, it.second->count_);
+      PutVarint64(dst, it.second->garbage_);
+    }
+  }
+}
+
+Status VlogManager::DecodeGarbageFrom(Slice input) {
+  WLock l(&mutex_);
+  uint64_t vlog_numb, count, bytes;
+  while (!input.empty()) {
+    if (!GetVarint64(&input, &vlog_numb) || !GetVarint64(&input, &count) ||
+        !GetVarint64(&input, &bytes)) {
+      return Status::Corruption("bad vlog garbage table");
+    }
+    std::map<uint64_t, VlogInfo*>::const_iterator iter =
+        manager_.find(vlog_numb);
+    if (iter != manager_.end() && iter->second != nullptr) {
+      iter->second->count_ = count;
+      iter->second->garbage_ = bytes;
+    }
+  }
+  return Status::OK();
+}
+
+void VlogManager::SetCurrentVlog(uint64_t vlog_numb) {
+  WLock l(&mutex_);
+  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(vlog_numb);
+  assert(iter != manager_.end() && iter->second != nullptr);
+  cur_vlogs_[iter->second->partition_] = vlog_numb;
+}
+
+static void DeleteCachedValue(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
+// address is <vlog_number, vlog_offset, size>
+static Status DecodeAddress(Slice addr, uint64_t* file_numb, uint64_t* offset,
+                            uint64_t* size) {
+  if (!GetVarint64(&addr, file_numb))
     return Status::Corruption("parse size false in RealValue");
-  if (!GetVarint64(&addr, &offset))
+  if (!GetVarint64(&addr, offset))
     return Status::Corruption("parse file_numb false in RealValue");
-  if (!GetVarint64(&addr, &size))
+  if (!GetVarint64(&addr, size))
     return Status::Corruption("parse pos false in RealValue");
+  return Status::OK();
+}
 
-  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(file_numb);
-  if (iter == manager_.end() || iter->second->vlog_fetch_ == nullptr) {
+VlogFetcher* VlogManager::FindFetcher(uint64_t vlog_numb) {
+  // A vlog is only removed once no reader can hold an address into it,
+  // so the fetcher stays valid after the lock is released.
+  RLock l(&mutex_);
+  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(vlog_numb);
+  if (iter != manager_.end() && iter->second != nullptr) {
+    return iter->second->vlog_fetch_;
+  }
+  return nullptr;
+}
+
+// Vlog numbers are never reused, so a cached value can not go stale.
+bool VlogManager::LookupValueCache(uint64_t vlog_numb, uint64_t offset,
+                                   std::string* value) {
+  if (value_cache_ == nullptr) {
+    return false;
+  }
+  char cache_key_buffer[24];
+  EncodeFixed64(cache_key_buffer, value_cache_id_);
+  EncodeFixed64(cache_key_buffer + 8, vlog_numb);
+  EncodeFixed64(cache_key_buffer + 16, offset);
+  Cache::Handle* handle =
+      value_cache_->Lookup(Slice(cache_key_buffer, sizeof(cache_key_buffer)));
+  if (handle == nullptr) {
+    value_cache_misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  value->assign(*reinterpret_cast<std::string*>(value_cache_->Value(handle)));
+  value_cache_->Release(handle);
+  value_cache_hits_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void VlogManager::InsertValueCache(uint64_t vlog_numb, uint64_t offset,
+                                   const std::string& value) {
+  if (value_cache_ == nullptr) {
+    return;
+  }
+  char cache_key_buffer[24];
+  EncodeFixed64(cache_key_buffer, value_cache_id_);
+  EncodeFixed64(cache_key_buffer + 8, vlog_numb);
+  EncodeFixed64(cache_key_buffer + 16, offset);
+  std::string* cached = new std::string(value);
+  value_cache_->Release(
+      value_cache_->Insert(Slice(cache_key_buffer, sizeof(cache_key_buffer)),
+                           cached, cached->size(), &DeleteCachedValue));
+}
+
+Status VlogManager::FetchValueFromVlog(Slice addr, std::string* value) {
+  uint64_t file_numb, offset, size;
+  Status s = DecodeAddress(addr, &file_numb, &offset, &size);
+  if (!s.ok() || LookupValueCache(file_numb, offset, value)) {
+    return s;
+  }
+
+  VlogFetcher* cache = FindFetcher(file_numb);
+  if (cache == nullptr) {
     s = Status::Corruption("can not find vlog");
   } else {
-    VlogFetcher* cache = iter->second->vlog_fetch_;
     s = cache->Get(offset, size, value);
   }
+  if (s.ok()) {
+    InsertValueCache(file_numb, offset, *value);
+  }
 
   return s;
 }
-Status VlogManager::AddRecord(const Slice& slice) {
-  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(cur_vlog_);
+
+namespace {
+
+// Reads of values that are at most this many bytes apart in a vlog are
+// merged into one read.
+const uint64_t kMaxCoalesceGap = 4096;
+
+// Upper bound of the bytes covered by a merged read.
+const uint64_t kMaxCoalescedRead = 1 << 20;
+
+// Upper bound of the executor threads that help a single
+// FetchValuesFromVlog() call.
+const size_t kMaxReadHelpers = 16;
+
+}  // namespace
+
+struct VlogManager::PendingFetch {
+  uint64_t file_numb;
+  uint64_t offset;
+  uint64_t size;
+  size_t index;  // Index into the caller's arrays
+
+  bool operator<(const PendingFetch& other) const {
+    if (file_numb != other.file_numb) {
+      return file_numb < other.file_numb;
+    }
+    return offset < other.offset;
+  }
+};
+
+// State shared by the threads that read the runs of one
+// FetchValuesFromVlog() call.  The runs are split into shares of about the
+// same size, and each thread claims the next unread share until none is
+// left.
+struct VlogManager::ParallelReads {
+  ParallelReads(VlogManager* m, const PendingFetch* p,
+                const std::vector<size_t>* r, size_t shares,
+                std::string* const* v, Status* s)
+      : manager(m),
+        pending(p),
+        runs(r),
+        num_shares(shares),
+        values(v),
+        statuses(s),
+        next_share(0),
+        done_cv(&mu),
+        helpers(0) {}
+
+  void Work() {
+    const size_t num_runs = runs->size() - 1;
+    size_t share;
+    while ((share = next_share.fetch_add(1, std::memory_order_relaxed)) <
+           num_shares) {
+      manager->ReadRuns(pending, runs->data(), share * num_runs / num_shares,
+                        (share + 1) * num_runs / num_shares, values, statuses);
+    }
+  }
+
+  static void Help(void* arg) {
+    ParallelReads* reads = reinterpret_cast<ParallelReads*>(arg);
+    reads->Work();
+    MutexLock l(&reads->mu);
+    if (--reads->helpers == 0) {
+      reads->done_cv.Signal();
+    }
+  }
+
+  VlogManager* const manager;
+  const PendingFetch* const pending;
+  const std::vector<size_t>* const runs;
+  const size_t num_shares;
+  std::string* const* const values;
+  Status* const statuses;
+  std::atomic<size_t> next_share;
+
+  port::Mutex mu;
+  port::CondVar done_cv;
+  size_t helpers GUARDED_BY(mu);  // Helper tasks that have not finished
+};
+
+void VlogManager::FetchValuesFromVlog(size_t n, const Slice* addrs,
+                                      std::string* const* values,
+                                      Status* statuses,
+                                      PrefetchExecutor* executor) {
+  std::vector<PendingFetch> pending;
+  pending.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    PendingFetch f;
+    f.index = i;
+    statuses[i] = DecodeAddress(addrs[i], &f.file_numb, &f.offset, &f.size);
+    if (statuses[i].ok() &&
+        !LookupValueCache(f.file_numb, f.offset, values[i])) {
+      pending.push_back(f);
+    }
+  }
+  if (pending.empty()) {
+    return;
+  }
+  std::sort(pending.begin(), pending.end());
+
+  // Split pending into runs of values that lie close after each other in
+  // the same vlog.  Run r is pending[runs[r], runs[r+1]).
+  std::vector<size_t> runs;
+  size_t i = 0;
+  while (i < pending.size()) {
+    runs.push_back(i);
+    const uint64_t start = pending[i].offset;
+    uint64_t limit = start + pending[i].size;
+    size_t j = i + 1;
+    while (j < pending.size() && pending[j].file_numb == pending[i].file_numb &&
+           pending[j].offset <= limit + kMaxCoalesceGap &&
+           pending[j].offset + pending[j].size - start <= kMaxCoalescedRead) {
+      limit = std::max(limit, pending[j].offset + pending[j].size);
+      j++;
+    }
+    i = j;
+  }
+  runs.push_back(pending.size());
+
+  const size_t num_runs = runs.size() - 1;
+  if (executor == nullptr || num_runs == 1) {
+    ReadRuns(pending.data(), runs.data(), 0, num_runs, values, statuses);
+    return;
+  }
+
+  const size_t helpers = std::min(num_runs - 1, kMaxReadHelpers);
+  ParallelReads reads(this, pending.data(), &runs, helpers + 1, values,
+                      statuses);
+  reads.mu.Lock();
+  reads.helpers = helpers;
+  reads.mu.Unlock();
+  for (size_t h = 0; h < helpers; h++) {
+    executor->Schedule(&ParallelReads::Help, &reads);
+  }
+  reads.Work();
+  // reads lives on this stack frame, wait until no helper uses it.
+  MutexLock l(&reads.mu);
+  while (reads.helpers > 0) {
+    reads.done_cv.Wait();
+  }
+}
+
+void VlogManager::ReadRuns(const PendingFetch* pending, const size_t* runs,
+                           size_t first_run, size_t last_run,
+                           std::string* const* values, Status* statuses) {
+  std::vector<RandomAccessFile::ReadRequest> reqs;
+  std::vector<size_t> req_runs;  // The run each request reads
+  std::vector<std::string> buffers;
+  size_t r = first_run;
+  while (r < last_run) {
+    // The runs [r, e) read from the same vlog.
+    const uint64_t file_numb = pending[runs[r]].file_numb;
+    size_t e = r + 1;
+    while (e < last_run && pending[runs[e]].file_numb == file_numb) {
+      e++;
+    }
+    const PendingFetch* begin = pending + runs[r];
+    const PendingFetch* end = pending + runs[e];
+
+    VlogFetcher* fetcher = FindFetcher(file_numb);
+    if (fetcher == nullptr) {
+      for (const PendingFetch* f = begin; f != end; ++f) {
+        statuses[f->index] = Status::Corruption("can not find vlog");
+      }
+      r = e;
+      continue;
+    }
+
+    reqs.clear();
+    req_runs.clear();
+    buffers.resize(e - r);
+    for (size_t q = r; q < e; q++) {
+      const uint64_t start = pending[runs[q]].offset;
+      uint64_t limit = start;
+      for (size_t k = runs[q]; k < runs[q + 1]; k++) {
+        limit = std::max(limit, pending[k].offset + pending[k].size);
+      }
+      if (!fetcher->Flushed(limit)) {
+        // The values may still be in the write buffer.
+        for (size_t k = runs[q]; k < runs[q + 1]; k++) {
+          const PendingFetch& f = pending[k];
+          statuses[f.index] =
+              fetcher->Get(f.offset, f.size, values[f.index]);
+        }
+        continue;
+      }
+      std::string* buffer = &buffers[q - r];
+      buffer->resize(limit - start);
+      RandomAccessFile::ReadRequest req;
+      req.offset = start;
+      req.n = limit - start;
+      req.scratch = &(*buffer)[0];
+      reqs.push_back(req);
+      req_runs.push_back(q);
+    }
+
+    fetcher->MultiRead(reqs.data(), reqs.size());
+    for (size_t i = 0; i < reqs.size(); i++) {
+      const RandomAccessFile::ReadRequest& req = reqs[i];
+      const size_t q = req_runs[i];
+      for (size_t k = runs[q]; k < runs[q + 1]; k++) {
+        const PendingFetch& f = pending[k];
+        if (req.status.ok()) {
+          statuses[f.index] = VlogFetcher::ParseValue(
+              Slice(req.result.data() + (f.offset - req.offset), f.size),
+              values[f.index]);
+        } else {
+          statuses[f.index] = req.status;
+        }
+      }
+    }
+
+    for (const PendingFetch* f = begin; f != end; ++f) {
+      if (statuses[f->index].ok()) {
+        InsertValueCache(f->file_numb, f->offset, *values[f->index]);
+      }
+    }
+    r = e;
+  }
+}
+
+void VlogManager::GetValueCacheStats(uint64_t* hits, uint64_t* misses) const {
+  *hits = value_cache_hits_.load(std::memory_order_relaxed);
+  *misses = value_cache_misses_.load(std::memory_order_relaxed);
+}
+VWriter* VlogManager::CurrentWriter(int partition) {
+  RLock l(&mutex_);
+  assert(static_cast<size_t>(partition) < cur_vlogs_.size());
+  std::map<uint64_t, VlogInfo*>::const_iterator iter =
+      manager_.find(cur_vlogs_[partition]);
   assert(iter != manager_.end());
   assert(iter->second != nullptr);
-  return iter->second->vlog_write_->AddRecord(slice);
+  return iter->second->vlog_write_;
 }
+
+void VlogManager::CurrentWriters(std::vector<VWriter*>* writers) {
+  RLock l(&mutex_);
+  writers->clear();
+  for (uint64_t vlog_numb : cur_vlogs_) {
+    std::map<uint64_t, VlogInfo*>::const_iterator iter =
+        manager_.find(vlog_numb);
+    if (iter != manager_.end() && iter->second != nullptr) {
+      writers->push_back(iter->second->vlog_write_);
+    }
+  }
+}
+
+Status VlogManager::AddRecord(int partition, const Slice& slice) {
+  return CurrentWriter(partition)->AddRecord(slice);
+}
+
+Status VlogManager::ReserveRecord(int partition, size_t n, uint64_t* offset) {
+  return CurrentWriter(partition)->Reserve(n, offset);
+}
+
+Status VlogManager::FillRecord(int partition, uint64_t offset,
+                               const Slice& slice) {
+  return CurrentWriter(partition)->Fill(offset, slice);
+}
+
+Status VlogManager::WaitFilled(int partition, uint64_t end) {
+  return CurrentWriter(partition)->WaitFilled(end);
+}
+
+Status VlogManager::Flush() {
+  std::vector<VWriter*> writers;
+  CurrentWriters(&writers);
+  Status s;
+  for (size_t i = 0; i < writers.size() && s.ok(); i++) {
+    s = writers[i]->Flush();
+  }
+  return s;
+}
+
 Status VlogManager::Sync() {
-  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(cur_vlog_);
-  assert(iter != manager_.end());
-  assert(iter->second != nullptr);
-  return iter->second->vlog_write_->dest_->Sync();
+  std::vector<VWriter*> writers;
+  CurrentWriters(&writers);
+  Status s;
+  for (size_t i = 0; i < writers.size() && s.ok(); i++) {
+    s = writers[i]->Sync();
+  }
+  return s;
 }
 
-Status VlogManager::SetHead(size_t offset) {
-  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(cur_vlog_);
+Status VlogManager::SetHead(const std::string& dbname, const Options& options,
+                            int partition, size_t offset) {
+  RLock l(&mutex_);
+  const uint64_t vlog_numb = static_cast<size_t>(partition) < cur_vlogs_.size()
+                                 ? cur_vlogs_[partition]
+                                 : 0;
+  std::map<uint64_t, VlogInfo*>::const_iterator iter = manager_.find(vlog_numb);
   if (iter == manager_.end() || iter->second->vlog_fetch_ == nullptr) {
     return Status::Corruption("can not find vlog");
   } else {
-    iter->second->head_ = offset;
+    const std::string fname = VlogFileName(dbname, vlog_numb, partition);
+    uint64_t file_size = 0;
+    if (options.env->GetFileSize(fname, &file_size).ok() &&
+        file_size > offset) {
+      // The file is preallocated or padded by direct I/O: write over the
+      // space past the records instead of appending behind it.
+      WritableFile* dest;
+      if (!OpenDirectVlogFile(options, fname, offset, &dest)) {
+        Status s = options.env->NewWritableFileAt(fname, offset, &dest);
+        if (!s.ok()) {
+          return s;
+        }
+      }
+      delete iter->second->vlog_write_->dest_;
+      iter->second->vlog_write_->dest_ = dest;
+    }
+    {
+      WLock info_lock(iter->second->rwlock_);
+      iter->second->head_ = offset;
+    }
+    iter->second->vlog_write_->SetOffset(offset);
     return Status::OK();
   }
 }
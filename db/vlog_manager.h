@@ -7,32 +7,48 @@
 #include <atomic>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "port/port_stdcxx.h"
 
 namespace leveldb {
+
+class PrefetchExecutor;
+
 namespace vlog {
 // Header is checksum (4 bytes), length (8 bytes).
 static const int kVHeaderSize = 4 + 8;
 
-static const int WriteBufferSize = 1 << 12;
-
 class VlogFetcher;
 class VWriter;
 
+// Return the vlog partition that the values of "user_key" are appended to,
+// see Options::vlog_partitions.
+int PartitionOf(const Options& options, const Slice& user_key);
+
+// Return the size limit and the garbage collection threshold of the vlogs
+// of partition "partition".
+uint64_t MaxVlogSize(const Options& options, int partition);
+uint64_t CleanThreshold(const Options& options, int partition);
+
 class VlogInfo {
-  char buffer_[WriteBufferSize];
-  size_t size_;
   VlogFetcher* vlog_fetch_;
   VWriter* vlog_write_;
-  size_t head_;
+  size_t head_;  // Bytes written to the file; later ones are buffered
+  int partition_;
 
-  uint64_t count_;  //代表该vlog文件垃圾kv的数量
+  uint64_t count_;    //代表该vlog文件垃圾kv的数量
+  uint64_t garbage_;  //代表该vlog文件垃圾kv占用的字节数
 
   port::SharedMutex* rwlock_;
 
  public:
-  VlogInfo() : size_(0), head_(0), rwlock_(new port::SpinSharedMutex) {}
+  VlogInfo()
+      : head_(0),
+        partition_(0),
+        count_(0),
+        garbage_(0),
+        rwlock_(new port::SpinSharedMutex) {}
   ~VlogInfo() { delete rwlock_; }
 
   friend class VWriter;
@@ -42,27 +58,150 @@ class VlogInfo {
 
 class VlogManager {
  public:
-  explicit VlogManager(uint64_t clean_threshold);
+  // If "value_cache" is non-null, values fetched from the vlogs are cached
+  // in it.  The cache is owned by the caller.
+  VlogManager(uint64_t clean_threshold, Cache* value_cache);
   ~VlogManager();
 
+  // Register the vlog "vlog_numb" of partition "partition" and make it the
+  // current vlog of the partition, that AddRecord() appends to.  Records
+  // buffered for the previous current vlog of the partition are flushed
+  // first.  A vlog that does not exist yet is created, preallocated if
+  // options.preallocate_vlog is set.
   void AddVlog(const std::string& dbname, const Options& options,
-               uint64_t vlog_numb);
-
-  Status AddRecord(const Slice& slice);
-
-  Status SetHead(size_t offset);
-
+               uint64_t vlog_numb, int partition);
+
+  // Zero the file of the retired vlog "old_numb" of partition
+  // "old_partition", rename it to the vlog "vlog_numb" of partition
+  // "partition" and register that like AddVlog().  On failure nothing is
+  // registered and the caller should create the vlog with AddVlog().
+  Status RecycleVlog(const std::string& dbname, const Options& options,
+                     uint64_t old_numb, int old_partition, uint64_t vlog_numb,
+                     int partition);
+
+  // Forget the vlog "vlog_numb" and close its files.  The caller must make
+  // sure that no reader can still fetch a value from it.
+  void RemoveVlog(uint64_t vlog_numb);
+
+  // Store the numbers of all registered vlogs in *numbers, in ascending
+  // order.
+  void GetVlogNumbers(std::vector<uint64_t>* numbers);
+
+  // Return the partition of the vlog "vlog_numb", or -1 if it is unknown.
+  int GetVlogPartition(uint64_t vlog_numb);
+
+  // Return the number of bytes appended to the vlog "vlog_numb", including
+  // the records that are still buffered.
+  uint64_t GetVlogSize(uint64_t vlog_numb);
+
+  // Account "count" values of the vlog "vlog_numb", "bytes" in total, that
+  // compaction dropped from the LSM-tree.  Unknown vlogs are ignored.
+  void AddGarbage(uint64_t vlog_numb, uint64_t count, uint64_t bytes);
+
+  // Forget the garbage accounted to the vlog "vlog_numb".
+  void ClearGarbage(uint64_t vlog_numb);
+
+  // Return the number of garbage values of the vlog "vlog_numb" in *count
+  // and the bytes they occupy in *bytes.
+  void GetGarbage(uint64_t vlog_numb, uint64_t* count, uint64_t* bytes);
+
+  // The garbage table is persisted as VersionEdit's vlog info:
+  //    (vlog_number: varint64, count: varint64, bytes: varint64)*
+  void EncodeGarbageTo(std::string* dst);
+  Status DecodeGarbageFrom(Slice input);
+
+  Status AddRecord(int partition, const Slice& slice);
+
+  // Reserve a record of "n" bytes in the current vlog of partition
+  // "partition" and store its offset in *offset, then copy "slice" into it
+  // with FillRecord().  Records may be filled by several threads at once;
+  // WaitFilled() waits until all the records before "end" are filled.
+  // See VWriter.
+  Status ReserveRecord(int partition, size_t n, uint64_t* offset);
+  Status FillRecord(int partition, uint64_t offset, const Slice& slice);
+  Status WaitFilled(int partition, uint64_t end);
+
+  // Make "offset" the end of the current vlog of partition "partition",
+  // where the next record is appended.  Preallocated space past "offset"
+  // is overwritten.
+  Status SetHead(const std::string& dbname, const Options& options,
+                 int partition, size_t offset);
+
+  // Write the records buffered for the current vlogs to their files.
+  Status Flush();
+
+  // Sync the current vlogs of all partitions.
   Status Sync();
 
   Status FetchValueFromVlog(Slice addr, std::string* value);
 
+  // Fetch the values at the vlog addresses addrs[0,n-1] into *values[i]
+  // and store the outcome of each fetch in statuses[i].  The values are
+  // read in the order they are laid out in the vlogs, and values that lie
+  // close to each other in a vlog are read with a single file read.  If
+  // "executor" is non-null, the reads are spread over its threads and the
+  // calling thread.  Tasks running on "executor" must pass nullptr.
+  void FetchValuesFromVlog(size_t n, const Slice* addrs,
+                           std::string* const* values, Status* statuses,
+                           PrefetchExecutor* executor);
+
+  // Return the number of value cache lookups that hit and missed.
+  void GetValueCacheStats(uint64_t* hits, uint64_t* misses) const;
+
+  // Make the registered vlog "vlog_numb" the current vlog of its partition.
   void SetCurrentVlog(uint64_t vlog_numb);
 
  private:
+  struct PendingFetch;
+  struct ParallelReads;
+
+  // Read the values of the runs [first_run, last_run), where run r is
+  // pending[runs[r], runs[r+1]) and holds values that lie close to each
+  // other in one vlog.  The runs of a vlog are read in a single MultiRead().
+  void ReadRuns(const PendingFetch* pending, const size_t* runs,
+                size_t first_run, size_t last_run, std::string* const* values,
+                Status* statuses);
+
+  // Register the vlog "vlog_numb" of partition "partition", whose records
+  // end at "head" and are appended through "dest", and make it the current
+  // vlog of the partition.
+  void RegisterVlog(const std::string& dbname, const Options& options,
+                    uint64_t vlog_numb, int partition, WritableFile* dest,
+                    uint64_t head);
+
+  // Returns the writer of the current vlog of partition "partition".  The
+  // writers wait without holding mutex_, so that filling records never
+  // waits for a thread that wants to change manager_.
+  VWriter* CurrentWriter(int partition);
+
+  // Returns the writers of the current vlogs of all partitions.
+  void CurrentWriters(std::vector<VWriter*>* writers);
+
+  // Returns the fetcher of the vlog "vlog_numb", or nullptr if the vlog
+  // is unknown.
+  VlogFetcher* FindFetcher(uint64_t vlog_numb);
+
+  // Value cache helpers.  Lookup returns true and stores the value in
+  // *value on a hit.
+  bool LookupValueCache(uint64_t vlog_numb, uint64_t offset,
+                        std::string* value);
+  void InsertValueCache(uint64_t vlog_numb, uint64_t offset,
+                        const std::string& value);
+
+  // Protects the structure of manager_.  Readers fetch values concurrently
+  // with the writer that appends records and the thread that adds or
+  // removes vlogs.
+  port::SpinSharedMutex mutex_;
   std::map<uint64_t, VlogInfo*> manager_;
   std::set<uint64_t> cleaning_vlog_set_;
   uint64_t clean_threshold_;
-  uint64_t cur_vlog_;
+  // Partition -> its current vlog, 0 if it has none yet.
+  std::vector<uint64_t> cur_vlogs_;
+
+  Cache* const value_cache_;
+  const uint64_t value_cache_id_;
+  std::atomic<uint64_t> value_cache_hits_;
+  std::atomic<uint64_t> value_cache_misses_;
 };
 
 }  // namespace vlog
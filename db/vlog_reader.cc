@@ -69,11 +69,18 @@ bool VReader::ReadRecord(Slice* record, std::string* scratch) {
   }
   //解析头部
   uint64_t length = 0;
-  uint32_t expected_crc = crc32c::Unmask(DecodeFixed32(
-      buffer_.data()));  //早一点解析出crc,因为后面可能buffer_.data内容会变
+  const uint32_t masked_crc = DecodeFixed32(buffer_.data());
+  uint32_t expected_crc = crc32c::Unmask(
+      masked_crc);  //早一点解析出crc,因为后面可能buffer_.data内容会变
   buffer_.remove_prefix(4);
   length = DecodeFixed64(buffer_.data());
   buffer_.remove_prefix(8);
+  if (masked_crc == 0 && length == 0) {
+    // 全0的头部不是记录，而是预分配的vlog文件中数据的末尾
+    buffer_.clear();
+    eof_ = true;
+    return false;
+  }
   if (length <= buffer_.size()) {
     //逻辑记录完整的在buffer中(在block中)
     if (checksum_) {
@@ -5,61 +5,290 @@
 #include "db/vlog_writer.h"
 
 #include "db/vlog_manager.h"
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 
 #include "leveldb/env.h"
 
 #include "util/coding.h"
 #include "util/crc32c.h"
+#include "util/mutexlock.h"
 
 #include "dbformat.h"
 
 namespace leveldb {
 namespace vlog {
 
-VWriter::VWriter(WritableFile* dest) : dest_(dest) {}
+// A record too large for the buffer, written by the flusher straight from
+// the memory of the thread that fills it.
+struct VWriter::DirectRecord {
+  char header[kVHeaderSize];
+  Slice payload;
+};
 
-VWriter::~VWriter() = default;
+static void EncodeHeader(const Slice& slice, char* header) {
+  uint32_t crc = crc32c::Extend(0, slice.data(), slice.size());
+  crc = crc32c::Mask(crc);  // Adjust for storage
+  EncodeFixed32(header, crc);
+  EncodeFixed64(&header[4], slice.size());
+}
+
+VWriter::VWriter(WritableFile* dest, size_t buffer_size)
+    : my_info_(nullptr),
+      dest_(dest),
+      capacity_(buffer_size),
+      flush_bytes_(buffer_size / 2),
+      buf_(nullptr),
+      reserved_(0),
+      flushed_(0),
+      cv_(&mu_),
+      flush_cv_(&mu_),
+      waiters_(0),
+      published_(0),
+      flush_requested_(0),
+      sync_requested_(0),
+      synced_(0),
+      stop_(false) {}
+
+VWriter::~VWriter() {
+  if (flusher_.joinable()) {
+    {
+      MutexLock l(&mu_);
+      stop_ = true;
+      flush_cv_.Signal();
+    }
+    flusher_.join();
+  }
+  delete[] buf_;
+}
+
+void VWriter::SetOffset(uint64_t offset) {
+  MutexLock l(&mu_);
+  assert(reserved_.load(std::memory_order_relaxed) == published_);
+  reserved_.store(offset, std::memory_order_relaxed);
+  flushed_.store(offset, std::memory_order_relaxed);
+  published_ = offset;
+  flush_requested_ = offset;
+  sync_requested_ = offset;
+  synced_ = offset;
+}
+
+void VWriter::StartFlusher() {
+  buf_ = new char[capacity_];
+  flusher_ = std::thread(&VWriter::FlusherLoop, this);
+}
+
+void VWriter::RequestFlush(uint64_t end) {
+  mu_.AssertHeld();
+  if (flush_requested_ < end) {
+    flush_requested_ = end;
+    flush_cv_.Signal();
+  }
+}
+
+void VWriter::Wait() {
+  mu_.AssertHeld();
+  waiters_++;
+  cv_.Wait();
+  waiters_--;
+}
 
 Status VWriter::AddRecord(const Slice& slice) {
-  const char* ptr = slice.data();
-  size_t left = slice.size();
-  char head[kVHeaderSize];
-  uint32_t crc = crc32c::Extend(0, ptr, left);
-  crc = crc32c::Mask(crc);  // Adjust for storage
-  EncodeFixed32(head, crc);
-  EncodeFixed64(&head[4], left);
+  uint64_t offset;
+  Status s = Reserve(slice.size(), &offset);
+  if (s.ok()) {
+    s = Fill(offset, slice);
+  }
+  return s;
+}
 
-  Status s;
+Status VWriter::Reserve(size_t n, uint64_t* offset) {
+  std::call_once(start_once_, &VWriter::StartFlusher, this);
+  // Waiting here for the flusher could deadlock: it needs the records
+  // before this one, which may be filled only after the caller returns.
+  *offset = reserved_.fetch_add(kVHeaderSize + n, std::memory_order_relaxed);
+  return Status::OK();
+}
+
+void VWriter::CopyIn(uint64_t offset, const char* data, size_t n) {
+  const size_t pos = offset % capacity_;
+  const size_t first = std::min(n, capacity_ - pos);
+  std::memcpy(buf_ + pos, data, first);
+  std::memcpy(buf_, data + first, n - first);
+}
 
-  if (my_info_->size_ + kVHeaderSize + left > WriteBufferSize) {
-    WLock l(my_info_->rwlock_);
-    if (!(s = dest_->SyncedAppend(Slice(my_info_->buffer_, my_info_->size_)))
-             .ok()) {
-      return s;
+void VWriter::ReadBuffered(uint64_t offset, size_t n, char* dst) const {
+  const size_t pos = offset % capacity_;
+  const size_t first = std::min(n, capacity_ - pos);
+  std::memcpy(dst, buf_ + pos, first);
+  std::memcpy(dst + first, buf_, n - first);
+}
+
+Status VWriter::Fill(uint64_t offset, const Slice& slice) {
+  const uint64_t end = offset + kVHeaderSize + slice.size();
+  if (end > flushed_.load(std::memory_order_acquire) + capacity_) {
+    // The record is larger than the buffer, or its part of the buffer
+    // still holds records that are not written.
+    DirectRecord record;
+    EncodeHeader(slice, record.header);
+    record.payload = slice;
+    {
+      MutexLock l(&mu_);
+      direct_[offset] = &record;
+      Publish(offset, end);
     }
-    my_info_->head_ += my_info_->size_;
-    my_info_->size_ = 0;
-    if (kVHeaderSize + left > WriteBufferSize) {
-      s = dest_->SyncedAppend(Slice(head, kVHeaderSize));
-      my_info_->head_ += kVHeaderSize;
-      s = dest_->SyncedAppend(Slice(ptr, left));
-      my_info_->head_ += left;
-    } else {
-      memcpy(my_info_->buffer_ + my_info_->size_, head, kVHeaderSize);
-      my_info_->size_ += kVHeaderSize;
-      memcpy(my_info_->buffer_ + my_info_->size_, ptr, left);
-      my_info_->size_ += left;
+    return WaitFlushed(end, false);
+  }
+
+  char header[kVHeaderSize];
+  EncodeHeader(slice, header);
+  CopyIn(offset, header, kVHeaderSize);
+  CopyIn(offset + kVHeaderSize, slice.data(), slice.size());
+  MutexLock l(&mu_);
+  Publish(offset, end);
+  return status_;
+}
+
+void VWriter::Publish(uint64_t offset, uint64_t end) {
+  mu_.AssertHeld();
+  if (offset != published_) {
+    filled_[offset] = end;
+    return;
+  }
+  published_ = end;
+  std::map<uint64_t, uint64_t>::iterator iter = filled_.begin();
+  while (iter != filled_.end() && iter->first == published_) {
+    published_ = iter->second;
+    iter = filled_.erase(iter);
+  }
+  const uint64_t flushed = flushed_.load(std::memory_order_relaxed);
+  if (published_ - flushed >= flush_bytes_ || flush_requested_ > flushed) {
+    flush_cv_.Signal();
+  }
+  if (waiters_ > 0) {
+    cv_.SignalAll();
+  }
+}
+
+Status VWriter::WaitFilled(uint64_t end) {
+  MutexLock l(&mu_);
+  while (status_.ok() && published_ < end) {
+    Wait();
+  }
+  return status_;
+}
+
+Status VWriter::WaitFlushed(uint64_t end, bool sync) {
+  MutexLock l(&mu_);
+  RequestFlush(end);
+  if (sync && sync_requested_ < end) {
+    sync_requested_ = end;
+    flush_cv_.Signal();
+  }
+  while (status_.ok() &&
+         (sync ? synced_ : flushed_.load(std::memory_order_relaxed)) < end) {
+    Wait();
+  }
+  return status_;
+}
+
+Status VWriter::Flush() {
+  uint64_t end;
+  {
+    MutexLock l(&mu_);
+    end = published_;
+    if (end <= flushed_.load(std::memory_order_relaxed)) {
+      return status_;
     }
-    return s;
   }
+  return WaitFlushed(end, false);
+}
 
-  memcpy(my_info_->buffer_ + my_info_->size_, head, kVHeaderSize);
-  my_info_->size_ += kVHeaderSize;
-  memcpy(my_info_->buffer_ + my_info_->size_, ptr, left);
-  my_info_->size_ += left;
+Status VWriter::Sync() {
+  std::call_once(start_once_, &VWriter::StartFlusher, this);
+  uint64_t end;
+  {
+    MutexLock l(&mu_);
+    end = published_;
+  }
+  return WaitFlushed(end, true);
+}
 
-  return s;
+uint64_t VWriter::Size() {
+  MutexLock l(&mu_);
+  return published_;
+}
+
+void VWriter::FlusherLoop() {
+  MutexLock l(&mu_);
+  while (true) {
+    const uint64_t flushed = flushed_.load(std::memory_order_relaxed);
+    if (status_.ok() && published_ > flushed &&
+        (published_ - flushed >= flush_bytes_ || flush_requested_ > flushed ||
+         stop_)) {
+      // Write everything filled so far, up to the next direct record, or
+      // the direct record itself.
+      uint64_t end = published_;
+      DirectRecord* direct = nullptr;
+      std::map<uint64_t, DirectRecord*>::iterator iter =
+          direct_.lower_bound(flushed);
+      if (iter != direct_.end() && iter->first < end) {
+        if (iter->first == flushed) {
+          direct = iter->second;
+          end = flushed + kVHeaderSize + direct->payload.size();
+          direct_.erase(iter);
+        } else {
+          end = iter->first;
+        }
+      }
+      mu_.Unlock();
+      Slice pieces[2];
+      size_t num_pieces = 2;
+      if (direct != nullptr) {
+        pieces[0] = Slice(direct->header, kVHeaderSize);
+        pieces[1] = direct->payload;
+      } else {
+        // The filled region may wrap around the end of the buffer.
+        const size_t pos = flushed % capacity_;
+        const size_t n = end - flushed;
+        const size_t first = std::min(n, capacity_ - pos);
+        pieces[0] = Slice(buf_ + pos, first);
+        pieces[1] = Slice(buf_, n - first);
+        num_pieces = (n > first) ? 2 : 1;
+      }
+      Status s = dest_->SyncedAppendv(pieces, num_pieces);
+      if (s.ok()) {
+        WLock info_lock(my_info_->rwlock_);
+        my_info_->head_ = end;
+        flushed_.store(end, std::memory_order_release);
+      }
+      mu_.Lock();
+      if (!s.ok()) {
+        status_ = s;
+      }
+      if (waiters_ > 0) {
+        cv_.SignalAll();
+      }
+    } else if (status_.ok() && sync_requested_ > synced_ &&
+               flushed >= sync_requested_) {
+      mu_.Unlock();
+      Status s = dest_->Sync();
+      mu_.Lock();
+      if (s.ok()) {
+        synced_ = flushed;
+      } else {
+        status_ = s;
+      }
+      if (waiters_ > 0) {
+        cv_.SignalAll();
+      }
+    } else if (stop_ && (!status_.ok() || published_ == flushed)) {
+      break;
+    } else {
+      flush_cv_.Wait();
+    }
+  }
 }
 
 }  // namespace vlog
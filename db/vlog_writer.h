@@ -7,11 +7,18 @@
 
 #include "db/log_format.h"
 #include "db/vlog_manager.h"
+#include <atomic>
 #include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
 
 #include "leveldb/slice.h"
 #include "leveldb/status.h"
 
+#include "port/port.h"
+#include "port/thread_annotations.h"
+
 namespace leveldb {
 
 class WritableFile;
@@ -20,27 +27,112 @@ class VlogManager;
 
 namespace vlog {
 
+class VlogInfo;
+
+// Appends records to a vlog through a ring buffer.  Appending a record
+// takes two steps: Reserve() hands out the offset of the record, and
+// Fill() copies and checksums it into the buffer.  Any number of threads
+// may fill their reserved records at the same time, in any order.  A
+// flusher thread writes the contiguous prefix of filled records to the
+// file with large writes, so appending does not wait for the file.  The
+// flusher writes once half of the buffer is filled, so that writers can
+// fill one half while the other is written, or when a caller waits for
+// the file.
+//
+// Records that do not fit in the buffer, or that would overwrite records
+// not written yet, are written by the flusher directly from the caller's
+// memory, and Fill() waits for that.
 class VWriter {
  public:
-  // Create a writer that will append data to "*dest".
-  // "*dest" must be initially empty.
+  // Create a writer that will append data to "*dest" through a buffer of
+  // "buffer_size" bytes.
   // "*dest" must remain live while this Writer is in use.
-  explicit VWriter(WritableFile* dest);
+  VWriter(WritableFile* dest, size_t buffer_size);
+
+  VWriter(const VWriter&) = delete;
+  VWriter& operator=(const VWriter&) = delete;
 
+  // Writes the filled records to the file and stops the flusher.
   ~VWriter();
 
+  // Reserve() and Fill() a record in one go.
   Status AddRecord(const Slice& slice);
 
+  // Reserve room for a record of "n" bytes and store its vlog offset in
+  // *offset.  The record starts with a kVHeaderSize header, so its payload
+  // is at *offset + kVHeaderSize.  Does not wait for the flusher.
+  // Thread-safe.
+  Status Reserve(size_t n, uint64_t* offset);
+
+  // Copy "slice", which must have the size given to Reserve(), into the
+  // record reserved at "offset" and make it available to the flusher.
+  // Thread-safe.
+  Status Fill(uint64_t offset, const Slice& slice);
+
+  // Wait until all the records before "end" are filled.
+  Status WaitFilled(uint64_t end);
+
+  // Wait until the records filled so far are written to the file.
+  Status Flush();
+
+  // Wait until the records filled so far are written to the file and
+  // synced.  The flusher syncs once for all the callers waiting at the
+  // time, and everything written before the sync is covered by it.
+  Status Sync();
+
+  // Return the end of the records filled so far.
+  uint64_t Size();
+
+  // Copy "n" vlog bytes at "offset" out of the buffer into "dst".
+  // REQUIRES: my_info_->rwlock_ is held and offset >= my_info_->head_.
+  void ReadBuffered(uint64_t offset, size_t n, char* dst) const;
+
   friend class VlogManager;
 
  private:
-  VWriter() = default;
+  struct DirectRecord;
+
+  // Make "offset" the position of the next record.  Only used before the
+  // first record is reserved.
+  void SetOffset(uint64_t offset);
+
+  void StartFlusher();
+  void FlusherLoop();
+  void CopyIn(uint64_t offset, const char* data, size_t n);
+  void Publish(uint64_t offset, uint64_t end) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // Ask the flusher to write at least the bytes before "end".
+  void RequestFlush(uint64_t end) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // Wait for progress of the flusher or of the fills.
+  void Wait() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // Wait until "end" is written to the file (and synced if "sync").
+  Status WaitFlushed(uint64_t end, bool sync);
 
   VlogInfo* my_info_;
   WritableFile* dest_;
-  // No copying allowed
-  VWriter(const VWriter&);
-  void operator=(const VWriter&);
+  const size_t capacity_;
+  const size_t flush_bytes_;  // Filled bytes that wake the flusher
+  char* buf_;  // Ring buffer, allocated on the first reservation
+  std::once_flag start_once_;
+  std::thread flusher_;
+
+  // End of the reserved records.
+  std::atomic<uint64_t> reserved_;
+  // End of the records written to the file.  Only advances while
+  // my_info_->rwlock_ is held exclusively, together with my_info_->head_.
+  std::atomic<uint64_t> flushed_;
+
+  port::Mutex mu_;
+  port::CondVar cv_ GUARDED_BY(mu_);        // Signalled for waiters_
+  port::CondVar flush_cv_ GUARDED_BY(mu_);  // Signalled for the flusher
+  int waiters_ GUARDED_BY(mu_);
+  uint64_t published_ GUARDED_BY(mu_);  // End of the contiguous filled records
+  uint64_t flush_requested_ GUARDED_BY(mu_);
+  std::map<uint64_t, uint64_t> filled_ GUARDED_BY(mu_);  // Past published_
+  std::map<uint64_t, DirectRecord*> direct_ GUARDED_BY(mu_);
+  uint64_t sync_requested_ GUARDED_BY(mu_);
+  uint64_t synced_ GUARDED_BY(mu_);
+  Status status_ GUARDED_BY(mu_);  // First write error, reported forever
+  bool stop_ GUARDED_BY(mu_);
 };
 
 }  // namespace vlog
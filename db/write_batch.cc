@@ -81,13 +81,47 @@ Status WriteBatch::Iterate(Handler* handler) const {
   }
 }
 
-Status WriteBatch::Iterate(Handler* handler, const uint64_t vlog_number,
-                           size_t* vlog_head) const {
-  Slice input(rep_);
+namespace {
+// Receives the entries of a batch that has been appended to a vlog.  Put()
+// is passed the address <vlog_number, vlog_offset, size> of the entry,
+// PutInline() the value of an entry smaller than the blob threshold.
+class VlogHandler : public WriteBatch::Handler {
+ public:
+  virtual void PutInline(const Slice& key, const Slice& value,
+                         size_t entry_size) = 0;
+};
+
+// Adapts a plain handler, used when every value lives in the vlog.
+class AddressOnlyHandler : public VlogHandler {
+ public:
+  explicit AddressOnlyHandler(WriteBatch::Handler* handler)
+      : handler_(handler) {}
+
+  void Put(const Slice& key, const Slice& address) override {
+    handler_->Put(key, address);
+  }
+  void PutInline(const Slice& key, const Slice& value,
+                 size_t entry_size) override {
+    assert(false);
+  }
+  void Delete(const Slice& key) override { handler_->Delete(key); }
+
+ private:
+  WriteBatch::Handler* const handler_;
+};
+}  // namespace
+
+// Walks "contents" as it was laid out in vlog "vlog_number", *vlog_head
+// being the offset of the batch contents in the vlog.  Values shorter than
+// "min_blob_size" are passed to PutInline(), all others by their address.
+static Status IterateVlog(Slice input, VlogHandler* handler,
+                          uint64_t vlog_number, size_t min_blob_size,
+                          size_t* vlog_head) {
   if (input.size() < kHeader) {
     return Status::Corruption("malformed WriteBatch (too small)");
   }
 
+  const int count = DecodeFixed32(input.data() + 8);
   input.remove_prefix(kHeader);
   *vlog_head += kHeader;
   const char* last_pos = input.data();
@@ -103,18 +137,16 @@ Status WriteBatch::Iterate(Handler* handler, const uint64_t vlog_number,
       case kTypeValue:
         if (GetLengthPrefixedSlice(&input, &key) &&
             GetLengthPrefixedSlice(&input, &value)) {
-          address.clear();
           size_t size = input.data() - last_pos;
-          PutVarint64(&address, vlog_number);
-          PutVarint64(&address, *vlog_head);
-          PutVarint64(&address, size);
-          handler->Put(key, address);
-
-//          std::fprintf(stdout,
-//                       "write: file_numb is %llu, pos is %zu, size is %zu, key "
-//                       "is %s, val is %s\n",
-//                       vlog_number, *vlog_head, size, key.data(), value.data());
-//          fflush(stdout);
+          if (value.size() < min_blob_size) {
+            handler->PutInline(key, value, size);
+          } else {
+            address.clear();
+            PutVarint64(&address, vlog_number);
+            PutVarint64(&address, *vlog_head);
+            PutVarint64(&address, size);
+            handler->Put(key, address);
+          }
 
           last_pos = input.data();
           *vlog_head += size;
@@ -135,13 +167,19 @@ Status WriteBatch::Iterate(Handler* handler, const uint64_t vlog_number,
         return Status::Corruption("unknown WriteBatch tag");
     }
   }
-  if (found != WriteBatchInternal::Count(this)) {
+  if (found != count) {
     return Status::Corruption("WriteBatch has wrong count");
   } else {
     return Status::OK();
   }
 }
 
+Status WriteBatch::Iterate(Handler* handler, const uint64_t vlog_number,
+                           size_t* vlog_head) const {
+  AddressOnlyHandler address_handler(handler);
+  return IterateVlog(rep_, &address_handler, vlog_number, 0, vlog_head);
+}
+
 int WriteBatchInternal::Count(const WriteBatch* b) {
   return DecodeFixed32(b->rep_.data() + 8);
 }
@@ -176,17 +214,34 @@ void WriteBatch::Append(const WriteBatch& source) {
 }
 
 namespace {
-class MemTableInserter : public WriteBatch::Handler {
+class MemTableInserter : public VlogHandler {
  public:
   SequenceNumber sequence_;
   MemTable* mem_;
+  bool concurrent_ = false;
+  uint64_t inline_count_ = 0;
+  uint64_t inline_bytes_ = 0;
 
   void Put(const Slice& key, const Slice& value) override {
-    mem_->Add(sequence_, kTypeValue, key, value);
-    sequence_++;
+    Add(kTypeValue, key, value);
+  }
+  void PutInline(const Slice& key, const Slice& value,
+                 size_t entry_size) override {
+    Add(kTypeInlineValue, key, value);
+    inline_count_++;
+    inline_bytes_ += entry_size;
   }
   void Delete(const Slice& key) override {
-    mem_->Add(sequence_, kTypeDeletion, key, Slice());
+    Add(kTypeDeletion, key, Slice());
+  }
+
+ private:
+  void Add(ValueType type, const Slice& key, const Slice& value) {
+    if (concurrent_) {
+      mem_->AddConcurrently(sequence_, type, key, value);
+    } else {
+      mem_->Add(sequence_, type, key, value);
+    }
     sequence_++;
   }
 };
@@ -210,14 +265,19 @@ void WriteBatchInternal::Append(WriteBatch* dst, const WriteBatch* src) {
   dst->rep_.append(src->rep_.data() + kHeader, src->rep_.size() - kHeader);
 }
 
-Status WriteBatchInternal::InsertAddressInto(const WriteBatch* batch,
-                                             uint64_t vlog_number,
-                                             MemTable* memTable,
-                                             size_t* vlog_head) {
+Status WriteBatchInternal::InsertAddressInto(
+    const WriteBatch* batch, uint64_t vlog_number, size_t min_blob_size,
+    MemTable* memTable, bool concurrent, size_t* vlog_head,
+    uint64_t* inline_count, uint64_t* inline_bytes) {
   MemTableInserter inserter;
   inserter.sequence_ = WriteBatchInternal::Sequence(batch);
   inserter.mem_ = memTable;
-  return batch->Iterate(&inserter, vlog_number, vlog_head);
+  inserter.concurrent_ = concurrent;
+  Status s = IterateVlog(Contents(batch), &inserter, vlog_number,
+                         min_blob_size, vlog_head);
+  *inline_count = inserter.inline_count_;
+  *inline_bytes = inserter.inline_bytes_;
+  return s;
 }
 
 }  // namespace leveldb
@@ -38,8 +38,18 @@ class WriteBatchInternal {
 
   static Status InsertInto(const WriteBatch* batch, MemTable* memtable);
 
+  // Insert the entries of "batch", which has been appended to vlog
+  // "vlog_number" at *vlog_head, into "memTable" and advance *vlog_head past
+  // them.  Values shorter than "min_blob_size" are inserted inline, the rest
+  // by their vlog address.  The number of inline values and the vlog bytes
+  // taken by their entries are stored in *inline_count and *inline_bytes.
+  // If "concurrent", other threads may insert into "memTable" at the same
+  // time, see MemTable::AddConcurrently().
   static Status InsertAddressInto(const WriteBatch* batch, uint64_t vlog_number,
-                               MemTable* memTable, size_t* vlog_head);
+                                  size_t min_blob_size, MemTable* memTable,
+                                  bool concurrent, size_t* vlog_head,
+                                  uint64_t* inline_count,
+                                  uint64_t* inline_bytes);
 
   static void Append(WriteBatch* dst, const WriteBatch* src);
 };
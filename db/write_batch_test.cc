@@ -7,16 +7,30 @@
 #include "db/write_batch_internal.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "util/coding.h"
 #include "util/logging.h"
+#include "util/testutil.h"
 
 namespace leveldb {
 
-static std::string PrintContents(WriteBatch* b) {
+// If "min_blob_size" is not zero, "b" is inserted as if it had been
+// appended to vlog 7 at offset 0, and the values of Put() are printed as
+// their addresses "@number:offset:size".
+static std::string PrintContents(WriteBatch* b, size_t min_blob_size = 0) {
   InternalKeyComparator cmp(BytewiseComparator());
   MemTable* mem = new MemTable(cmp);
   mem->Ref();
   std::string state;
-  Status s = WriteBatchInternal::InsertInto(b, mem);
+  Status s;
+  if (min_blob_size == 0) {
+    s = WriteBatchInternal::InsertInto(b, mem);
+  } else {
+    size_t vlog_head = 0;
+    uint64_t inline_count, inline_bytes;
+    s = WriteBatchInternal::InsertAddressInto(b, 7, min_blob_size, mem, false,
+                                              &vlog_head, &inline_count,
+                                              &inline_bytes);
+  }
   int count = 0;
   Iterator* iter = mem->NewIterator();
   for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
@@ -27,6 +41,24 @@ static std::string PrintContents(WriteBatch* b) {
         state.append("Put(");
         state.append(ikey.user_key.ToString());
         state.append(", ");
+        if (min_blob_size == 0) {
+          state.append(iter->value().ToString());
+        } else {
+          Slice address = iter->value();
+          uint64_t number, offset, size;
+          EXPECT_TRUE(GetVarint64(&address, &number) &&
+                      GetVarint64(&address, &offset) &&
+                      GetVarint64(&address, &size));
+          state.append("@" + NumberToString(number) + ":" +
+                       NumberToString(offset) + ":" + NumberToString(size));
+        }
+        state.append(")");
+        count++;
+        break;
+      case kTypeInlineValue:
+        state.append("PutInline(");
+        state.append(ikey.user_key.ToString());
+        state.append(", ");
         state.append(iter->value().ToString());
         state.append(")");
         count++;
@@ -72,6 +104,33 @@ TEST(WriteBatchTest, Multiple) {
       PrintContents(&batch));
 }
 
+TEST(WriteBatchTest, InlineValues) {
+  WriteBatch batch;
+  batch.Put(Slice("big"), Slice("0123456789"));
+  batch.Put(Slice("small"), Slice("v"));
+  batch.Delete(Slice("gone"));
+  WriteBatchInternal::SetSequence(&batch, 100);
+  // Values below min_blob_size stay inline, the rest are addressed by their
+  // entries in the vlog, which start after the 12-byte batch header.
+  ASSERT_EQ(
+      "Put(big, @7:12:16)@100"
+      "Delete(gone)@102"
+      "PutInline(small, v)@101",
+      PrintContents(&batch, 5));
+
+  size_t vlog_head = 0;
+  uint64_t inline_count, inline_bytes;
+  InternalKeyComparator cmp(BytewiseComparator());
+  MemTable* mem = new MemTable(cmp);
+  mem->Ref();
+  ASSERT_LEVELDB_OK(WriteBatchInternal::InsertAddressInto(
+      &batch, 7, 5, mem, false, &vlog_head, &inline_count, &inline_bytes));
+  ASSERT_EQ(12 + 16 + 9 + 6, static_cast<int>(vlog_head));
+  ASSERT_EQ(1, static_cast<int>(inline_count));
+  ASSERT_EQ(9, static_cast<int>(inline_bytes));
+  mem->Unref();
+}
+
 TEST(WriteBatchTest, Corruption) {
   WriteBatch batch;
   batch.Put(Slice("foo"), Slice("bar"));
@@ -87,6 +87,16 @@ class LEVELDB_EXPORT DB {
   virtual Status Get(const ReadOptions& options, const Slice& key,
                      std::string* value) = 0;
 
+  // For each i in [0,n-1], look up keys[i] as Get() would, storing the
+  // value in values[i] and the outcome in statuses[i].  All the lookups
+  // observe the same state of the database.  The values stored in the
+  // vlogs are read together, in the order they are laid out on disk and
+  // in parallel, which is faster than calling Get() for each key.
+  //
+  // The default implementation calls Get() for each key under a snapshot.
+  virtual void MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                        std::string* values, Status* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -95,6 +105,9 @@ class LEVELDB_EXPORT DB {
   // The returned iterator should be deleted before this db is deleted.
   virtual Iterator* NewIterator(const ReadOptions& options) = 0;
 
+  // Like NewIterator(), but value() is the address of the value in its vlog
+  // instead of the value itself.  Keys whose values are stored inline (see
+  // Options::min_blob_size) are skipped.
   virtual Iterator* NewAddrIterator(const ReadOptions& options) {
     return nullptr;
   }
@@ -123,6 +136,12 @@ class LEVELDB_EXPORT DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.vlog-garbage" - returns a multi-line string that describes
+  //     the garbage that compactions accounted to every vlog file.
+  //  "leveldb.value-cache" - returns the number of Options::value_cache
+  //     lookups that hit and missed, and the bytes of values it holds.
+  //  "leveldb.address-cache" - returns the number of Options::address_cache
+  //     lookups that hit and missed.
   //  "leveldb.approximate-memory-usage" - returns the approximate number of
   //     bytes of memory in use by the DB.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
@@ -117,6 +117,36 @@ class LEVELDB_EXPORT Env {
   virtual Status NewAppendableFile(const std::string& fname,
                                    WritableFile** result);
 
+  // Create an object that writes to the file "fname" from "offset" on,
+  // overwriting what is there, without truncating the file.  The file is
+  // created if it does not exist.  Meant for files whose space is
+  // allocated ahead of the data, see WritableFile::Allocate().
+  //
+  // The returned file will only be accessed by one thread at a time.
+  //
+  // The default implementation returns an IsNotSupportedError error.
+  virtual Status NewWritableFileAt(const std::string& fname, uint64_t offset,
+                                   WritableFile** result);
+
+  // Like NewSequentialFile(), NewNonMmapRandomAccessFile() and
+  // NewWritableFileAt(), but the file is read or written with direct I/O
+  // that bypasses the operating system's page cache.  Callers may read and
+  // write any range; the returned file aligns the I/O itself.  A direct
+  // writable file zeroes the rest of the last block it writes, so it is
+  // meant for writing at the end of the data.  Until it is closed, the
+  // file may be padded with zeros to a block boundary.
+  //
+  // The default implementations return an IsNotSupportedError error, and
+  // so may implementations on file systems without direct I/O.  Callers
+  // are expected to fall back to the buffered variants.
+  virtual Status NewDirectSequentialFile(const std::string& fname,
+                                         SequentialFile** result);
+  virtual Status NewDirectRandomAccessFile(const std::string& fname,
+                                           RandomAccessFile** result);
+  virtual Status NewDirectWritableFileAt(const std::string& fname,
+                                         uint64_t offset,
+                                         WritableFile** result);
+
   // Returns true iff the named file exists.
   virtual bool FileExists(const std::string& fname) = 0;
 
@@ -287,6 +317,25 @@ class LEVELDB_EXPORT RandomAccessFile {
   // Safe for concurrent use by multiple threads.
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
+
+  // A read performed by MultiRead().
+  struct ReadRequest {
+    uint64_t offset;
+    size_t n;
+    char* scratch;  // Holds at least n bytes, see Read()
+
+    // Set by MultiRead().
+    Slice result;
+    Status status;
+  };
+
+  // Perform the reads reqs[0,num_reqs-1] as if by calling Read() for each
+  // of them, storing the outcome of each read in the request.
+  // Implementations may keep all the reads in flight at the same time.
+  // The default implementation calls Read() for each request in turn.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual void MultiRead(ReadRequest* reqs, size_t num_reqs) const;
 };
 
 // A file abstraction for sequential writing.  The implementation
@@ -310,6 +359,23 @@ class LEVELDB_EXPORT WritableFile {
     (void)data;
     return Status::NotSupported("SyncedAppend");
   }
+
+  // Append data[0,n-1] as if by calling SyncedAppend() for each of them
+  // in turn.  Implementations may write all of them with a single call.
+  // The default implementation calls SyncedAppend() for each slice.
+  virtual Status SyncedAppendv(const Slice* data, size_t n);
+
+  // Make the bytes [offset, offset+len) of the file read as zeros and
+  // allocate disk space for them, so that writing them later neither
+  // allocates space nor, unless "keep_size" is set, changes the file size.
+  // With "keep_size", bytes past the end of the file are allocated but the
+  // file size stays the same.
+  virtual Status Allocate(uint64_t offset, uint64_t len, bool keep_size) {
+    (void)offset;
+    (void)len;
+    (void)keep_size;
+    return Status::NotSupported("Allocate");
+  }
 };
 
 // An interface for writing log messages.
@@ -378,6 +444,22 @@ class LEVELDB_EXPORT EnvWrapper : public Env {
   Status NewAppendableFile(const std::string& f, WritableFile** r) override {
     return target_->NewAppendableFile(f, r);
   }
+  Status NewWritableFileAt(const std::string& f, uint64_t offset,
+                           WritableFile** r) override {
+    return target_->NewWritableFileAt(f, offset, r);
+  }
+  Status NewDirectSequentialFile(const std::string& f,
+                                 SequentialFile** r) override {
+    return target_->NewDirectSequentialFile(f, r);
+  }
+  Status NewDirectRandomAccessFile(const std::string& f,
+                                   RandomAccessFile** r) override {
+    return target_->NewDirectRandomAccessFile(f, r);
+  }
+  Status NewDirectWritableFileAt(const std::string& f, uint64_t offset,
+                                 WritableFile** r) override {
+    return target_->NewDirectWritableFileAt(f, offset, r);
+  }
   bool FileExists(const std::string& f) override {
     return target_->FileExists(f);
   }
@@ -7,6 +7,8 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <string>
+#include <vector>
 
 #include "leveldb/export.h"
 
@@ -30,6 +32,17 @@ enum CompressionType {
   kSnappyCompression = 0x1
 };
 
+// vlog分区：key以prefix开头的value写入该分区自己的vlog文件，见Options::vlog_partitions
+struct LEVELDB_EXPORT VlogPartition {
+  std::string prefix;
+
+  // 该分区的vlog文件大小上限，为0时使用Options::max_vlog_size
+  uint64_t max_vlog_size = 0;
+
+  // 该分区的垃圾回收阈值，为0时使用Options::clean_threshold
+  uint64_t clean_threshold = 0;
+};
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct LEVELDB_EXPORT Options {
   // Create an Options object with default values for all fields.
@@ -94,6 +107,19 @@ struct LEVELDB_EXPORT Options {
   // If null, leveldb will automatically create and use an 8MB internal cache.
   Cache* block_cache = nullptr;
 
+  // If non-null, use the specified cache for values read from the vlogs,
+  // keyed by their vlog address.  Hits avoid the read and the decoding of
+  // the vlog entry.  The charge of an entry is the size of its value.
+  // If null, values are always read from the vlog files.
+  Cache* value_cache = nullptr;
+
+  // If non-null, use the specified cache to remember where the newest
+  // values of recently read keys live.  A hit skips the memtables and the
+  // sstables, and only the value is read from the vlog (or value_cache).
+  // Writes and garbage collection drop the entries of the keys they touch.
+  // If null, every read looks the key up in the LSM-tree.
+  Cache* address_cache = nullptr;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -105,6 +131,29 @@ struct LEVELDB_EXPORT Options {
   // leave this parameter alone.
   int block_restart_interval = 16;
 
+  // If true, data blocks end with a hash index that maps the user keys in
+  // the block to their restart points, so that point lookups go straight
+  // to the right restart point instead of binary searching for it.
+  // Blocks with more than 253 restart points are written without it.
+  // Tables written without the index remain readable, but tables written
+  // with it can not be read by older versions.
+  bool use_data_block_hash_index = false;
+
+  // Number of keys per bucket of the data block hash index.  A lower
+  // ratio means fewer collisions, which fall back to the binary search,
+  // and larger blocks.
+  double data_block_hash_table_util_ratio = 0.75;
+
+  // If true, the index block and the filter block of a table are split
+  // into partitions of about metadata_block_size bytes, which are read
+  // through block_cache when needed.  An open table then only keeps a
+  // small top-level index of the partitions in memory.  Tables written
+  // this way can not be read by older versions.
+  bool partition_index_and_filters = false;
+
+  // Approximate size of the partitions of the index and filter blocks.
+  size_t metadata_block_size = 4 * 1024;
+
   // Leveldb will write up to this amount of bytes to a file before
   // switching to a new one.
   // Most clients should leave this parameter alone.  However if your
@@ -142,20 +191,75 @@ struct LEVELDB_EXPORT Options {
   // NewBloomFilterPolicy() here.
   const FilterPolicy* filter_policy = nullptr;
 
-  //垃圾回收的写缓冲区，必须要大于12
+  //垃圾回收每次从vlog尾部读取的字节数，必须要大于12
   uint64_t clean_write_buffer_size;
 
-  // vlog文件垃圾记录条数达到多少条时开始进行垃圾回收
+  // 已封存（不再写入）的vlog文件中，合并丢弃的垃圾kv达到多少字节时对其进行垃圾回收，
+  // 垃圾占比最高的文件优先回收
   uint64_t clean_threshold;
 
-  // vlog进行手动清理时，只有文件垃圾记录条数达到min_clean_threshold才会清理
+  // 回收完一个vlog文件后，若释放的字节数少于min_clean_threshold，
+  // 则暂停垃圾回收，直到又写入clean_threshold字节的新数据
   uint64_t min_clean_threshold;
 
+  // 垃圾回收每秒最多读取的vlog字节数，为0时不限速
+  uint64_t clean_rate_limit;
+
   //与持久化vloginfo有关的，合并后新产生log_dropCount_threshold条垃圾记录时持久化vloginfo
   uint64_t log_dropCount_threshold;
 
   // vlog文件大小上限值
   uint64_t max_vlog_size;
+
+  // 创建vlog文件时用fallocate为其预分配max_vlog_size字节并清零，
+  // 追加写入不再分配磁盘空间，也不再改变文件大小，同步写入只需fdatasync数据块。
+  // 文件中数据的末尾由全0的记录头标识，恢复时在那里停止。
+  // 被垃圾回收退役的vlog文件清零后留作新的vlog文件，而不是删除
+  bool preallocate_vlog;
+
+  // 预分配时保持文件大小不变（FALLOC_FL_KEEP_SIZE），只预留磁盘空间。
+  // 追加写入仍会改变文件大小，退役的vlog文件照常删除
+  bool vlog_preallocate_keep_size;
+
+  // 写入vlog的环形缓冲区大小，写线程将记录拷入缓冲区，后台线程将其批量写入文件，
+  // 写满一半即开始写出。放不进缓冲区剩余空间的记录直接写入文件
+  size_t vlog_write_buffer_size;
+
+  // 用O_DIRECT读写vlog文件，绕过操作系统的页缓存，避免value与sstable的索引块
+  // 争抢页缓存。读取的value改由value_cache缓存，开启时应一并设置value_cache。
+  // 文件系统不支持时退回普通的读写
+  bool use_direct_io_for_vlog;
+
+  // 同步写入在组提交前等待的微秒数，以便让更多的写入加入同一组，
+  // 共享同一次fdatasync。为0时不等待
+  uint64_t max_sync_delay_micros;
+
+  // 流水线写入：写入组在vlog中预留好记录后即离开写队列，下一组追加vlog的同时，
+  // 本组将记录拷入vlog并插入memtable。序列号仍按组的顺序发布
+  bool enable_pipelined_write;
+
+  // 小于min_blob_size字节的value直接内联存放在memtable和sstable中，
+  // 读取时无需再访问vlog；不小于该值的value只在LSM-tree中保存其vlog地址。
+  // vlog仍然记录完整的WriteBatch作为WAL，内联value在vlog中的副本在写入时即记为垃圾。
+  // 为0时所有value都存放在vlog中
+  uint64_t min_blob_size;
+
+  // 迭代器预读vlog中value的线程数上限，同一个DB的所有迭代器共享这些线程，
+  // 线程在需要时才创建，并一直保留到DB关闭
+  int max_prefetch_threads;
+
+  // 每个迭代器预读的value总字节数上限，预读的条目数从少量开始，
+  // 随调用者不断调用Next()/Prev()而成倍增长，直到达到该上限
+  uint64_t max_readahead_bytes;
+
+  // 按key前缀划分的vlog分区，vlog_partitions[i]为i+1号分区，
+  // 不匹配任何前缀的key属于0号分区，匹配多个前缀时取第一个。
+  // 各分区共享LSM-tree和MANIFEST，但各自追加、轮换和回收自己的vlog文件，
+  // 冷热数据分开存放，垃圾回收时不必反复搬运冷数据。
+  // 跨分区的WriteBatch作为一条vlog记录写入其第一个key所在的分区，崩溃后整体恢复或整体丢弃，
+  // 垃圾回收搬运时再把各value写入各自key所在的分区。
+  // 重新打开时只能在末尾追加分区，不能删除分区或修改已有分区的前缀
+  std::vector<VlogPartition> vlog_partitions;
 };
 
 // Options that control read operations
@@ -175,6 +279,12 @@ struct LEVELDB_EXPORT ReadOptions {
   // not have been released).  If "snapshot" is null, use an implicit
   // snapshot of the state at the beginning of this read operation.
   const Snapshot* snapshot = nullptr;
+
+  // The number of entries an iterator is expected to read after a seek.
+  // Iterators read values ahead of the caller; a hint lets a long scan
+  // start with a deep readahead instead of growing it gradually.
+  // 0 means unknown.
+  size_t readahead_hint = 0;
 };
 
 // Options that control write operations
@@ -63,12 +63,25 @@ class LEVELDB_EXPORT Table {
   struct Rep;
 
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
+  static Iterator* BlockReader(Table* table, const ReadOptions& options,
+                               const Slice& index_value, bool point_lookup);
 
   explicit Table(Rep* rep) : rep_(rep) {}
 
+  // Returns an iterator over the entries of the index, whose values are
+  // the handles of the data blocks.
+  Iterator* NewIndexIterator(const ReadOptions&) const;
+
+  // Returns false if the filter partition named by "partition_value", an
+  // entry of the top-level index, says that "key" is not in the data block
+  // at "block_offset".
+  bool PartitionKeyMayMatch(const ReadOptions&, const Slice& partition_value,
+                            uint64_t block_offset, const Slice& key);
+
   // Calls (*handle_result)(arg, ...) with the entry found after a call
-  // to Seek(key).  May not make such a call if filter policy says
-  // that key is not present.
+  // to Seek(key).  May not make such a call if filter policy or the hash
+  // index of the data block says that key is not present, and may call it
+  // with a key of a different user key if the key is not present.
   Status InternalGet(const ReadOptions&, const Slice& key, void* arg,
                      void (*handle_result)(void* arg, const Slice& k,
                                            const Slice& v));
@@ -17,25 +17,42 @@
 
 namespace leveldb {
 
-inline uint32_t Block::NumRestarts() const {
-  assert(size_ >= sizeof(uint32_t));
-  return DecodeFixed32(data_ + size_ - sizeof(uint32_t));
-}
-
 Block::Block(const BlockContents& contents)
     : data_(contents.data.data()),
       size_(contents.data.size()),
+      num_restarts_(0),
+      hash_index_offset_(0),
+      num_buckets_(0),
       owned_(contents.heap_allocated) {
   if (size_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
-  } else {
-    size_t max_restarts_allowed = (size_ - sizeof(uint32_t)) / sizeof(uint32_t);
-    if (NumRestarts() > max_restarts_allowed) {
-      // The size is too small for NumRestarts()
+    return;
+  }
+  // The restart array, and the hash index if any, end here.
+  size_t limit = size_ - sizeof(uint32_t);
+  num_restarts_ = DecodeFixed32(data_ + limit);
+  if ((num_restarts_ & kBlockHashIndexFlag) != 0) {
+    num_restarts_ &= ~kBlockHashIndexFlag;
+    if (limit < sizeof(uint16_t)) {
       size_ = 0;
-    } else {
-      restart_offset_ = size_ - (1 + NumRestarts()) * sizeof(uint32_t);
+      return;
+    }
+    limit -= sizeof(uint16_t);
+    num_buckets_ = DecodeFixed16(data_ + limit);
+    if (num_buckets_ == 0 || num_buckets_ > limit) {
+      // The size is too small for the hash index
+      size_ = 0;
+      return;
     }
+    limit -= num_buckets_;
+    hash_index_offset_ = limit;
+  }
+  size_t max_restarts_allowed = limit / sizeof(uint32_t);
+  if (num_restarts_ > max_restarts_allowed) {
+    // The size is too small for num_restarts_
+    size_ = 0;
+  } else {
+    restart_offset_ = limit - num_restarts_ * sizeof(uint32_t);
   }
 }
 
@@ -80,6 +97,8 @@ class Block::Iter : public Iterator {
   const char* const data_;       // underlying block contents
   uint32_t const restarts_;      // Offset of restart array (list of fixed32)
   uint32_t const num_restarts_;  // Number of uint32_t entries in restart array
+  const uint8_t* const hash_index_;  // Buckets of the hash index, or nullptr
+  uint16_t const num_buckets_;
 
   // current_ is offset in data_ of current entry.  >= restarts_ if !Valid
   uint32_t current_;
@@ -114,11 +133,13 @@ class Block::Iter : public Iterator {
 
  public:
   Iter(const Comparator* comparator, const char* data, uint32_t restarts,
-       uint32_t num_restarts)
+       uint32_t num_restarts, const uint8_t* hash_index, uint16_t num_buckets)
       : comparator_(comparator),
         data_(data),
         restarts_(restarts),
         num_restarts_(num_restarts),
+        hash_index_(hash_index),
+        num_buckets_(num_buckets),
         current_(restarts_),
         restart_index_(num_restarts_) {
     assert(num_restarts_ > 0);
@@ -162,6 +183,10 @@ class Block::Iter : public Iterator {
   }
 
   void Seek(const Slice& target) override {
+    if (hash_index_ != nullptr && !Valid() && SeekByHashIndex(target)) {
+      return;
+    }
+
     // Binary search in restart array to find the last restart point
     // with a key < target
     uint32_t left = 0;
@@ -247,6 +272,35 @@ class Block::Iter : public Iterator {
     value_.clear();
   }
 
+  // Seek to the first key >= target in the restart interval that holds the
+  // user key of "target", as recorded by the hash index.  Returns false if
+  // the hash index can not tell which interval that is.
+  bool SeekByHashIndex(const Slice& target) {
+    if (target.size() < 8) {
+      return false;
+    }
+    const Slice user_key(target.data(), target.size() - 8);
+    const uint8_t entry = hash_index_[HashIndexHash(user_key) % num_buckets_];
+    if (entry == kHashIndexCollision) {
+      return false;
+    }
+    if (entry == kHashIndexNoEntry) {
+      // The block does not hold the user key.
+      current_ = restarts_;
+      restart_index_ = num_restarts_;
+      return true;
+    }
+    if (entry >= num_restarts_) {
+      CorruptionError();
+      return true;
+    }
+    SeekToRestartPoint(entry);
+    while (ParseNextKey() && Compare(key_, target) < 0) {
+      // Keep skipping
+    }
+    return true;
+  }
+
   bool ParseNextKey() {
     current_ = NextEntryOffset();
     const char* p = data_ + current_;
@@ -281,12 +335,21 @@ Iterator* Block::NewIterator(const Comparator* comparator) {
   if (size_ < sizeof(uint32_t)) {
     return NewErrorIterator(Status::Corruption("bad block contents"));
   }
-  const uint32_t num_restarts = NumRestarts();
-  if (num_restarts == 0) {
+  if (num_restarts_ == 0) {
     return NewEmptyIterator();
   } else {
-    return new Iter(comparator, data_, restart_offset_, num_restarts);
+    return new Iter(comparator, data_, restart_offset_, num_restarts_, nullptr,
+                    0);
+  }
+}
+
+Iterator* Block::NewPointLookupIterator(const Comparator* comparator) {
+  if (num_buckets_ == 0 || size_ < sizeof(uint32_t) || num_restarts_ == 0) {
+    return NewIterator(comparator);
   }
+  return new Iter(comparator, data_, restart_offset_, num_restarts_,
+                  reinterpret_cast<const uint8_t*>(data_ + hash_index_offset_),
+                  num_buckets_);
 }
 
 }  // namespace leveldb
@@ -28,15 +28,22 @@ class Block {
   size_t size() const { return size_; }
   Iterator* NewIterator(const Comparator* comparator);
 
+  // Like NewIterator(), for looking up a single user key in a block of
+  // internal keys.  If the block has a hash index, Seek() goes straight to
+  // the restart point of the user key, and may leave the iterator invalid
+  // or at a larger user key if the block does not hold it.
+  Iterator* NewPointLookupIterator(const Comparator* comparator);
+
  private:
   class Iter;
 
-  uint32_t NumRestarts() const;
-
   const char* data_;
   size_t size_;
   uint32_t restart_offset_;  // Offset in data_ of restart array
-  bool owned_;               // Block owns data_[]
+  uint32_t num_restarts_;
+  uint32_t hash_index_offset_;  // Offset in data_ of the hash index, if any
+  uint16_t num_buckets_;        // Zero if the block has no hash index
+  bool owned_;                  // Block owns data_[]
 };
 
 }  // namespace leveldb
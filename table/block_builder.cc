@@ -25,6 +25,17 @@
 //     restarts: uint32[num_restarts]
 //     num_restarts: uint32
 // restarts[i] contains the offset within the block of the ith restart point.
+//
+// A data block built with Options::use_data_block_hash_index ends with a
+// hash index instead:
+//     restarts: uint32[num_restarts]
+//     buckets: uint8[num_buckets]
+//     num_buckets: uint16
+//     num_restarts | kBlockHashIndexFlag: uint32
+// buckets[HashIndexHash(user_key) % num_buckets] is the index of the
+// restart point whose interval holds all the entries of user_key,
+// kHashIndexNoEntry if no key of the block hashes there, or
+// kHashIndexCollision if keys of different intervals do.
 
 #include "table/block_builder.h"
 
@@ -33,12 +44,21 @@
 
 #include "leveldb/comparator.h"
 #include "leveldb/options.h"
+#include "table/format.h"
 #include "util/coding.h"
 
 namespace leveldb {
 
 BlockBuilder::BlockBuilder(const Options* options)
-    : options_(options), restarts_(), counter_(0), finished_(false) {
+    : BlockBuilder(options, false) {}
+
+BlockBuilder::BlockBuilder(const Options* options, bool data_block)
+    : options_(options),
+      data_block_(data_block),
+      restarts_(),
+      hash_index_ok_(true),
+      counter_(0),
+      finished_(false) {
   assert(options->block_restart_interval >= 1);
   restarts_.push_back(0);  // First restart point is at offset 0
 }
@@ -47,15 +67,23 @@ void BlockBuilder::Reset() {
   buffer_.clear();
   restarts_.clear();
   restarts_.push_back(0);  // First restart point is at offset 0
+  hash_entries_.clear();
+  hash_index_ok_ = true;
   counter_ = 0;
   finished_ = false;
   last_key_.clear();
 }
 
 size_t BlockBuilder::CurrentSizeEstimate() const {
-  return (buffer_.size() +                       // Raw data buffer
-          restarts_.size() * sizeof(uint32_t) +  // Restart array
-          sizeof(uint32_t));                     // Restart array length
+  size_t estimate = (buffer_.size() +                       // Raw data buffer
+                     restarts_.size() * sizeof(uint32_t) +  // Restart array
+                     sizeof(uint32_t));  // Restart array length
+  if (!hash_entries_.empty()) {
+    estimate += hash_entries_.size() /
+                    options_->data_block_hash_table_util_ratio +
+                sizeof(uint16_t);
+  }
+  return estimate;
 }
 
 Slice BlockBuilder::Finish() {
@@ -63,11 +91,44 @@ Slice BlockBuilder::Finish() {
   for (size_t i = 0; i < restarts_.size(); i++) {
     PutFixed32(&buffer_, restarts_[i]);
   }
-  PutFixed32(&buffer_, restarts_.size());
+  if (hash_index_ok_ && !hash_entries_.empty() &&
+      restarts_.size() <= kHashIndexMaxRestarts) {
+    AppendHashIndex();
+    PutFixed32(&buffer_, restarts_.size() | kBlockHashIndexFlag);
+  } else {
+    PutFixed32(&buffer_, restarts_.size());
+  }
   finished_ = true;
   return Slice(buffer_);
 }
 
+void BlockBuilder::AppendHashIndex() {
+  double buckets =
+      hash_entries_.size() / options_->data_block_hash_table_util_ratio;
+  if (!(buckets >= 1)) {
+    buckets = 1;
+  } else if (buckets > 65535) {
+    buckets = 65535;
+  }
+  const uint32_t num_buckets = static_cast<uint32_t>(buckets);
+  std::string index(num_buckets, static_cast<char>(kHashIndexNoEntry));
+  for (const auto& entry : hash_entries_) {
+    const uint32_t bucket = entry.first % num_buckets;
+    const uint8_t restart_index = static_cast<uint8_t>(entry.second);
+    uint8_t current = static_cast<uint8_t>(index[bucket]);
+    if (current == kHashIndexNoEntry) {
+      current = restart_index;
+    } else if (current != restart_index) {
+      current = kHashIndexCollision;
+    }
+    index[bucket] = static_cast<char>(current);
+  }
+  buffer_.append(index);
+  char buf[sizeof(uint16_t)];
+  EncodeFixed16(buf, num_buckets);
+  buffer_.append(buf, sizeof(buf));
+}
+
 void BlockBuilder::Add(const Slice& key, const Slice& value) {
   Slice last_key_piece(last_key_);
   assert(!finished_);
@@ -102,6 +163,20 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
   last_key_.append(key.data() + shared, non_shared);
   assert(Slice(last_key_) == key);
   counter_++;
+
+  if (data_block_ && options_->use_data_block_hash_index && hash_index_ok_) {
+    if (key.size() < 8) {
+      hash_index_ok_ = false;
+      hash_entries_.clear();
+    } else {
+      const uint32_t hash = HashIndexHash(Slice(key.data(), key.size() - 8));
+      const uint32_t restart_index = restarts_.size() - 1;
+      if (hash_entries_.empty() || hash_entries_.back().first != hash ||
+          hash_entries_.back().second != restart_index) {
+        hash_entries_.emplace_back(hash, restart_index);
+      }
+    }
+  }
 }
 
 }  // namespace leveldb
@@ -6,6 +6,8 @@
 #define STORAGE_LEVELDB_TABLE_BLOCK_BUILDER_H_
 
 #include <cstdint>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "leveldb/slice.h"
@@ -18,6 +20,11 @@ class BlockBuilder {
  public:
   explicit BlockBuilder(const Options* options);
 
+  // If "data_block" is true, the keys are internal keys, and the block
+  // gets a hash index of their user keys when
+  // Options::use_data_block_hash_index is set.
+  BlockBuilder(const Options* options, bool data_block);
+
   BlockBuilder(const BlockBuilder&) = delete;
   BlockBuilder& operator=(const BlockBuilder&) = delete;
 
@@ -41,9 +48,16 @@ class BlockBuilder {
   bool empty() const { return buffer_.empty(); }
 
  private:
+  void AppendHashIndex();
+
   const Options* options_;
+  const bool data_block_;
   std::string buffer_;              // Destination buffer
   std::vector<uint32_t> restarts_;  // Restart points
+  // <hash of the user key, restart index> of the keys added for the hash
+  // index, which is not built if a key is no internal key.
+  std::vector<std::pair<uint32_t, uint32_t>> hash_entries_;
+  bool hash_index_ok_;
   int counter_;                     // Number of entries emitted since restart
   bool finished_;                   // Has Finish() been called?
   std::string last_key_;
@@ -62,12 +62,18 @@ class Footer {
   const BlockHandle& index_handle() const { return index_handle_; }
   void set_index_handle(const BlockHandle& h) { index_handle_ = h; }
 
+  // Whether the index block is the top-level index of a partitioned index,
+  // i.e. it maps the last key of each partition to the partition.
+  bool partitioned_index() const { return partitioned_index_; }
+  void set_partitioned_index(bool p) { partitioned_index_ = p; }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(Slice* input);
 
  private:
   BlockHandle metaindex_handle_;
   BlockHandle index_handle_;
+  bool partitioned_index_ = false;
 };
 
 // kTableMagicNumber was picked by running
@@ -75,9 +81,29 @@ class Footer {
 // and taking the leading 64 bits.
 static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 
+// Tables with a partitioned index end with kPartitionedTableMagicNumber
+// instead, so that older versions refuse to open them.  It was picked by
+// running
+//    echo http://code.google.com/p/leveldb/partitioned | sha1sum
+// and taking the leading 64 bits.
+static const uint64_t kPartitionedTableMagicNumber = 0xf2acd95ef85ce379ull;
+
 // 1-byte type + 32-bit crc
 static const size_t kBlockTrailerSize = 5;
 
+// The restart count at the end of a block has this bit set if the block
+// ends with a hash index of its user keys, see block_builder.cc.
+static const uint32_t kBlockHashIndexFlag = 1u << 31;
+
+// Buckets of the hash index hold a restart index, or one of these.
+static const uint8_t kHashIndexNoEntry = 255;
+static const uint8_t kHashIndexCollision = 254;
+static const uint32_t kHashIndexMaxRestarts = 253;
+
+// Hash of "user_key" in the hash index of a block.  Its bucket is the
+// hash modulo the number of buckets.
+uint32_t HashIndexHash(const Slice& user_key);
+
 struct BlockContents {
   Slice data;           // Actual contents of data
   bool cachable;        // True iff data can be cached
@@ -32,9 +32,30 @@ struct Table::Rep {
   const char* filter_data;
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
-  Block* index_block;
+  Block* index_block;  // The top-level index if partitioned_index is true
+  bool partitioned_index;
+  bool partitioned_filter;  // The top-level index has filter partitions
 };
 
+namespace {
+
+// A filter partition, as kept in the block cache.
+struct FilterPartition {
+  FilterPartition(const FilterPolicy* policy, const BlockContents& contents)
+      : reader(policy, contents.data),
+        data(contents.heap_allocated ? contents.data.data() : nullptr) {}
+  ~FilterPartition() { delete[] data; }
+
+  FilterBlockReader reader;
+  const char* data;  // Owned if the contents were heap allocated
+};
+
+void DeleteCachedFilterPartition(const Slice& key, void* value) {
+  delete reinterpret_cast<FilterPartition*>(value);
+}
+
+}  // namespace
+
 Status Table::Open(const Options& options, RandomAccessFile* file,
                    uint64_t size, Table** table) {
   *table = nullptr;
@@ -69,6 +90,8 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
     rep->file = file;
     rep->metaindex_handle = footer.metaindex_handle();
     rep->index_block = index_block;
+    rep->partitioned_index = footer.partitioned_index();
+    rep->partitioned_filter = false;
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->filter_data = nullptr;
     rep->filter = nullptr;
@@ -104,6 +127,12 @@ void Table::ReadMeta(const Footer& footer) {
   if (iter->Valid() && iter->key() == Slice(key)) {
     ReadFilter(iter->value());
   }
+  if (rep_->partitioned_index) {
+    key = "partitionedfilter.";
+    key.append(rep_->options.filter_policy->Name());
+    iter->Seek(key);
+    rep_->partitioned_filter = iter->Valid() && iter->key() == Slice(key);
+  }
   delete iter;
   delete meta;
 }
@@ -152,7 +181,14 @@ static void ReleaseBlock(void* arg, void* h) {
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
                              const Slice& index_value) {
-  Table* table = reinterpret_cast<Table*>(arg);
+  return BlockReader(reinterpret_cast<Table*>(arg), options, index_value,
+                     false);
+}
+
+// If "point_lookup" is true, the iterator is only used to look up a single
+// user key, and may use the hash index of the block.
+Iterator* Table::BlockReader(Table* table, const ReadOptions& options,
+                             const Slice& index_value, bool point_lookup) {
   Cache* block_cache = table->rep_->options.block_cache;
   Block* block = nullptr;
   Cache::Handle* cache_handle = nullptr;
@@ -193,7 +229,9 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
 
   Iterator* iter;
   if (block != nullptr) {
-    iter = block->NewIterator(table->rep_->options.comparator);
+    iter = point_lookup
+               ? block->NewPointLookupIterator(table->rep_->options.comparator)
+               : block->NewIterator(table->rep_->options.comparator);
     if (cache_handle == nullptr) {
       iter->RegisterCleanup(&DeleteBlock, block, nullptr);
     } else {
@@ -205,10 +243,68 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
   return iter;
 }
 
+Iterator* Table::NewIndexIterator(const ReadOptions& options) const {
+  Iterator* iter = rep_->index_block->NewIterator(rep_->options.comparator);
+  if (rep_->partitioned_index) {
+    // The values of the top-level index start with the handles of the
+    // index partitions, which BlockReader reads like data blocks.
+    iter = NewTwoLevelIterator(iter, &Table::BlockReader,
+                               const_cast<Table*>(this), options);
+  }
+  return iter;
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  return NewTwoLevelIterator(NewIndexIterator(options), &Table::BlockReader,
+                             const_cast<Table*>(this), options);
+}
+
+bool Table::PartitionKeyMayMatch(const ReadOptions& options,
+                                 const Slice& partition_value,
+                                 uint64_t block_offset, const Slice& key) {
+  Slice input = partition_value;
+  BlockHandle index_handle, filter_handle;
+  uint64_t filter_base;
+  if (!index_handle.DecodeFrom(&input).ok() ||
+      !filter_handle.DecodeFrom(&input).ok() ||
+      !GetVarint64(&input, &filter_base) || block_offset < filter_base) {
+    return true;
+  }
+
+  Cache* block_cache = rep_->options.block_cache;
+  FilterPartition* partition = nullptr;
+  Cache::Handle* cache_handle = nullptr;
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, rep_->cache_id);
+  EncodeFixed64(cache_key_buffer + 8, filter_handle.offset());
+  Slice cache_key(cache_key_buffer, sizeof(cache_key_buffer));
+  if (block_cache != nullptr) {
+    cache_handle = block_cache->Lookup(cache_key);
+  }
+  if (cache_handle != nullptr) {
+    partition =
+        reinterpret_cast<FilterPartition*>(block_cache->Value(cache_handle));
+  } else {
+    BlockContents contents;
+    if (!ReadBlock(rep_->file, options, filter_handle, &contents).ok()) {
+      return true;
+    }
+    partition = new FilterPartition(rep_->options.filter_policy, contents);
+    if (block_cache != nullptr && contents.cachable && options.fill_cache) {
+      cache_handle =
+          block_cache->Insert(cache_key, partition, contents.data.size(),
+                              &DeleteCachedFilterPartition);
+    }
+  }
+
+  const bool result =
+      partition->reader.KeyMayMatch(block_offset - filter_base, key);
+  if (cache_handle != nullptr) {
+    block_cache->Release(cache_handle);
+  } else {
+    delete partition;
+  }
+  return result;
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
@@ -217,6 +313,13 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
   Status s;
   Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
   iiter->Seek(k);
+  // The top-level index, if the index is partitioned
+  Iterator* top_level_iter = nullptr;
+  if (rep_->partitioned_index && iiter->Valid()) {
+    top_level_iter = iiter;
+    iiter = BlockReader(this, options, top_level_iter->value(), false);
+    iiter->Seek(k);
+  }
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
     FilterBlockReader* filter = rep_->filter;
@@ -224,8 +327,13 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
     if (filter != nullptr && handle.DecodeFrom(&handle_value).ok() &&
         !filter->KeyMayMatch(handle.offset(), k)) {
       // Not found
+    } else if (top_level_iter != nullptr && rep_->partitioned_filter &&
+               handle.DecodeFrom(&handle_value).ok() &&
+               !PartitionKeyMayMatch(options, top_level_iter->value(),
+                                     handle.offset(), k)) {
+      // Not found
     } else {
-      Iterator* block_iter = BlockReader(this, options, iiter->value());
+      Iterator* block_iter = BlockReader(this, options, iiter->value(), true);
       block_iter->Seek(k);
       if (block_iter->Valid()) {
         (*handle_result)(arg, block_iter->key(), block_iter->value());
@@ -238,12 +346,17 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
     s = iiter->status();
   }
   delete iiter;
+  if (top_level_iter != nullptr) {
+    if (s.ok()) {
+      s = top_level_iter->status();
+    }
+    delete top_level_iter;
+  }
   return s;
 }
 
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* index_iter = NewIndexIterator(ReadOptions());
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
@@ -24,8 +24,10 @@ struct TableBuilder::Rep {
         index_block_options(opt),
         file(f),
         offset(0),
-        data_block(&options),
+        data_block(&options, true),
         index_block(&index_block_options),
+        top_level_index(&index_block_options),
+        filter_base(0),
         num_entries(0),
         closed(false),
         filter_block(opt.filter_policy == nullptr
@@ -42,6 +44,15 @@ struct TableBuilder::Rep {
   Status status;
   BlockBuilder data_block;
   BlockBuilder index_block;
+
+  // If options.partition_index_and_filters is true, index_block and
+  // filter_block only hold the current partition, and top_level_index maps
+  // the last key of each partition to the handles of its index partition
+  // and filter partition, followed by filter_base.  The filter partition
+  // sees the offsets of its data blocks relative to filter_base.
+  BlockBuilder top_level_index;
+  uint64_t filter_base;
+
   std::string last_key;
   int64_t num_entries;
   bool closed;  // Either Finish() or Abandon() has been called.
@@ -82,6 +93,11 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (options.partition_index_and_filters !=
+      rep_->options.partition_index_and_filters) {
+    return Status::InvalidArgument(
+        "changing partition_index_and_filters while building table");
+  }
 
   // Note that any live BlockBuilders point to rep_->options and therefore
   // will automatically pick up the updated options.
@@ -106,6 +122,11 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
     r->pending_handle.EncodeTo(&handle_encoding);
     r->index_block.Add(r->last_key, Slice(handle_encoding));
     r->pending_index_entry = false;
+    if (r->options.partition_index_and_filters &&
+        r->index_block.CurrentSizeEstimate() >=
+            r->options.metadata_block_size) {
+      FlushPartition();
+    }
   }
 
   if (r->filter_block != nullptr) {
@@ -134,7 +155,34 @@ void TableBuilder::Flush() {
     r->status = r->file->Flush();
   }
   if (r->filter_block != nullptr) {
-    r->filter_block->StartBlock(r->offset);
+    r->filter_block->StartBlock(r->offset - r->filter_base);
+  }
+}
+
+void TableBuilder::FlushPartition() {
+  Rep* r = rep_;
+  assert(!r->pending_index_entry);
+  if (!ok() || r->index_block.empty()) return;
+  BlockHandle filter_handle, index_handle;
+  if (r->filter_block != nullptr) {
+    WriteRawBlock(r->filter_block->Finish(), kNoCompression, &filter_handle);
+  }
+  if (ok()) {
+    WriteBlock(&r->index_block, &index_handle);
+  }
+  if (ok()) {
+    // r->last_key is the last key of the index partition
+    std::string handle_encoding;
+    index_handle.EncodeTo(&handle_encoding);
+    if (r->filter_block != nullptr) {
+      filter_handle.EncodeTo(&handle_encoding);
+      PutVarint64(&handle_encoding, r->filter_base);
+      delete r->filter_block;
+      r->filter_block = new FilterBlockBuilder(r->options.filter_policy);
+      r->filter_base = r->offset;
+      r->filter_block->StartBlock(0);
+    }
+    r->top_level_index.Add(r->last_key, Slice(handle_encoding));
   }
 }
 
@@ -202,9 +250,10 @@ Status TableBuilder::Finish() {
   r->closed = true;
 
   BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle;
+  const bool partitioned = r->options.partition_index_and_filters;
 
   // Write filter block
-  if (ok() && r->filter_block != nullptr) {
+  if (ok() && r->filter_block != nullptr && !partitioned) {
     WriteRawBlock(r->filter_block->Finish(), kNoCompression,
                   &filter_block_handle);
   }
@@ -212,7 +261,13 @@ Status TableBuilder::Finish() {
   // Write metaindex block
   if (ok()) {
     BlockBuilder meta_index_block(&r->options);
-    if (r->filter_block != nullptr) {
+    if (r->filter_block != nullptr && partitioned) {
+      // Tell readers that the top-level index has the filter partitions
+      // of "Name"
+      std::string key = "partitionedfilter.";
+      key.append(r->options.filter_policy->Name());
+      meta_index_block.Add(key, Slice());
+    } else if (r->filter_block != nullptr) {
       // Add mapping from "filter.Name" to location of filter data
       std::string key = "filter.";
       key.append(r->options.filter_policy->Name());
@@ -234,7 +289,14 @@ Status TableBuilder::Finish() {
       r->index_block.Add(r->last_key, Slice(handle_encoding));
       r->pending_index_entry = false;
     }
-    WriteBlock(&r->index_block, &index_block_handle);
+    if (partitioned) {
+      FlushPartition();
+      if (ok()) {
+        WriteBlock(&r->top_level_index, &index_block_handle);
+      }
+    } else {
+      WriteBlock(&r->index_block, &index_block_handle);
+    }
   }
 
   // Write footer
@@ -242,6 +304,7 @@ Status TableBuilder::Finish() {
     Footer footer;
     footer.set_metaindex_handle(metaindex_block_handle);
     footer.set_index_handle(index_block_handle);
+    footer.set_partitioned_index(partitioned);
     std::string footer_encoding;
     footer.EncodeTo(&footer_encoding);
     r->status = r->file->Append(footer_encoding);
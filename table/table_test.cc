@@ -6,6 +6,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "db/dbformat.h"
@@ -18,6 +19,7 @@
 #include "table/block.h"
 #include "table/block_builder.h"
 #include "table/format.h"
+#include "util/coding.h"
 #include "util/random.h"
 #include "util/testutil.h"
 
@@ -376,30 +378,33 @@ struct TestArgs {
   TestType type;
   bool reverse_compare;
   int restart_interval;
+  bool partitioned;
 };
 
 static const TestArgs kTestArgList[] = {
-    {TABLE_TEST, false, 16},
-    {TABLE_TEST, false, 1},
-    {TABLE_TEST, false, 1024},
-    {TABLE_TEST, true, 16},
-    {TABLE_TEST, true, 1},
-    {TABLE_TEST, true, 1024},
-
-    {BLOCK_TEST, false, 16},
-    {BLOCK_TEST, false, 1},
-    {BLOCK_TEST, false, 1024},
-    {BLOCK_TEST, true, 16},
-    {BLOCK_TEST, true, 1},
-    {BLOCK_TEST, true, 1024},
+    {TABLE_TEST, false, 16, false},
+    {TABLE_TEST, false, 1, false},
+    {TABLE_TEST, false, 1024, false},
+    {TABLE_TEST, true, 16, false},
+    {TABLE_TEST, true, 1, false},
+    {TABLE_TEST, true, 1024, false},
+    {TABLE_TEST, false, 16, true},
+    {TABLE_TEST, true, 1, true},
+
+    {BLOCK_TEST, false, 16, false},
+    {BLOCK_TEST, false, 1, false},
+    {BLOCK_TEST, false, 1024, false},
+    {BLOCK_TEST, true, 16, false},
+    {BLOCK_TEST, true, 1, false},
+    {BLOCK_TEST, true, 1024, false},
 
     // Restart interval does not matter for memtables
-    {MEMTABLE_TEST, false, 16},
-    {MEMTABLE_TEST, true, 16},
+    {MEMTABLE_TEST, false, 16, false},
+    {MEMTABLE_TEST, true, 16, false},
 
     // Do not bother with restart interval variations for DB
-    {DB_TEST, false, 16},
-    {DB_TEST, true, 16},
+    {DB_TEST, false, 16, false},
+    {DB_TEST, true, 16, false},
 };
 static const int kNumTestArgs = sizeof(kTestArgList) / sizeof(kTestArgList[0]);
 
@@ -419,6 +424,10 @@ class Harness : public testing::Test {
     if (args.reverse_compare) {
       options_.comparator = &reverse_key_comparator;
     }
+    if (args.partitioned) {
+      options_.partition_index_and_filters = true;
+      options_.metadata_block_size = 64;
+    }
     switch (args.type) {
       case TABLE_TEST:
         constructor_ = new TableConstructor(options_.comparator);
@@ -699,7 +708,7 @@ TEST_F(Harness, Randomized) {
 
 TEST_F(Harness, RandomizedLongDB) {
   Random rnd(test::RandomSeed());
-  TestArgs args = {DB_TEST, false, 16};
+  TestArgs args = {DB_TEST, false, 16, false};
   Init(args);
   int num_entries = 100000;
   for (int e = 0; e < num_entries; e++) {
@@ -745,6 +754,73 @@ TEST(MemTableTest, Simple) {
   memtable->Unref();
 }
 
+TEST(BlockTest, HashIndex) {
+  InternalKeyComparator cmp(BytewiseComparator());
+  Options options;
+  options.block_restart_interval = 4;
+  options.use_data_block_hash_index = true;
+
+  // Several versions of every other user key, newest first.
+  std::vector<std::string> keys;
+  for (int i = 0; i < 200; i += 2) {
+    char user_key[20];
+    std::snprintf(user_key, sizeof(user_key), "key%06d", i);
+    for (SequenceNumber seq = 3 + i % 3; seq > 0; seq--) {
+      std::string key;
+      AppendInternalKey(&key,
+                        ParsedInternalKey(user_key, 10 * seq, kTypeValue));
+      keys.push_back(key);
+    }
+  }
+  for (bool hash_index : {false, true}) {
+    options.use_data_block_hash_index = hash_index;
+    BlockBuilder builder(&options, true);
+    for (const std::string& key : keys) {
+      builder.Add(key, "v");
+    }
+    BlockContents contents;
+    contents.data = builder.Finish();
+    contents.cachable = false;
+    contents.heap_allocated = false;
+    ASSERT_EQ(hash_index, (DecodeFixed32(contents.data.data() +
+                                         contents.data.size() - 4) &
+                           kBlockHashIndexFlag) != 0);
+    Block block(contents);
+
+    // Plain iteration skips the hash index.
+    Iterator* iter = block.NewIterator(&cmp);
+    size_t n = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), n++) {
+      ASSERT_EQ(keys[n], iter->key().ToString());
+    }
+    ASSERT_EQ(keys.size(), n);
+    ASSERT_LEVELDB_OK(iter->status());
+    delete iter;
+
+    for (int i = 0; i < 200; i++) {
+      char user_key[20];
+      std::snprintf(user_key, sizeof(user_key), "key%06d", i);
+      for (SequenceNumber snapshot = 5; snapshot < 60; snapshot += 10) {
+        LookupKey lkey(user_key, snapshot);
+        Iterator* expected = block.NewIterator(&cmp);
+        Iterator* lookup = block.NewPointLookupIterator(&cmp);
+        expected->Seek(lkey.internal_key());
+        lookup->Seek(lkey.internal_key());
+        ASSERT_LEVELDB_OK(lookup->status());
+        if (expected->Valid() &&
+            ExtractUserKey(expected->key()) == lkey.user_key()) {
+          ASSERT_TRUE(lookup->Valid());
+          ASSERT_EQ(expected->key().ToString(), lookup->key().ToString());
+        } else if (lookup->Valid()) {
+          ASSERT_NE(lkey.user_key(), ExtractUserKey(lookup->key()));
+        }
+        delete lookup;
+        delete expected;
+      }
+    }
+  }
+}
+
 static bool Between(uint64_t val, uint64_t low, uint64_t high) {
   bool result = (val >= low) && (val <= high);
   if (!result) {
@@ -11,6 +11,9 @@
 #include <cstdint>
 #include <vector>
 
+#include "port/port.h"
+#include "port/thread_annotations.h"
+
 namespace leveldb {
 
 class Arena {
@@ -28,6 +31,12 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc.
   char* AllocateAligned(size_t bytes);
 
+  // Thread-safe variants of Allocate() and AllocateAligned() that may be
+  // called from any number of threads at once.  They must not be mixed with
+  // concurrent calls of the variants above.
+  char* AllocateConcurrently(size_t bytes) LOCKS_EXCLUDED(mu_);
+  char* AllocateAlignedConcurrently(size_t bytes) LOCKS_EXCLUDED(mu_);
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena.
   size_t MemoryUsage() const {
@@ -42,6 +51,10 @@ class Arena {
   char* alloc_ptr_;
   size_t alloc_bytes_remaining_;
 
+  // Serializes the concurrent allocations.  The unsynchronized variants
+  // do not take it.
+  port::Mutex mu_;
+
   // Array of new[] allocated memory blocks
   std::vector<char*> blocks_;
 
@@ -5,8 +5,14 @@
 #include "leveldb/filter_policy.h"
 
 #include "leveldb/slice.h"
+#include "util/bloom.h"
 #include "util/hash.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define LEVELDB_BLOOM_AVX2 1
+#include <immintrin.h>
+#endif
+
 namespace leveldb {
 
 namespace {
@@ -83,10 +89,164 @@ class BloomFilterPolicy : public FilterPolicy {
   size_t bits_per_key_;
   size_t k_;
 };
+
+// A blocked bloom filter keeps the bits of each key in one 64-byte line of
+// the filter, chosen by the hash of the key.  The probes within the line
+// come from multiplying the hash by kProbeMultiplier over and over, and
+// taking the top 9 bits.
+//
+// Filter layout:
+//     lines: char[64 * num_lines]
+//     k: uint8
+static const size_t kLineBytes = 64;
+static const uint32_t kProbeMultiplier = 0x9e3779b9;
+
+static bool LineMayMatch(const char* line, uint32_t h, size_t k) {
+  for (size_t j = 0; j < k; j++) {
+    h *= kProbeMultiplier;
+    const uint32_t bitpos = h >> 23;
+    if ((line[bitpos / 8] & (1 << (bitpos % 8))) == 0) return false;
+  }
+  return true;
+}
+
+#if LEVELDB_BLOOM_AVX2
+// Same as LineMayMatch(), but checks eight probes at a time.  Lane i of
+// "hashes" holds the hash of probe i + 1, and the bits of the line are
+// looked up as sixteen little-endian 32-bit words.
+__attribute__((target("avx2"))) static bool LineMayMatchAVX2(
+    const char* line, uint32_t h, size_t k) {
+  const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line));
+  const __m256i hi =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line + 32));
+  // kProbeMultiplier to the powers 1 to 8
+  __m256i hashes = _mm256_mullo_epi32(
+      _mm256_set1_epi32(h),
+      _mm256_setr_epi32(0x9e3779b9, 0xe35e67b1, 0x734297e9, 0x35fbe861,
+                        0xdeb7c719, 0x0448b211, 0x3459b749, 0xab25f4c1));
+  const __m256i next = _mm256_set1_epi32(0xab25f4c1);
+  for (size_t remaining = k;; remaining -= 8) {
+    const __m256i bitpos = _mm256_srli_epi32(hashes, 23);
+    const __m256i word = _mm256_srli_epi32(bitpos, 5);
+    // Bit 3 of the word index picks the upper half of the line.
+    const __m256 in_hi = _mm256_castsi256_ps(_mm256_slli_epi32(word, 28));
+    const __m256i words = _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_castsi256_ps(_mm256_permutevar8x32_epi32(lo, word)),
+        _mm256_castsi256_ps(_mm256_permutevar8x32_epi32(hi, word)), in_hi));
+    const __m256i bits = _mm256_sllv_epi32(
+        _mm256_set1_epi32(1), _mm256_and_si256(bitpos, _mm256_set1_epi32(31)));
+    const __m256i unset = _mm256_cmpeq_epi32(_mm256_and_si256(words, bits),
+                                             _mm256_setzero_si256());
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(unset));
+    if (remaining < 8) mask &= (1 << remaining) - 1;
+    if (mask != 0) return false;
+    if (remaining <= 8) return true;
+    hashes = _mm256_mullo_epi32(hashes, next);
+  }
+}
+
+#endif  // LEVELDB_BLOOM_AVX2
+
+class BlockedBloomFilterPolicy : public FilterPolicy {
+ public:
+  BlockedBloomFilterPolicy(int bits_per_key, bool use_avx2)
+      : bits_per_key_(bits_per_key) {
+    k_ = static_cast<size_t>(bits_per_key * 0.69);  // 0.69 =~ ln(2)
+    if (k_ < 1) k_ = 1;
+    if (k_ > 30) k_ = 30;
+#if LEVELDB_BLOOM_AVX2
+    use_avx2_ = use_avx2;
+#else
+    (void)use_avx2;
+#endif  // LEVELDB_BLOOM_AVX2
+  }
+
+  const char* Name() const override {
+    return "leveldb.BuiltinBlockedBloomFilter";
+  }
+
+  void CreateFilter(const Slice* keys, int n, std::string* dst) const override {
+    size_t lines = (n * bits_per_key_ + kLineBytes * 8 - 1) / (kLineBytes * 8);
+    if (lines < 1) lines = 1;
+
+    const size_t init_size = dst->size();
+    dst->resize(init_size + lines * kLineBytes, 0);
+    dst->push_back(static_cast<char>(k_));  // Remember # of probes in filter
+    char* array = &(*dst)[init_size];
+    for (int i = 0; i < n; i++) {
+      uint32_t h = BloomHash(keys[i]);
+      char* line = array + LineOf(h, lines) * kLineBytes;
+      for (size_t j = 0; j < k_; j++) {
+        h *= kProbeMultiplier;
+        const uint32_t bitpos = h >> 23;
+        line[bitpos / 8] |= (1 << (bitpos % 8));
+      }
+    }
+  }
+
+  bool KeyMayMatch(const Slice& key, const Slice& bloom_filter) const override {
+    const size_t len = bloom_filter.size();
+    if (len < 2) return false;
+    if ((len - 1) % kLineBytes != 0) {
+      // Not a filter of this policy.  Consider it a match.
+      return true;
+    }
+
+    const char* array = bloom_filter.data();
+    const size_t k = array[len - 1];
+    if (k > 30) {
+      // Reserved for potentially new encodings.  Consider it a match.
+      return true;
+    }
+
+    const uint32_t h = BloomHash(key);
+    const char* line = array + LineOf(h, (len - 1) / kLineBytes) * kLineBytes;
+#if LEVELDB_BLOOM_AVX2
+    if (use_avx2_) {
+      return LineMayMatchAVX2(line, h, k);
+    }
+#endif  // LEVELDB_BLOOM_AVX2
+    return LineMayMatch(line, h, k);
+  }
+
+ private:
+  // Maps h uniformly onto [0, lines) without a division.
+  static size_t LineOf(uint32_t h, size_t lines) {
+    return static_cast<size_t>((static_cast<uint64_t>(h) * lines) >> 32);
+  }
+
+  size_t bits_per_key_;
+  size_t k_;
+#if LEVELDB_BLOOM_AVX2
+  bool use_avx2_;
+#endif  // LEVELDB_BLOOM_AVX2
+};
 }  // namespace
 
 const FilterPolicy* NewBloomFilterPolicy(int bits_per_key) {
   return new BloomFilterPolicy(bits_per_key);
 }
 
+const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key) {
+  return new BlockedBloomFilterPolicy(bits_per_key, bloom::CanUseAVX2());
+}
+
+namespace bloom {
+
+bool CanUseAVX2() {
+#if LEVELDB_BLOOM_AVX2
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif  // LEVELDB_BLOOM_AVX2
+}
+
+const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key,
+                                                bool use_avx2) {
+  return new BlockedBloomFilterPolicy(bits_per_key, use_avx2);
+}
+
+}  // namespace bloom
+
 }  // namespace leveldb
@@ -0,0 +1,27 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_BLOOM_H_
+#define STORAGE_LEVELDB_UTIL_BLOOM_H_
+
+namespace leveldb {
+
+class FilterPolicy;
+
+namespace bloom {
+
+// Return true if the policies of NewBlockedBloomFilterPolicy() probe their
+// filters with AVX2 on this CPU.
+bool CanUseAVX2();
+
+// Same as NewBlockedBloomFilterPolicy(), but the filters are probed with
+// AVX2 if "use_avx2" and with the scalar code otherwise.  For testing.
+// REQUIRES: !use_avx2 || CanUseAVX2()
+const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key,
+                                                bool use_avx2);
+
+}  // namespace bloom
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_BLOOM_H_
@@ -22,6 +22,28 @@ Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
 
+Status Env::NewWritableFileAt(const std::string& fname, uint64_t offset,
+                              WritableFile** result) {
+  (void)offset;
+  return Status::NotSupported("NewWritableFileAt", fname);
+}
+
+Status Env::NewDirectSequentialFile(const std::string& fname,
+                                    SequentialFile** result) {
+  return Status::NotSupported("NewDirectSequentialFile", fname);
+}
+
+Status Env::NewDirectRandomAccessFile(const std::string& fname,
+                                      RandomAccessFile** result) {
+  return Status::NotSupported("NewDirectRandomAccessFile", fname);
+}
+
+Status Env::NewDirectWritableFileAt(const std::string& fname, uint64_t offset,
+                                    WritableFile** result) {
+  (void)offset;
+  return Status::NotSupported("NewDirectWritableFileAt", fname);
+}
+
 Status Env::RemoveDir(const std::string& dirname) { return DeleteDir(dirname); }
 Status Env::DeleteDir(const std::string& dirname) { return RemoveDir(dirname); }
 
@@ -32,8 +54,23 @@ SequentialFile::~SequentialFile() = default;
 
 RandomAccessFile::~RandomAccessFile() = default;
 
+void RandomAccessFile::MultiRead(ReadRequest* reqs, size_t num_reqs) const {
+  for (size_t i = 0; i < num_reqs; i++) {
+    ReadRequest* req = &reqs[i];
+    req->status = Read(req->offset, req->n, &req->result, req->scratch);
+  }
+}
+
 WritableFile::~WritableFile() = default;
 
+Status WritableFile::SyncedAppendv(const Slice* data, size_t n) {
+  Status s;
+  for (size_t i = 0; i < n && s.ok(); i++) {
+    s = SyncedAppend(data[i]);
+  }
+  return s;
+}
+
 Logger::~Logger() = default;
 
 FileLock::~FileLock() = default;
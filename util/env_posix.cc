@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
 #include <cstddef>
@@ -12,6 +13,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <limits>
+#include <memory>
 #include <pthread.h>
 #include <queue>
 #include <set>
@@ -21,10 +23,12 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <thread>
 #include <type_traits>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 
 #include "leveldb/env.h"
 #include "leveldb/slice.h"
@@ -35,6 +39,11 @@
 #include "util/env_posix_test_helper.h"
 #include "util/posix_logger.h"
 
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif  // HAVE_IO_URING
+
 namespace leveldb {
 
 namespace {
@@ -142,11 +151,235 @@ class PosixSequentialFile final : public SequentialFile {
     return Status::OK();
   }
 
+  Status DeallocateDiskSpace(uint64_t offset, size_t len) override {
+#if HAVE_FALLOCATE && defined(FALLOC_FL_PUNCH_HOLE)
+    if (::fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                    static_cast<off_t>(offset), static_cast<off_t>(len)) != 0) {
+      return PosixError(filename_, errno);
+    }
+    return Status::OK();
+#else
+    (void)offset;
+    (void)len;
+    return Status::NotSupported("DeallocateDiskSpace", filename_);
+#endif  // HAVE_FALLOCATE && defined(FALLOC_FL_PUNCH_HOLE)
+  }
+
  private:
   const int fd_;
   const std::string filename_;
 };
 
+#if HAVE_IO_URING
+// Submits batches of reads through an io_uring instance, which the kernel
+// may serve concurrently, and waits for them to complete.  The syscalls are
+// issued directly so that liburing is not required.
+//
+// Instances are not thread-safe; each thread uses its own, see ForThread().
+class IoUring {
+ public:
+  // Returns the calling thread's instance, or nullptr if io_uring is not
+  // available, e.g. because the kernel is too old or the syscalls are
+  // blocked.
+  static IoUring* ForThread() {
+    static std::atomic<bool> unavailable(false);
+    thread_local IoUring ring;
+    if (!ring.initialized_) {
+      if (unavailable.load(std::memory_order_relaxed)) {
+        return nullptr;
+      }
+      if (!ring.Init()) {
+        unavailable.store(true, std::memory_order_relaxed);
+        return nullptr;
+      }
+    }
+    return ring.broken_ ? nullptr : &ring;
+  }
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  // Read reqs[0,n-1] from |fd|.  Requests that the kernel could not
+  // serve are marked in |fallback| and left for the caller to read.
+  void Read(int fd, const std::string& filename,
+            RandomAccessFile::ReadRequest* reqs, size_t n, bool* fallback) {
+    size_t next = 0;
+    size_t queued = 0;  // In the submission queue, not yet consumed
+    size_t in_flight = 0;
+    while (next < n || queued > 0 || in_flight > 0) {
+      // Queue as many reads as there are free submission entries.
+      unsigned tail = *sq_tail_;
+      while (next < n && in_flight + queued < sq_entries_) {
+        const unsigned index = tail & *sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(reqs[next].scratch);
+        sqe->len = static_cast<uint32_t>(reqs[next].n);
+        sqe->off = reqs[next].offset;
+        sqe->user_data = next;
+        sq_array_[index] = index;
+        tail++;
+        next++;
+        queued++;
+      }
+      __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+      const long ret = ::syscall(__NR_io_uring_enter, ring_fd_, queued, 1,
+                                 IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0) {
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+          // The ring is unusable.  The kernel may still be reading into the
+          // buffers of the reads in flight, so wait for them before the
+          // caller gets the buffers back; it does the remaining reads.
+          broken_ = true;
+          Reap(filename, reqs, fallback, &in_flight);
+          while (in_flight > 0) {
+            if (::syscall(__NR_io_uring_enter, ring_fd_, 0, 1,
+                          IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+              // Completions are still posted to the shared ring.
+              std::this_thread::yield();
+            }
+            Reap(filename, reqs, fallback, &in_flight);
+          }
+          for (size_t i = 0; i < n; i++) {
+            if (!completed_[i]) fallback[i] = true;
+          }
+          return;
+        }
+      } else {
+        // The kernel may consume fewer entries than were queued.
+        queued -= ret;
+        in_flight += ret;
+      }
+
+      Reap(filename, reqs, fallback, &in_flight);
+    }
+  }
+
+  // Marks the requests of the next Read() as not completed.
+  void Reset(size_t n) { completed_.assign(n, false); }
+
+ private:
+  // Consumes the completions in the completion queue, and decrements
+  // *in_flight by their number.
+  void Reap(const std::string& filename, RandomAccessFile::ReadRequest* reqs,
+            bool* fallback, size_t* in_flight) {
+    unsigned head = *cq_head_;
+    const unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != cq_tail) {
+      const io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+      RandomAccessFile::ReadRequest* req = &reqs[cqe->user_data];
+      completed_[cqe->user_data] = true;
+      if (cqe->res >= 0) {
+        req->result = Slice(req->scratch, cqe->res);
+        req->status = Status::OK();
+      } else if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+        // IORING_OP_READ is not supported by this kernel.
+        fallback[cqe->user_data] = true;
+      } else {
+        req->result = Slice(req->scratch, 0);
+        req->status = PosixError(filename, -cqe->res);
+      }
+      head++;
+      (*in_flight)--;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+  // Number of submission queue entries, which bounds the reads in flight.
+  static constexpr unsigned kQueueDepth = 64;
+
+  IoUring() : initialized_(false), broken_(false), ring_fd_(-1) {}
+
+  ~IoUring() {
+    if (initialized_) {
+      ::munmap(sqes_, sqes_size_);
+      if (cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_size_);
+      ::munmap(sq_ptr_, sq_size_);
+      ::close(ring_fd_);
+    }
+  }
+
+  bool Init() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd_ = ::syscall(__NR_io_uring_setup, kQueueDepth, &params);
+    if (ring_fd_ < 0) {
+      return false;
+    }
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+    sq_ptr_ = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+      ::close(ring_fd_);
+      return false;
+    }
+    cq_ptr_ = sq_ptr_;
+    if (!single_mmap) {
+      cq_ptr_ = ::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+      if (cq_ptr_ == MAP_FAILED) {
+        ::munmap(sq_ptr_, sq_size_);
+        ::close(ring_fd_);
+        return false;
+      }
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = reinterpret_cast<io_uring_sqe*>(
+        ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED) {
+      if (cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_size_);
+      ::munmap(sq_ptr_, sq_size_);
+      ::close(ring_fd_);
+      return false;
+    }
+
+    char* sq = reinterpret_cast<char*>(sq_ptr_);
+    char* cq = reinterpret_cast<char*>(cq_ptr_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    sq_entries_ = params.sq_entries;
+    initialized_ = true;
+    return true;
+  }
+
+  bool initialized_;
+  bool broken_;  // A syscall failed; the ring is no longer used.
+  int ring_fd_;
+  unsigned sq_entries_;
+  std::vector<bool> completed_;  // Indexed like the requests of Read()
+
+  void* sq_ptr_;
+  void* cq_ptr_;
+  size_t sq_size_;
+  size_t cq_size_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  io_uring_cqe* cqes_;
+};
+#endif  // HAVE_IO_URING
+
 // Implements random read access in a file using pread().
 //
 // Instances of this class are thread-safe, as required by the RandomAccessFile
@@ -202,6 +435,49 @@ class PosixRandomAccessFile final : public RandomAccessFile {
     return status;
   }
 
+#if HAVE_IO_URING
+  // Keeps the reads in flight together through io_uring when the kernel
+  // supports it.
+  void MultiRead(ReadRequest* reqs, size_t num_reqs) const override {
+    IoUring* ring = (num_reqs > 1) ? IoUring::ForThread() : nullptr;
+    if (ring == nullptr) {
+      RandomAccessFile::MultiRead(reqs, num_reqs);
+      return;
+    }
+
+    int fd = fd_;
+    if (!has_permanent_fd_) {
+      fd = ::open(filename_.c_str(), O_RDONLY | kOpenBaseFlags);
+      if (fd < 0) {
+        Status status = PosixError(filename_, errno);
+        for (size_t i = 0; i < num_reqs; i++) {
+          reqs[i].result = Slice(reqs[i].scratch, 0);
+          reqs[i].status = status;
+        }
+        return;
+      }
+    }
+
+    std::unique_ptr<bool[]> fallback_flags(new bool[num_reqs]());
+    ring->Reset(num_reqs);
+    ring->Read(fd, filename_, reqs, num_reqs, fallback_flags.get());
+    for (size_t i = 0; i < num_reqs; i++) {
+      if (fallback_flags[i]) {
+        ReadRequest* req = &reqs[i];
+        ssize_t read_size = ::pread(fd, req->scratch, req->n,
+                                    static_cast<off_t>(req->offset));
+        req->result = Slice(req->scratch, (read_size < 0) ? 0 : read_size);
+        req->status =
+            (read_size < 0) ? PosixError(filename_, errno) : Status::OK();
+      }
+    }
+
+    if (!has_permanent_fd_) {
+      ::close(fd);
+    }
+  }
+#endif  // HAVE_IO_URING
+
  private:
   const bool has_permanent_fd_;  // If false, the file is opened on every read.
   const int fd_;                 // -1 if has_permanent_fd_ is false.
@@ -253,6 +529,25 @@ class PosixMmapReadableFile final : public RandomAccessFile {
   const std::string filename_;
 };
 
+// Implements WritableFile::Allocate() for |fd|.
+Status AllocateZeroRange(int fd, const std::string& filename, uint64_t offset,
+                         uint64_t len, bool keep_size) {
+#if HAVE_FALLOCATE && defined(FALLOC_FL_ZERO_RANGE)
+  const int mode = FALLOC_FL_ZERO_RANGE | (keep_size ? FALLOC_FL_KEEP_SIZE : 0);
+  if (::fallocate(fd, mode, static_cast<off_t>(offset),
+                  static_cast<off_t>(len)) == 0) {
+    return Status::OK();
+  }
+  return PosixError(filename, errno);
+#else
+  (void)fd;
+  (void)offset;
+  (void)len;
+  (void)keep_size;
+  return Status::NotSupported("Allocate", filename);
+#endif  // HAVE_FALLOCATE && defined(FALLOC_FL_ZERO_RANGE)
+}
+
 class PosixWritableFile final : public WritableFile {
  public:
   PosixWritableFile(std::string filename, int fd)
@@ -302,6 +597,51 @@ class PosixWritableFile final : public WritableFile {
     return WriteUnbuffered(data.data(), data.size());
   }
 
+  Status SyncedAppendv(const Slice* data, size_t n) override {
+    Status status = FlushBuffer();
+    if (!status.ok()) {
+      return status;
+    }
+
+    static constexpr size_t kMaxIovecs = 16;
+    while (n > 0) {
+      struct iovec iov[kMaxIovecs];
+      const size_t count = std::min(n, kMaxIovecs);
+      for (size_t i = 0; i < count; i++) {
+        iov[i].iov_base = const_cast<char*>(data[i].data());
+        iov[i].iov_len = data[i].size();
+      }
+      ssize_t write_result = ::writev(fd_, iov, static_cast<int>(count));
+      if (write_result < 0) {
+        if (errno == EINTR) {
+          continue;  // Retry
+        }
+        return PosixError(filename_, errno);
+      }
+      // Finish a short write with plain writes.
+      size_t written = static_cast<size_t>(write_result);
+      for (size_t i = 0; i < count; i++) {
+        if (written >= data[i].size()) {
+          written -= data[i].size();
+          continue;
+        }
+        status = WriteUnbuffered(data[i].data() + written,
+                                 data[i].size() - written);
+        if (!status.ok()) {
+          return status;
+        }
+        written = 0;
+      }
+      data += count;
+      n -= count;
+    }
+    return Status::OK();
+  }
+
+  Status Allocate(uint64_t offset, uint64_t len, bool keep_size) override {
+    return AllocateZeroRange(fd_, filename_, offset, len, keep_size);
+  }
+
   Status Close() override {
     Status status = FlushBuffer();
     const int close_result = ::close(fd_);
@@ -447,6 +787,369 @@ class PosixWritableFile final : public WritableFile {
   const std::string dirname_;  // The directory of filename_.
 };
 
+#if HAVE_O_DIRECT
+// Offsets, lengths and buffer addresses of direct I/O must be multiples of
+// the logical block size of the device, which is at most this many bytes.
+constexpr const size_t kDirectIOAlignment = 4096;
+
+// Direct reads and writes are staged in buffers of this many bytes.
+constexpr const size_t kDirectIOBufferSize = 256 * 1024;
+
+uint64_t AlignDown(uint64_t n) { return n & ~uint64_t{kDirectIOAlignment - 1}; }
+
+uint64_t AlignUp(uint64_t n) { return AlignDown(n + kDirectIOAlignment - 1); }
+
+// A heap buffer aligned for direct I/O.
+class AlignedBuffer {
+ public:
+  AlignedBuffer() : data_(nullptr), capacity_(0) {}
+  ~AlignedBuffer() { std::free(data_); }
+
+  AlignedBuffer(const AlignedBuffer&) = delete;
+  AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+  // Make room for at least |n| bytes.  The contents are lost if the buffer
+  // has to grow.  Returns false if the memory can not be allocated.
+  bool Reserve(size_t n) {
+    if (n <= capacity_) {
+      return true;
+    }
+    std::free(data_);
+    data_ = nullptr;
+    capacity_ = 0;
+    void* data;
+    if (::posix_memalign(&data, kDirectIOAlignment, AlignUp(n)) != 0) {
+      return false;
+    }
+    data_ = reinterpret_cast<char*>(data);
+    capacity_ = AlignUp(n);
+    return true;
+  }
+
+  char* data() const { return data_; }
+
+ private:
+  char* data_;
+  size_t capacity_;
+};
+
+// Reads up to |n| bytes at |offset| of |fd| into |buf|, which are all
+// aligned for direct I/O, and stores the number of bytes read in
+// *|bytes_read|.  Reads fewer bytes only at the end of the file.
+Status DirectRead(int fd, const std::string& filename, uint64_t offset,
+                  size_t n, char* buf, size_t* bytes_read) {
+  *bytes_read = 0;
+  while (*bytes_read < n) {
+    ::ssize_t read_size = ::pread(fd, buf + *bytes_read, n - *bytes_read,
+                                  static_cast<off_t>(offset + *bytes_read));
+    if (read_size < 0) {
+      if (errno == EINTR) {
+        continue;  // Retry
+      }
+      return PosixError(filename, errno);
+    }
+    *bytes_read += read_size;
+    // A read that stops short of a block boundary hit the end of the file.
+    if (read_size == 0 || *bytes_read % kDirectIOAlignment != 0) {
+      break;
+    }
+  }
+  return Status::OK();
+}
+
+// Implements sequential read access in a file using direct I/O.  The file
+// is read in aligned chunks of kDirectIOBufferSize bytes, which serve the
+// Read() calls that follow.
+//
+// Instances of this class are thread-friendly but not thread-safe, as required
+// by the SequentialFile API.
+class PosixDirectSequentialFile final : public SequentialFile {
+ public:
+  PosixDirectSequentialFile(std::string filename, int fd)
+      : fd_(fd),
+        filename_(std::move(filename)),
+        offset_(0),
+        buf_start_(0),
+        buf_size_(0) {}
+  ~PosixDirectSequentialFile() override { ::close(fd_); }
+
+  Status Read(size_t n, Slice* result, char* scratch) override {
+    size_t copied = 0;
+    while (copied < n) {
+      if (offset_ < buf_start_ || offset_ >= buf_start_ + buf_size_) {
+        if (!buf_.Reserve(kDirectIOBufferSize)) {
+          *result = Slice(scratch, copied);
+          return Status::IOError(filename_, "can not allocate read buffer");
+        }
+        buf_start_ = AlignDown(offset_);
+        Status status =
+            DirectRead(fd_, filename_, buf_start_, kDirectIOBufferSize,
+                       buf_.data(), &buf_size_);
+        if (!status.ok()) {
+          buf_size_ = 0;
+          *result = Slice(scratch, copied);
+          return status;
+        }
+        if (offset_ >= buf_start_ + buf_size_) {
+          break;  // End of file
+        }
+      }
+      const size_t available = buf_start_ + buf_size_ - offset_;
+      const size_t copy_size = std::min(n - copied, available);
+      std::memcpy(scratch + copied, buf_.data() + (offset_ - buf_start_),
+                  copy_size);
+      copied += copy_size;
+      offset_ += copy_size;
+    }
+    *result = Slice(scratch, copied);
+    return Status::OK();
+  }
+
+  Status Skip(uint64_t n) override {
+    offset_ += n;
+    return Status::OK();
+  }
+
+  Status Jump(uint64_t n) override {
+    offset_ = n;
+    return Status::OK();
+  }
+
+ private:
+  const int fd_;
+  const std::string filename_;
+  uint64_t offset_;  // Position of the next Read()
+  // buf_[0, buf_size_ - 1] holds the file bytes from buf_start_ on.
+  AlignedBuffer buf_;
+  uint64_t buf_start_;
+  size_t buf_size_;
+};
+
+// Implements random read access in a file using direct I/O.  Each read
+// covers the blocks of the requested range and copies the range out.
+//
+// Instances of this class are thread-safe, as required by the RandomAccessFile
+// API. Instances are immutable and Read() only calls thread-safe library
+// functions.
+class PosixDirectRandomAccessFile final : public RandomAccessFile {
+ public:
+  PosixDirectRandomAccessFile(std::string filename, int fd)
+      : fd_(fd), filename_(std::move(filename)) {}
+  ~PosixDirectRandomAccessFile() override { ::close(fd_); }
+
+  Status Read(uint64_t offset, size_t n, Slice* result,
+              char* scratch) const override {
+    const uint64_t start = AlignDown(offset);
+    const size_t size = AlignUp(offset + n) - start;
+    // Small reads, which are most of the value reads, are staged on the
+    // stack.
+    alignas(kDirectIOAlignment) char stack_buf[2 * kDirectIOAlignment];
+    AlignedBuffer heap_buf;
+    char* buf = stack_buf;
+    if (size > sizeof(stack_buf)) {
+      if (!heap_buf.Reserve(size)) {
+        *result = Slice();
+        return Status::IOError(filename_, "can not allocate read buffer");
+      }
+      buf = heap_buf.data();
+    }
+
+    size_t read_size;
+    Status status = DirectRead(fd_, filename_, start, size, buf, &read_size);
+    size_t copy_size = 0;
+    if (status.ok() && read_size > offset - start) {
+      copy_size = std::min<size_t>(n, read_size - (offset - start));
+      std::memcpy(scratch, buf + (offset - start), copy_size);
+    }
+    *result = Slice(scratch, copy_size);
+    return status;
+  }
+
+ private:
+  const int fd_;
+  const std::string filename_;
+};
+
+// Implements writes with direct I/O.  Appended data is staged in an aligned
+// buffer that starts at a block boundary of the file.  Writing the buffer
+// pads it with zeros to the next block boundary and keeps its last partial
+// block, which is written again, completed, by the next write.  Close()
+// truncates the padding.
+class PosixDirectWritableFile final : public WritableFile {
+ public:
+  // The file is written from |offset| on.  |file_size| is the size of the
+  // file when it was opened.
+  PosixDirectWritableFile(std::string filename, int fd, uint64_t offset,
+                          uint64_t file_size)
+      : fd_(fd),
+        filename_(std::move(filename)),
+        buf_offset_(AlignDown(offset)),
+        pos_(offset - buf_offset_),
+        dirty_(false),
+        file_size_(file_size),
+        written_end_(0) {}
+
+  ~PosixDirectWritableFile() override {
+    if (fd_ >= 0) {
+      // Ignoring any potential errors
+      Close();
+    }
+  }
+
+  // Load the part of the block at the starting offset that comes before it.
+  Status ReadHead() {
+    if (pos_ == 0) {
+      return Status::OK();
+    }
+    if (!buf_.Reserve(kDirectIOBufferSize)) {
+      return Status::IOError(filename_, "can not allocate write buffer");
+    }
+    size_t read_size;
+    Status status = DirectRead(fd_, filename_, buf_offset_, kDirectIOAlignment,
+                               buf_.data(), &read_size);
+    if (status.ok() && read_size < pos_) {
+      // The file ends before the starting offset.
+      std::memset(buf_.data() + read_size, 0, pos_ - read_size);
+    }
+    return status;
+  }
+
+  Status Append(const Slice& data) override {
+    const char* write_data = data.data();
+    size_t write_size = data.size();
+    while (write_size > 0) {
+      if (!buf_.Reserve(kDirectIOBufferSize)) {
+        return Status::IOError(filename_, "can not allocate write buffer");
+      }
+      const size_t copy_size =
+          std::min(write_size, kDirectIOBufferSize - pos_);
+      std::memcpy(buf_.data() + pos_, write_data, copy_size);
+      write_data += copy_size;
+      write_size -= copy_size;
+      pos_ += copy_size;
+      dirty_ = true;
+      if (pos_ == kDirectIOBufferSize) {
+        Status status = WriteBuffer();
+        if (!status.ok()) {
+          return status;
+        }
+      }
+    }
+    return Status::OK();
+  }
+
+  Status SyncedAppend(const Slice& data) override {
+    Status status = Append(data);
+    if (status.ok()) {
+      status = WriteBuffer();
+    }
+    return status;
+  }
+
+  Status SyncedAppendv(const Slice* data, size_t n) override {
+    Status status;
+    for (size_t i = 0; i < n && status.ok(); i++) {
+      status = Append(data[i]);
+    }
+    if (status.ok()) {
+      status = WriteBuffer();
+    }
+    return status;
+  }
+
+  Status Allocate(uint64_t offset, uint64_t len, bool keep_size) override {
+    Status status = AllocateZeroRange(fd_, filename_, offset, len, keep_size);
+    if (status.ok() && !keep_size) {
+      file_size_ = std::max(file_size_, offset + len);
+    }
+    return status;
+  }
+
+  Status Close() override {
+    Status status = WriteBuffer();
+    // Drop the padding, but not the space that the file had before.
+    const uint64_t size = std::max(buf_offset_ + pos_, file_size_);
+    if (status.ok() && written_end_ > size &&
+        ::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+      status = PosixError(filename_, errno);
+    }
+    const int close_result = ::close(fd_);
+    if (close_result < 0 && status.ok()) {
+      status = PosixError(filename_, errno);
+    }
+    fd_ = -1;
+    return status;
+  }
+
+  Status Flush() override { return WriteBuffer(); }
+
+  Status Sync() override {
+    Status status = WriteBuffer();
+    if (!status.ok()) {
+      return status;
+    }
+    // Direct I/O bypasses the page cache, but neither the device's cache
+    // nor the file's metadata.
+#if HAVE_FDATASYNC
+    bool sync_success = ::fdatasync(fd_) == 0;
+#else
+    bool sync_success = ::fsync(fd_) == 0;
+#endif  // HAVE_FDATASYNC
+    if (sync_success) {
+      return Status::OK();
+    }
+    return PosixError(filename_, errno);
+  }
+
+ private:
+  // Write the data appended since the last write, padded to the next block
+  // boundary, and keep its last partial block in buf_.
+  Status WriteBuffer() {
+    if (!dirty_) {
+      return Status::OK();
+    }
+    char* const buf = buf_.data();
+    const size_t write_size = AlignUp(pos_);
+    std::memset(buf + pos_, 0, write_size - pos_);
+    size_t written = 0;
+    while (written < write_size) {
+      ::ssize_t write_result =
+          ::pwrite(fd_, buf + written, write_size - written,
+                   static_cast<off_t>(buf_offset_ + written));
+      if (write_result < 0) {
+        if (errno == EINTR) {
+          continue;  // Retry
+        }
+        return PosixError(filename_, errno);
+      }
+      written += write_result;
+    }
+    written_end_ = std::max(written_end_, buf_offset_ + write_size);
+
+    const size_t tail = pos_ % kDirectIOAlignment;
+    const size_t full = pos_ - tail;
+    if (full > 0 && tail > 0) {
+      std::memcpy(buf, buf + full, tail);
+    }
+    buf_offset_ += full;
+    pos_ = tail;
+    dirty_ = false;
+    return Status::OK();
+  }
+
+  int fd_;
+  const std::string filename_;
+  // buf_[0, pos_ - 1] holds the file bytes from buf_offset_ on.  They are
+  // not all written yet if dirty_ is set.
+  AlignedBuffer buf_;
+  uint64_t buf_offset_;
+  size_t pos_;
+  bool dirty_;
+  uint64_t file_size_;    // The size the file keeps when it is closed
+  uint64_t written_end_;  // End of the blocks written, padding included
+};
+#endif  // HAVE_O_DIRECT
+
 int LockOrUnlock(int fd, bool lock) {
   errno = 0;
   struct ::flock file_lock_info;
@@ -591,6 +1294,78 @@ class PosixEnv : public Env {
     return Status::OK();
   }
 
+  Status NewWritableFileAt(const std::string& filename, uint64_t offset,
+                           WritableFile** result) override {
+    int fd =
+        ::open(filename.c_str(), O_WRONLY | O_CREAT | kOpenBaseFlags, 0644);
+    if (fd < 0) {
+      *result = nullptr;
+      return PosixError(filename, errno);
+    }
+    if (::lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+      Status status = PosixError(filename, errno);
+      ::close(fd);
+      *result = nullptr;
+      return status;
+    }
+
+    *result = new PosixWritableFile(filename, fd);
+    return Status::OK();
+  }
+
+#if HAVE_O_DIRECT
+  Status NewDirectSequentialFile(const std::string& filename,
+                                 SequentialFile** result) override {
+    int fd = ::open(filename.c_str(), O_RDONLY | O_DIRECT | kOpenBaseFlags);
+    if (fd < 0) {
+      *result = nullptr;
+      return PosixError(filename, errno);
+    }
+
+    *result = new PosixDirectSequentialFile(filename, fd);
+    return Status::OK();
+  }
+
+  Status NewDirectRandomAccessFile(const std::string& filename,
+                                   RandomAccessFile** result) override {
+    int fd = ::open(filename.c_str(), O_RDONLY | O_DIRECT | kOpenBaseFlags);
+    if (fd < 0) {
+      *result = nullptr;
+      return PosixError(filename, errno);
+    }
+
+    *result = new PosixDirectRandomAccessFile(filename, fd);
+    return Status::OK();
+  }
+
+  Status NewDirectWritableFileAt(const std::string& filename, uint64_t offset,
+                                 WritableFile** result) override {
+    *result = nullptr;
+    // The file is also read, to complete a partial block at |offset|.
+    int fd = ::open(filename.c_str(),
+                    O_RDWR | O_CREAT | O_DIRECT | kOpenBaseFlags, 0644);
+    if (fd < 0) {
+      return PosixError(filename, errno);
+    }
+    struct ::stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+      Status status = PosixError(filename, errno);
+      ::close(fd);
+      return status;
+    }
+
+    PosixDirectWritableFile* file =
+        new PosixDirectWritableFile(filename, fd, offset, file_stat.st_size);
+    Status status = file->ReadHead();
+    if (!status.ok()) {
+      delete file;
+      return status;
+    }
+    *result = file;
+    return Status::OK();
+  }
+#endif  // HAVE_O_DIRECT
+
   bool FileExists(const std::string& filename) override {
     return ::access(filename.c_str(), F_OK) == 0;
   }
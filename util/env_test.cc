@@ -5,6 +5,7 @@
 #include "leveldb/env.h"
 
 #include <algorithm>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "port/port.h"
@@ -70,6 +71,46 @@ TEST_F(EnvTest, ReadWrite) {
   delete sequential_file;
 }
 
+TEST_F(EnvTest, MultiRead) {
+  Random rnd(test::RandomSeed());
+
+  std::string test_dir;
+  ASSERT_LEVELDB_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file_name = test_dir + "/multi_read.txt";
+  std::string data;
+  test::RandomString(&rnd, 1 << 20, &data);
+  ASSERT_LEVELDB_OK(WriteStringToFile(env_, data, test_file_name));
+
+  RandomAccessFile* file;
+  ASSERT_LEVELDB_OK(env_->NewNonMmapRandomAccessFile(test_file_name, &file));
+
+  // More reads than an implementation is likely to keep in flight, the last
+  // one running past the end of the file.
+  static const int kNumReads = 200;
+  std::vector<RandomAccessFile::ReadRequest> reqs(kNumReads);
+  std::vector<std::string> scratch(kNumReads);
+  for (int i = 0; i < kNumReads; i++) {
+    reqs[i].offset = rnd.Uniform(data.size());
+    reqs[i].n = rnd.Skewed(14);
+    if (i == kNumReads - 1) {
+      reqs[i].offset = data.size() - 10;
+      reqs[i].n = 100;
+    }
+    scratch[i].resize(std::max<size_t>(reqs[i].n, 1));
+    reqs[i].scratch = &scratch[i][0];
+  }
+  file->MultiRead(reqs.data(), reqs.size());
+  for (int i = 0; i < kNumReads; i++) {
+    ASSERT_LEVELDB_OK(reqs[i].status);
+    size_t expected_size =
+        std::min<size_t>(reqs[i].n, data.size() - reqs[i].offset);
+    ASSERT_EQ(reqs[i].result.ToString(),
+              data.substr(reqs[i].offset, expected_size));
+  }
+  delete file;
+  ASSERT_LEVELDB_OK(env_->RemoveFile(test_file_name));
+}
+
 TEST_F(EnvTest, RunImmediately) {
   struct RunState {
     port::Mutex mu;
@@ -232,6 +273,108 @@ TEST_F(EnvTest, ReopenAppendableFile) {
   env_->RemoveFile(test_file_name);
 }
 
+TEST_F(EnvTest, SyncedAppendv) {
+  Random rnd(test::RandomSeed());
+  std::string test_dir;
+  ASSERT_LEVELDB_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file_name = test_dir + "/synced_appendv.txt";
+  env_->RemoveFile(test_file_name);
+
+  WritableFile* writable_file;
+  ASSERT_LEVELDB_OK(env_->NewWritableFile(test_file_name, &writable_file));
+  // Buffered data must be written ahead of the slices.
+  std::string data("hello world!");
+  ASSERT_LEVELDB_OK(writable_file->Append(data));
+
+  // More slices than a single writev() takes, some of them empty.
+  std::vector<std::string> pieces(40);
+  std::vector<Slice> slices;
+  for (std::string& piece : pieces) {
+    test::RandomString(&rnd, rnd.OneIn(4) ? 0 : rnd.Skewed(17), &piece);
+    slices.push_back(piece);
+    data += piece;
+  }
+  ASSERT_LEVELDB_OK(writable_file->SyncedAppendv(slices.data(), slices.size()));
+  ASSERT_LEVELDB_OK(writable_file->Close());
+  delete writable_file;
+
+  std::string read_result;
+  ASSERT_LEVELDB_OK(ReadFileToString(env_, test_file_name, &read_result));
+  ASSERT_EQ(data, read_result);
+  env_->RemoveFile(test_file_name);
+}
+
+TEST_F(EnvTest, DirectIO) {
+  Random rnd(test::RandomSeed());
+  std::string test_dir;
+  ASSERT_LEVELDB_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file_name = test_dir + "/direct_io.txt";
+  env_->RemoveFile(test_file_name);
+
+  WritableFile* writable_file;
+  Status s = env_->NewDirectWritableFileAt(test_file_name, 0, &writable_file);
+  if (!s.ok()) {
+    std::fprintf(stderr, "skipping test because env does not support direct "
+                         "I/O: %s\n", s.ToString().c_str());
+    return;
+  }
+  // Writes of any size at any offset, some of them across the staging
+  // buffer, each followed by a read of everything written so far.
+  std::string data;
+  for (int i = 0; i < 60; i++) {
+    std::string piece;
+    test::RandomString(&rnd, rnd.OneIn(10) ? 300000 : rnd.Skewed(14), &piece);
+    ASSERT_LEVELDB_OK(writable_file->SyncedAppend(piece));
+    data += piece;
+
+    RandomAccessFile* random_file;
+    ASSERT_LEVELDB_OK(
+        env_->NewDirectRandomAccessFile(test_file_name, &random_file));
+    const uint64_t offset = rnd.Uniform(data.size() + 1);
+    const size_t n = rnd.Uniform(data.size() - offset + 1);
+    std::string scratch(n, '\0');
+    Slice result;
+    ASSERT_LEVELDB_OK(random_file->Read(offset, n, &result, &scratch[0]));
+    ASSERT_EQ(data.substr(offset, n), result.ToString());
+    delete random_file;
+  }
+  ASSERT_LEVELDB_OK(writable_file->Close());
+  delete writable_file;
+
+  // The padding of the last block is gone.
+  uint64_t file_size;
+  ASSERT_LEVELDB_OK(env_->GetFileSize(test_file_name, &file_size));
+  ASSERT_EQ(data.size(), file_size);
+
+  // Write on from an offset inside a block, past the end of the file.
+  const uint64_t offset = data.size() - 1001;
+  ASSERT_LEVELDB_OK(
+      env_->NewDirectWritableFileAt(test_file_name, offset, &writable_file));
+  std::string piece;
+  test::RandomString(&rnd, 5000, &piece);
+  ASSERT_LEVELDB_OK(writable_file->SyncedAppend(piece));
+  data.resize(offset);
+  data += piece;
+  ASSERT_LEVELDB_OK(writable_file->Close());
+  delete writable_file;
+
+  SequentialFile* sequential_file;
+  ASSERT_LEVELDB_OK(
+      env_->NewDirectSequentialFile(test_file_name, &sequential_file));
+  ASSERT_LEVELDB_OK(sequential_file->Skip(7));
+  std::string read_result;
+  std::string scratch(70000, '\0');
+  Slice result;
+  do {
+    ASSERT_LEVELDB_OK(sequential_file->Read(scratch.size(), &result,
+                                            &scratch[0]));
+    read_result.append(result.data(), result.size());
+  } while (!result.empty());
+  delete sequential_file;
+  ASSERT_EQ(data.substr(7), read_result);
+  env_->RemoveFile(test_file_name);
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
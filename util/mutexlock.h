@@ -48,6 +48,20 @@ class SCOPED_LOCKABLE WLock {
   port::SharedMutex* const mu_;
 };
 
+class SCOPED_LOCKABLE RLock {
+ public:
+  explicit RLock(port::SharedMutex* mu) SHARED_LOCK_FUNCTION(mu) : mu_(mu) {
+    this->mu_->SharedLock();
+  }
+  ~RLock() UNLOCK_FUNCTION() { this->mu_->SharedUnlock(); }
+
+  RLock(const RLock&) = delete;
+  RLock& operator=(const RLock&) = delete;
+
+ private:
+  port::SharedMutex* const mu_;
+};
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_UTIL_MUTEXLOCK_H_
@@ -15,6 +15,16 @@ Options::Options()
       clean_write_buffer_size(128 << 10),
       clean_threshold(300 * 1024 * 1024),
       min_clean_threshold(clean_threshold / 5),
+      clean_rate_limit(32 * 1024 * 1024),
       log_dropCount_threshold(100),
-      max_vlog_size(1024 * 1024 * 1024) {}
+      max_vlog_size(1024 * 1024 * 1024),
+      preallocate_vlog(false),
+      vlog_preallocate_keep_size(false),
+      vlog_write_buffer_size(1 << 20),
+      use_direct_io_for_vlog(false),
+      max_sync_delay_micros(0),
+      enable_pipelined_write(false),
+      min_blob_size(0),
+      max_prefetch_threads(32),
+      max_readahead_bytes(4 * 1024 * 1024) {}
 }  // namespace leveldb